@@ -0,0 +1,183 @@
+#pragma once
+
+#include <sdbus-c++/sdbus-c++.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "DeviceTable.h"
+
+struct CoalescerStats
+{
+  uint64_t received = 0; // PropertiesChanged signals submitted
+  uint64_t dropped  = 0; // signals carrying nothing new
+  uint64_t merged   = 0; // signals folded into an already pending update
+  uint64_t emitted  = 0; // consolidated updates handed out
+};
+
+// Sits between BlueZ's per-advertisement PropertiesChanged storm and the
+// device table. Each property value is hashed and compared with the last
+// value seen for that device, so repeats are dropped outright; what remains
+// is merged per device and released once per window.
+class AdvertisementCoalescer
+{
+public:
+  using Clock      = std::chrono::steady_clock;
+  using Properties = std::map<std::string, sdbus::Variant>;
+
+  struct Update
+  {
+    std::string              path;
+    Properties               changed;
+    std::vector<std::string> invalidated;
+  };
+
+private:
+  struct DeviceState
+  {
+    std::unordered_map<std::string, uint64_t> lastHashes;
+    Properties                                pending;
+    std::vector<std::string>                  invalidated;
+    bool                                      queued = false;
+  };
+
+  std::unordered_map<std::string, DeviceState>          states;
+  std::deque<std::pair<Clock::time_point, std::string>> due;
+  std::chrono::milliseconds                             window;
+  CoalescerStats                                        counters;
+
+  static uint64_t hashValue(const sdbus::Variant& value)
+  {
+    return hashVariant(value, 0xcbf29ce484222325ULL);
+  }
+
+public:
+  explicit AdvertisementCoalescer(
+    std::chrono::milliseconds windowLength = std::chrono::milliseconds(0))
+    : window(windowLength)
+  {
+  }
+
+  void setWindow(std::chrono::milliseconds windowLength)
+  {
+    window = windowLength;
+  }
+  std::chrono::milliseconds getWindow() const { return window; }
+
+  // Records the full property set of a newly added device so subsequent
+  // repeats of those values are recognized as unchanged.
+  void prime(const std::string& path, const Properties& props)
+  {
+    DeviceState& state = states[path];
+    state.lastHashes.clear();
+    for (const auto& [key, value] : props)
+    {
+      state.lastHashes[key] = hashValue(value);
+    }
+  }
+
+  // Returns true when this update opened a new window for the device, i.e.
+  // the earliest pending deadline may have moved.
+  bool submit(const std::string&              path,
+              const Properties&               changed,
+              const std::vector<std::string>& invalidated,
+              Clock::time_point               now)
+  {
+    ++counters.received;
+
+    DeviceState& state   = states[path];
+    bool         hasNews = false;
+
+    for (const auto& [key, value] : changed)
+    {
+      uint64_t hash = hashValue(value);
+      auto     last = state.lastHashes.find(key);
+      if (last != state.lastHashes.end() && last->second == hash)
+        continue;
+
+      state.lastHashes[key] = hash;
+      state.pending[key]    = value;
+      state.invalidated.erase(std::remove(state.invalidated.begin(),
+                                          state.invalidated.end(), key),
+                              state.invalidated.end());
+      hasNews = true;
+    }
+
+    for (const auto& key : invalidated)
+    {
+      if (state.lastHashes.erase(key) == 0)
+        continue;
+
+      state.pending.erase(key);
+      state.invalidated.push_back(key);
+      hasNews = true;
+    }
+
+    if (!hasNews)
+    {
+      ++counters.dropped;
+      return false;
+    }
+
+    if (state.queued)
+    {
+      ++counters.merged;
+      return false;
+    }
+
+    state.queued = true;
+    due.emplace_back(now + window, path);
+    return true;
+  }
+
+  // Moves every device whose window has closed into `out`
+  size_t drainDue(Clock::time_point now, std::vector<Update>& out)
+  {
+    size_t count = 0;
+    while (!due.empty() && due.front().first <= now)
+    {
+      std::string path = std::move(due.front().second);
+      due.pop_front();
+
+      auto it = states.find(path);
+      if (it == states.end() || !it->second.queued)
+        continue;
+
+      DeviceState& state = it->second;
+      out.push_back({path, std::move(state.pending),
+                     std::move(state.invalidated)});
+      state.pending.clear();
+      state.invalidated.clear();
+      state.queued = false;
+
+      ++counters.emitted;
+      ++count;
+    }
+    return count;
+  }
+
+  bool nextDeadline(Clock::time_point& when) const
+  {
+    if (due.empty())
+      return false;
+    when = due.front().first;
+    return true;
+  }
+
+  // Drops all state for a device that left the table
+  void forget(const std::string& path) { states.erase(path); }
+
+  void clear()
+  {
+    states.clear();
+    due.clear();
+  }
+
+  const CoalescerStats& stats() const { return counters; }
+};
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <variant>
+
+#include "DeviceTable.h"
+#include "Uuid.h"
+
+// Non-owning view of advertisement bytes. Decoders only ever hand out views
+// into the record they were given, so parsing never copies or allocates.
+struct ByteView
+{
+  const uint8_t* data = nullptr;
+  size_t         size = 0;
+
+  uint8_t operator[](size_t index) const { return data[index]; }
+
+  ByteView subview(size_t offset, size_t length) const
+  {
+    return {data + offset, length};
+  }
+
+  uint16_t readU16BE(size_t offset) const
+  {
+    return static_cast<uint16_t>(data[offset] << 8 | data[offset + 1]);
+  }
+  int16_t readI16BE(size_t offset) const
+  {
+    return static_cast<int16_t>(readU16BE(offset));
+  }
+  uint32_t readU32BE(size_t offset) const
+  {
+    return static_cast<uint32_t>(readU16BE(offset)) << 16 |
+           readU16BE(offset + 2);
+  }
+  uint64_t readU64BE(size_t offset) const
+  {
+    return static_cast<uint64_t>(readU32BE(offset)) << 32 |
+           readU32BE(offset + 4);
+  }
+};
+
+struct IBeaconFrame
+{
+  Uuid128  proximityUuid;
+  uint16_t major;
+  uint16_t minor;
+  int8_t   measuredPower;
+};
+
+struct EddystoneUidFrame
+{
+  int8_t   txPower;
+  ByteView namespaceId;
+  ByteView instanceId;
+};
+
+struct EddystoneUrlFrame
+{
+  int8_t   txPower;
+  uint8_t  scheme;
+  ByteView encodedUrl;
+};
+
+struct EddystoneTlmFrame
+{
+  uint16_t batteryMillivolts;
+  int16_t  temperatureFixed88;
+  uint32_t advertisementCount;
+  uint32_t uptimeDeciseconds;
+};
+
+// RuuviTag data format 5 (RAWv2)
+struct RuuviFrame
+{
+  int16_t  temperatureRaw;
+  uint16_t humidityRaw;
+  uint16_t pressureRaw;
+  int16_t  accelerationMg[3];
+  uint16_t batteryMillivolts;
+  int8_t   txPower;
+  uint16_t sequence;
+};
+
+using AdvertisementFrame = std::variant<std::monostate,
+                                        IBeaconFrame,
+                                        EddystoneUidFrame,
+                                        EddystoneUrlFrame,
+                                        EddystoneTlmFrame,
+                                        RuuviFrame>;
+
+// Typed decoder for one company's manufacturer data or one service's
+// service data. Returns false if the payload is not a format it knows.
+using AdvertisementDecoder = bool (*)(ByteView            payload,
+                                      AdvertisementFrame& out);
+
+inline bool decodeIBeacon(ByteView payload, AdvertisementFrame& out)
+{
+  if (payload.size < 23 || payload[0] != 0x02 || payload[1] != 0x15)
+    return false;
+
+  IBeaconFrame frame;
+  frame.proximityUuid = {payload.readU64BE(2), payload.readU64BE(10)};
+  frame.major         = payload.readU16BE(18);
+  frame.minor         = payload.readU16BE(20);
+  frame.measuredPower = static_cast<int8_t>(payload[22]);
+  out                 = frame;
+  return true;
+}
+
+inline bool decodeEddystone(ByteView payload, AdvertisementFrame& out)
+{
+  if (payload.size < 2)
+    return false;
+
+  switch (payload[0])
+  {
+    case 0x00: // UID
+      if (payload.size < 18)
+        return false;
+      out = EddystoneUidFrame{static_cast<int8_t>(payload[1]),
+                              payload.subview(2, 10), payload.subview(12, 6)};
+      return true;
+
+    case 0x10: // URL
+      if (payload.size < 3)
+        return false;
+      out = EddystoneUrlFrame{static_cast<int8_t>(payload[1]), payload[2],
+                              payload.subview(3, payload.size - 3)};
+      return true;
+
+    case 0x20: // TLM, unencrypted version only
+      if (payload.size < 14 || payload[1] != 0x00)
+        return false;
+      out = EddystoneTlmFrame{payload.readU16BE(2), payload.readI16BE(4),
+                              payload.readU32BE(6), payload.readU32BE(10)};
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+inline bool decodeRuuvi(ByteView payload, AdvertisementFrame& out)
+{
+  if (payload.size < 24 || payload[0] != 0x05)
+    return false;
+
+  RuuviFrame frame;
+  frame.temperatureRaw    = payload.readI16BE(1);
+  frame.humidityRaw       = payload.readU16BE(3);
+  frame.pressureRaw       = payload.readU16BE(5);
+  frame.accelerationMg[0] = payload.readI16BE(7);
+  frame.accelerationMg[1] = payload.readI16BE(9);
+  frame.accelerationMg[2] = payload.readI16BE(11);
+
+  uint16_t power          = payload.readU16BE(13);
+  frame.batteryMillivolts = static_cast<uint16_t>((power >> 5) + 1600);
+  frame.txPower           = static_cast<int8_t>((power & 0x1f) * 2 - 40);
+  frame.sequence          = payload.readU16BE(16);
+  out                     = frame;
+  return true;
+}
+
+// Maps company IDs and service UUIDs to decoders. Lookups are a single hash
+// probe per ManufacturerData / ServiceData entry.
+class AdvertisementParser
+{
+private:
+  std::unordered_map<uint16_t, AdvertisementDecoder>             companies;
+  std::unordered_map<Uuid128, AdvertisementDecoder, Uuid128Hash> services;
+
+public:
+  static constexpr uint16_t COMPANY_APPLE     = 0x004C;
+  static constexpr uint16_t COMPANY_RUUVI     = 0x0499;
+  static constexpr uint32_t SERVICE_EDDYSTONE = 0xFEAA;
+
+  AdvertisementParser()
+  {
+    registerCompany(COMPANY_APPLE, decodeIBeacon);
+    registerCompany(COMPANY_RUUVI, decodeRuuvi);
+    registerService(Uuid128::fromShort(SERVICE_EDDYSTONE), decodeEddystone);
+  }
+
+  void registerCompany(uint16_t companyId, AdvertisementDecoder decoder)
+  {
+    companies[companyId] = decoder;
+  }
+
+  void registerService(const Uuid128& uuid, AdvertisementDecoder decoder)
+  {
+    services[uuid] = decoder;
+  }
+
+  // Decodes every recognized ManufacturerData and ServiceData entry of a
+  // device, calling `visit(frame)` for each. Returns the number decoded.
+  template <typename Visitor>
+  size_t parse(const DeviceRecord& device, Visitor&& visit) const
+  {
+    size_t             count = 0;
+    AdvertisementFrame frame;
+
+    for (const auto& [companyId, bytes] : device.manufacturerData)
+    {
+      auto it = companies.find(companyId);
+      if (it != companies.end() &&
+          it->second({bytes.data(), bytes.size()}, frame))
+      {
+        visit(frame);
+        ++count;
+      }
+    }
+    for (const auto& [uuid, bytes] : device.serviceData)
+    {
+      auto it = services.find(uuid);
+      if (it != services.end() &&
+          it->second({bytes.data(), bytes.size()}, frame))
+      {
+        visit(frame);
+        ++count;
+      }
+    }
+    return count;
+  }
+};
+
+// Human-readable one-line summary, for display only
+inline std::string describeFrame(const AdvertisementFrame& frame)
+{
+  char text[160];
+
+  if (const auto* beacon = std::get_if<IBeaconFrame>(&frame))
+  {
+    std::snprintf(text, sizeof(text), "iBeacon %s major %u minor %u power %d",
+                  beacon->proximityUuid.toString().c_str(), beacon->major,
+                  beacon->minor, beacon->measuredPower);
+  }
+  else if (const auto* uid = std::get_if<EddystoneUidFrame>(&frame))
+  {
+    std::string id;
+    for (size_t i = 0; i < uid->namespaceId.size + uid->instanceId.size; ++i)
+    {
+      char hex[3];
+      std::snprintf(hex, sizeof(hex), "%02x",
+                    i < 10 ? uid->namespaceId[i] : uid->instanceId[i - 10]);
+      id += hex;
+      if (i == 9)
+        id += '/';
+    }
+    std::snprintf(text, sizeof(text), "Eddystone-UID %s tx %d", id.c_str(),
+                  uid->txPower);
+  }
+  else if (const auto* url = std::get_if<EddystoneUrlFrame>(&frame))
+  {
+    static const char* const schemes[]    = {"http://www.", "https://www.",
+                                             "http://", "https://"};
+    static const char* const expansions[] = {
+      ".com/", ".org/", ".edu/", ".net/", ".info/", ".biz/", ".gov/",
+      ".com",  ".org",  ".edu",  ".net",  ".info",  ".biz",  ".gov"};
+
+    std::string decoded = url->scheme < 4 ? schemes[url->scheme] : "";
+    for (size_t i = 0; i < url->encodedUrl.size; ++i)
+    {
+      uint8_t c = url->encodedUrl[i];
+      if (c < 14)
+        decoded += expansions[c];
+      else if (c > 0x20 && c < 0x7f)
+        decoded += static_cast<char>(c);
+    }
+    std::snprintf(text, sizeof(text), "Eddystone-URL %s tx %d",
+                  decoded.c_str(), url->txPower);
+  }
+  else if (const auto* tlm = std::get_if<EddystoneTlmFrame>(&frame))
+  {
+    std::snprintf(text, sizeof(text),
+                  "Eddystone-TLM battery %u mV temp %.2f C adv %u uptime %u s",
+                  tlm->batteryMillivolts, tlm->temperatureFixed88 / 256.0,
+                  tlm->advertisementCount, tlm->uptimeDeciseconds / 10);
+  }
+  else if (const auto* ruuvi = std::get_if<RuuviFrame>(&frame))
+  {
+    std::snprintf(text, sizeof(text),
+                  "Ruuvi %.2f C %.2f %% %u Pa battery %u mV seq %u",
+                  ruuvi->temperatureRaw * 0.005, ruuvi->humidityRaw * 0.0025,
+                  ruuvi->pressureRaw + 50000u, ruuvi->batteryMillivolts,
+                  ruuvi->sequence);
+  }
+  else
+  {
+    return "Unknown";
+  }
+  return text;
+}
@@ -0,0 +1,103 @@
+// Replaces the global operator new and delete so AllocationTracker can
+// count every heap allocation in the process. Only built with
+// BUILD_WITH_ALLOC_TRACKING; the counting costs a few atomic increments
+// per allocation.
+
+#include <cstdlib>
+#include <new>
+
+#include "AllocationTracker.h"
+
+namespace
+{
+void* allocate(std::size_t size)
+{
+  AllocationTracker::allocated(size);
+  if (void* block = std::malloc(size ? size : 1))
+    return block;
+  throw std::bad_alloc();
+}
+
+void* allocateAligned(std::size_t size, std::align_val_t alignment)
+{
+  AllocationTracker::allocated(size);
+  auto        align = static_cast<std::size_t>(alignment);
+  std::size_t round = (size + align - 1) / align * align;
+  if (void* block = std::aligned_alloc(align, round ? round : align))
+    return block;
+  throw std::bad_alloc();
+}
+
+void release(void* block)
+{
+  if (!block)
+    return;
+  AllocationTracker::freed();
+  std::free(block);
+}
+} // namespace
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  try
+  {
+    return allocate(size);
+  }
+  catch (const std::bad_alloc&)
+  {
+    return nullptr;
+  }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+  return operator new(size, tag);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+  return allocateAligned(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+  return allocateAligned(size, alignment);
+}
+
+void operator delete(void* block) noexcept { release(block); }
+void operator delete[](void* block) noexcept { release(block); }
+void operator delete(void* block, std::size_t) noexcept { release(block); }
+void operator delete[](void* block, std::size_t) noexcept { release(block); }
+
+void operator delete(void* block, const std::nothrow_t&) noexcept
+{
+  release(block);
+}
+
+void operator delete[](void* block, const std::nothrow_t&) noexcept
+{
+  release(block);
+}
+
+void operator delete(void* block, std::align_val_t) noexcept
+{
+  release(block);
+}
+
+void operator delete[](void* block, std::align_val_t) noexcept
+{
+  release(block);
+}
+
+void operator delete(void* block, std::size_t, std::align_val_t) noexcept
+{
+  release(block);
+}
+
+void operator delete[](void* block, std::size_t, std::align_val_t) noexcept
+{
+  release(block);
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+struct AllocationCounts
+{
+  uint64_t allocations = 0;
+  uint64_t bytes       = 0; // as requested, not as handed out by malloc
+  uint64_t frees       = 0;
+};
+
+// What allocations are charged to: an operation, or a subsystem when given
+// no parent. An operation's allocations also count towards its parent.
+// Tags must have static storage duration; the first MAX_TAGS constructed
+// are listed in reports.
+class AllocationTag
+{
+public:
+  static constexpr size_t MAX_TAGS = 64;
+
+private:
+  const char*           tagName;
+  AllocationTag*        tagParent;
+  std::atomic<uint64_t> allocations{0};
+  std::atomic<uint64_t> bytes{0};
+
+  static constinit inline std::array<AllocationTag*, MAX_TAGS> registry{};
+  static constinit inline std::atomic<size_t>                  registered{0};
+
+public:
+  explicit AllocationTag(const char* name, AllocationTag* parent = nullptr)
+    : tagName(name), tagParent(parent)
+  {
+    size_t index = registered.fetch_add(1);
+    if (index < MAX_TAGS)
+      registry[index] = this;
+  }
+
+  AllocationTag(const AllocationTag&)            = delete;
+  AllocationTag& operator=(const AllocationTag&) = delete;
+
+  const char*          name() const { return tagName; }
+  const AllocationTag* parent() const { return tagParent; }
+
+  AllocationCounts counts() const
+  {
+    return {allocations.load(std::memory_order_relaxed),
+            bytes.load(std::memory_order_relaxed), 0};
+  }
+
+  void charge(size_t size)
+  {
+    for (AllocationTag* tag = this; tag; tag = tag->tagParent)
+    {
+      tag->allocations.fetch_add(1, std::memory_order_relaxed);
+      tag->bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+  }
+
+  // Every tag in construction order
+  template <typename Visitor>
+  static void forEach(Visitor&& visit)
+  {
+    size_t count = registered.load();
+    for (size_t i = 0; i < count && i < MAX_TAGS; ++i)
+      visit(*registry[i]);
+  }
+};
+
+// Counts heap allocations when the build replaces operator new and delete
+// (BUILD_WITH_ALLOC_TRACKING, which defines BLE_ALLOC_TRACKING and adds
+// AllocationHooks.cpp). Counts are kept per thread, so a thread can measure
+// exactly what a piece of its own code allocates, and per tag, for the
+// totals the whole process spends on each operation. Without the hooks
+// everything here still compiles and every count stays zero.
+class AllocationTracker
+{
+public:
+#ifdef BLE_ALLOC_TRACKING
+  static constexpr bool enabled = true;
+#else
+  static constexpr bool enabled = false;
+#endif
+
+private:
+  friend class AllocationScope;
+
+  static constinit inline thread_local AllocationCounts threadCounts;
+  static constinit inline thread_local AllocationTag*   threadTag = nullptr;
+  static constinit inline std::atomic<uint64_t>         totalAllocations{0};
+  static constinit inline std::atomic<uint64_t>         totalBytes{0};
+  static constinit inline std::atomic<uint64_t>         totalFrees{0};
+
+public:
+  // Called by the hooks. Neither may allocate.
+  static void allocated(size_t size)
+  {
+    ++threadCounts.allocations;
+    threadCounts.bytes += size;
+    totalAllocations.fetch_add(1, std::memory_order_relaxed);
+    totalBytes.fetch_add(size, std::memory_order_relaxed);
+    if (threadTag)
+      threadTag->charge(size);
+  }
+
+  static void freed()
+  {
+    ++threadCounts.frees;
+    totalFrees.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Everything the calling thread has allocated so far
+  static AllocationCounts thisThread() { return threadCounts; }
+
+  // Everything every thread has allocated so far, tagged or not
+  static AllocationCounts total()
+  {
+    return {totalAllocations.load(std::memory_order_relaxed),
+            totalBytes.load(std::memory_order_relaxed),
+            totalFrees.load(std::memory_order_relaxed)};
+  }
+};
+
+// Charges what the calling thread allocates to `tag` until the scope ends.
+// Scopes nest, the innermost one winning. Not for coroutines: a scope held
+// across a suspension would charge whatever the thread runs next.
+class AllocationScope
+{
+private:
+  AllocationTag* previous;
+
+public:
+  explicit AllocationScope(AllocationTag& tag)
+    : previous(AllocationTracker::threadTag)
+  {
+    AllocationTracker::threadTag = &tag;
+  }
+
+  ~AllocationScope() { AllocationTracker::threadTag = previous; }
+
+  AllocationScope(const AllocationScope&)            = delete;
+  AllocationScope& operator=(const AllocationScope&) = delete;
+};
+
+// What the calling thread allocates between construction and allocated()
+class AllocationCounter
+{
+private:
+  AllocationCounts start = AllocationTracker::thisThread();
+
+public:
+  AllocationCounts allocated() const
+  {
+    AllocationCounts now = AllocationTracker::thisThread();
+    return {now.allocations - start.allocations, now.bytes - start.bytes,
+            now.frees - start.frees};
+  }
+
+  void reset() { start = AllocationTracker::thisThread(); }
+};
@@ -0,0 +1,591 @@
+#pragma once
+
+#include <sdbus-c++/sdbus-c++.h>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "BusLoop.h"
+#include "CallControl.h"
+#include "Payload.h"
+#include "Result.h"
+#include "Uuid.h"
+
+// Coroutines over the BusLoop thread. Every coroutine here runs on that
+// thread, suspends while a call or signal is outstanding and is resumed
+// from the loop, so any number of device workflows share the one thread
+// that already dispatches D-Bus traffic.
+
+// Resumes whoever awaited the task once its body finishes
+struct TaskPromiseBase
+{
+  std::coroutine_handle<> continuation = std::noop_coroutine();
+  std::exception_ptr      exception;
+
+  struct FinalAwaiter
+  {
+    bool await_ready() noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> self) noexcept
+    {
+      return self.promise().continuation;
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter        final_suspend() noexcept { return {}; }
+  void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <typename T>
+struct TaskResult
+{
+  std::optional<T> value;
+
+  void return_value(T result) { value.emplace(std::move(result)); }
+  T    take() { return std::move(*value); }
+};
+
+template <>
+struct TaskResult<void>
+{
+  void return_void() {}
+  void take() {}
+};
+
+// A coroutine producing a T. It starts when first awaited and resumes its
+// awaiter directly when it finishes, so a chain of tasks costs no loop
+// iterations of its own.
+template <typename T>
+class [[nodiscard]] Task
+{
+public:
+  struct promise_type : TaskPromiseBase, TaskResult<T>
+  {
+    Task get_return_object()
+    {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+  };
+
+private:
+  std::coroutine_handle<promise_type> handle;
+
+  explicit Task(std::coroutine_handle<promise_type> coroutine)
+    : handle(coroutine)
+  {
+  }
+
+public:
+  Task(Task&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+  Task& operator=(Task&&) = delete;
+  ~Task()
+  {
+    if (handle)
+      handle.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiting)
+  {
+    handle.promise().continuation = waiting;
+    return handle;
+  }
+  T await_resume()
+  {
+    if (handle.promise().exception)
+      std::rethrow_exception(handle.promise().exception);
+    return handle.promise().take();
+  }
+};
+
+// A task nobody waits for; its frame frees itself when the body returns
+struct DetachedTask
+{
+  struct promise_type
+  {
+    DetachedTask       get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void               return_void() {}
+    void               unhandled_exception() { std::terminate(); }
+  };
+};
+
+// Runs `task` until its first suspension and lets it finish on its own.
+// Must be called on the loop thread; use BusLoop::post() from elsewhere.
+inline DetachedTask spawn(Task<void> task)
+{
+  co_await std::move(task);
+}
+
+// Wakes one waiting coroutine when something happens, or when its deadline
+// passes. A firing with nobody waiting is kept for the next wait.
+class Trigger
+{
+private:
+  BusLoop&                loop;
+  std::coroutine_handle<> waiting;
+  BusLoop::TimerId        timer = 0;
+  bool                    fired = false;
+
+  void timedOut()
+  {
+    auto resumed = std::exchange(waiting, {});
+    resumed.resume();
+  }
+
+public:
+  explicit Trigger(BusLoop& busLoop) : loop(busLoop) {}
+  ~Trigger()
+  {
+    if (waiting)
+      loop.cancelTimer(timer);
+  }
+
+  Trigger(const Trigger&)            = delete;
+  Trigger& operator=(const Trigger&) = delete;
+
+  // May be called from a D-Bus handler; the waiter resumes after it returns
+  void fire()
+  {
+    fired = true;
+    if (!waiting)
+      return;
+    loop.cancelTimer(timer);
+    loop.defer([resumed = std::exchange(waiting, {})] { resumed.resume(); });
+  }
+
+  struct Awaiter
+  {
+    Trigger&                   trigger;
+    BusLoop::Clock::time_point deadline;
+
+    bool await_ready() const { return trigger.fired; }
+    void await_suspend(std::coroutine_handle<> coroutine)
+    {
+      trigger.waiting = coroutine;
+      trigger.timer   = trigger.loop.addTimer(
+        deadline, [owner = &trigger] { owner->timedOut(); });
+    }
+    // True if fired, false if the deadline passed first
+    bool await_resume() { return std::exchange(trigger.fired, false); }
+  };
+
+  Awaiter wait(BusLoop::Clock::time_point deadline)
+  {
+    return {*this, deadline};
+  }
+};
+
+// Suspends until `at`
+struct SleepAwaiter
+{
+  BusLoop&                   loop;
+  BusLoop::Clock::time_point at;
+
+  bool await_ready() const { return at <= BusLoop::Clock::now(); }
+  void await_suspend(std::coroutine_handle<> coroutine)
+  {
+    loop.addTimer(at, [coroutine] { coroutine.resume(); });
+  }
+  void await_resume() {}
+};
+
+// Sends a method call when awaited and resumes with its reply or error.
+// Errors come back as values, as from awaitReplies().
+class CallAwaiter
+{
+private:
+  BusLoop&                                  loop;
+  sdbus::IProxy&                            proxy;
+  sdbus::MethodCall                         call;
+  std::chrono::microseconds                 timeout;
+  std::optional<Result<sdbus::MethodReply>> result;
+  sdbus::PendingAsyncCall                   pending;
+
+public:
+  CallAwaiter(BusLoop&                   busLoop,
+              sdbus::IProxy&             target,
+              sdbus::MethodCall          methodCall,
+              BusLoop::Clock::time_point deadline)
+    : loop(busLoop),
+      proxy(target),
+      call(std::move(methodCall)),
+      timeout(0) // sd-bus default
+  {
+    if (deadline == BusLoop::Clock::time_point::max())
+      return;
+    timeout = std::chrono::duration_cast<std::chrono::microseconds>(
+      deadline - BusLoop::Clock::now());
+    if (timeout.count() <= 0)
+      result.emplace(
+        CallError{CALL_TIMED_OUT, "Deadline passed before the call was sent"});
+  }
+
+  bool await_ready() const { return result.has_value(); }
+  bool await_suspend(std::coroutine_handle<> coroutine)
+  {
+    try
+    {
+      pending = proxy.callMethodAsync(
+        call,
+        [this, coroutine](sdbus::MethodReply          reply,
+                          std::optional<sdbus::Error> error) {
+          if (error)
+            result.emplace(CallError{error->getName(), error->getMessage()});
+          else
+            result.emplace(std::move(reply));
+          loop.defer([coroutine] { coroutine.resume(); });
+        },
+        timeout);
+      return true;
+    }
+    catch (const sdbus::Error& error)
+    {
+      result.emplace(CallError{error.getName(), error.getMessage()});
+      return false;
+    }
+  }
+  Result<sdbus::MethodReply> await_resume() { return std::move(*result); }
+};
+
+// Awaitable BLE operations on BlueZ. Devices connected here are tracked
+// separately from BluetoothManager's connection cache. Every member must
+// be called, and every task awaited, on the loop thread.
+class AsyncBle
+{
+public:
+  using Clock = BusLoop::Clock;
+
+private:
+  // Values from one characteristic, waiting for nextNotification()
+  struct NotificationQueue
+  {
+    std::deque<Payload> values;
+    Trigger             arrived;
+    sdbus::Slot         watch;
+    bool                closed = false;
+
+    explicit NotificationQueue(BusLoop& loop) : arrived(loop) {}
+  };
+
+  struct Link
+  {
+    std::map<std::string, std::string> characteristics; // UUID -> path
+    std::map<std::string, std::shared_ptr<NotificationQueue>> notifications;
+  };
+
+  const std::string BLUEZ_SERVICE          = "org.bluez";
+  const std::string DEVICE_INTERFACE       = "org.bluez.Device1";
+  const std::string GATT_CHAR_INTERFACE    = "org.bluez.GattCharacteristic1";
+  const std::string PROPERTIES_INTERFACE   = "org.freedesktop.DBus.Properties";
+  const std::string OBJECT_MANAGER_INTERFACE =
+    "org.freedesktop.DBus.ObjectManager";
+
+  // How long a failed connect() may spend disconnecting, on top of its
+  // deadline, which has often passed by then
+  const std::chrono::seconds CLEANUP_TIMEOUT{5};
+
+  sdbus::IConnection&                                   connection;
+  BusLoop&                                              loop;
+  std::map<std::string, std::unique_ptr<sdbus::IProxy>> proxies;
+  std::map<std::string, Link>                           links;
+
+  // Proxies live as long as this object, so no reply outlives its proxy
+  sdbus::IProxy& proxyFor(const std::string& path)
+  {
+    auto& proxy = proxies[path];
+    if (!proxy)
+      proxy = sdbus::createProxy(connection,
+                                 sdbus::ServiceName(BLUEZ_SERVICE),
+                                 sdbus::ObjectPath{path});
+    return *proxy;
+  }
+
+  template <typename... Args>
+  CallAwaiter call(const std::string& path,
+                   const std::string& interface,
+                   const std::string& method,
+                   Clock::time_point  deadline,
+                   const Args&... args)
+  {
+    auto& proxy = proxyFor(path);
+    auto  methodCall = proxy.createMethodCall(sdbus::InterfaceName(interface),
+                                              sdbus::MethodName(method));
+    ((methodCall << args), ...);
+    return CallAwaiter(loop, proxy, std::move(methodCall), deadline);
+  }
+
+  // Canonical form of `uuid`, or empty if it is not one
+  static std::string canonical(const std::string& uuid)
+  {
+    Uuid128 parsed;
+    return Uuid128::parse(uuid, parsed) ? parsed.toString() : std::string();
+  }
+
+  // Object path of `uuid` on a device connected through connect()
+  Result<std::string> characteristicPath(const std::string& devicePath,
+                                         const std::string& uuid) const
+  {
+    auto link = links.find(devicePath);
+    if (link == links.end())
+      return CallError{ERROR_NOT_CONNECTED, devicePath + " is not connected"};
+    if (canonical(uuid).empty())
+      return CallError{"org.freedesktop.DBus.Error.InvalidArgs",
+                       "Invalid UUID '" + uuid + "'"};
+
+    auto it = link->second.characteristics.find(canonical(uuid));
+    if (it == link->second.characteristics.end())
+      return CallError{ERROR_NO_CHARACTERISTIC,
+                       "Characteristic " + uuid + " not found"};
+    return it->second;
+  }
+
+  static std::optional<bool> flag(const std::map<std::string, sdbus::Variant>&
+                                    changed,
+                                  const std::string& name)
+  {
+    auto it = changed.find(name);
+    if (it == changed.end() || !it->second.containsValueOfType<bool>())
+      return std::nullopt;
+    return it->second.get<bool>();
+  }
+
+  // The part of connect() after Connect has succeeded: waits for service
+  // discovery and maps the characteristics. `progress` and `lost` belong to
+  // connect()'s Device1 watch.
+  Task<Result<void>> bringUp(const std::string& devicePath,
+                             Clock::time_point  deadline,
+                             Trigger&           progress,
+                             const bool&        lost)
+  {
+    // Services may already have been resolved from BlueZ's cache
+    auto resolved = co_await call(devicePath, PROPERTIES_INTERFACE, "Get",
+                                  deadline, DEVICE_INTERFACE,
+                                  "ServicesResolved");
+    if (!resolved)
+      co_return resolved.error();
+    sdbus::Variant resolvedVar;
+    resolved.value() >> resolvedVar;
+    if (resolvedVar.containsValueOfType<bool>() && resolvedVar.get<bool>())
+      progress.fire();
+
+    if (!co_await progress.wait(deadline))
+      co_return CallError{CALL_TIMED_OUT, "Services were not resolved in time"};
+    if (lost)
+      co_return CallError{ERROR_CONNECT_FAILED,
+                          "Link lost before services were resolved"};
+
+    auto reply = co_await call("/", OBJECT_MANAGER_INTERFACE,
+                               "GetManagedObjects", deadline);
+    if (!reply)
+      co_return reply.error();
+    std::map<sdbus::ObjectPath,
+             std::map<std::string, std::map<std::string, sdbus::Variant>>>
+      objects;
+    reply.value() >> objects;
+
+    Link        link;
+    std::string prefix = devicePath + "/";
+    for (const auto& [path, interfaces] : objects)
+    {
+      auto props = interfaces.find(GATT_CHAR_INTERFACE);
+      if (path.compare(0, prefix.size(), prefix) != 0 ||
+          props == interfaces.end())
+        continue;
+      auto uuid = props->second.find("UUID");
+      if (uuid != props->second.end() &&
+          uuid->second.containsValueOfType<std::string>())
+        link.characteristics[canonical(uuid->second.get<std::string>())] =
+          path;
+    }
+    links[devicePath] = std::move(link);
+    co_return Result<void>();
+  }
+
+public:
+  AsyncBle(sdbus::IConnection& busConnection, BusLoop& busLoop)
+    : connection(busConnection), loop(busLoop)
+  {
+  }
+
+  // Connects and waits for service discovery, then maps the device's
+  // characteristics so the other operations can address them by UUID. On
+  // failure the device is left disconnected.
+  Task<Result<void>> connect(std::string devicePath, Clock::time_point deadline)
+  {
+    Trigger progress(loop);
+    bool    lost  = false;
+    auto    watch = connection.addMatch(
+      "type='signal',sender='" + BLUEZ_SERVICE + "',path='" + devicePath +
+        "',interface='" + PROPERTIES_INTERFACE +
+        "',member='PropertiesChanged',arg0='" + DEVICE_INTERFACE + "'",
+      [&](sdbus::Message msg) {
+        std::string                           interface;
+        std::map<std::string, sdbus::Variant> changed;
+        msg >> interface >> changed;
+        if (flag(changed, "Connected") == false)
+          lost = true;
+        if (lost || flag(changed, "ServicesResolved") == true)
+          progress.fire();
+      },
+      sdbus::return_slot);
+
+    auto connected = co_await call(devicePath, DEVICE_INTERFACE, "Connect",
+                                   deadline);
+    if (!connected)
+      co_return connected.error();
+
+    // The device is connected from here on. If it cannot be brought up, it
+    // is disconnected again rather than left connected with no owner.
+    auto ready = co_await bringUp(devicePath, deadline, progress, lost);
+    if (!ready)
+    {
+      watch.reset();
+      auto disconnected = co_await call(devicePath, DEVICE_INTERFACE,
+                                        "Disconnect",
+                                        Clock::now() + CLEANUP_TIMEOUT);
+      (void)disconnected;
+    }
+    co_return ready;
+  }
+
+  Task<Result<Payload>> read(std::string       devicePath,
+                             std::string       uuid,
+                             Clock::time_point deadline)
+  {
+    auto path = characteristicPath(devicePath, uuid);
+    if (!path)
+      co_return path.error();
+
+    auto reply = co_await call(path.value(), GATT_CHAR_INTERFACE, "ReadValue",
+                               deadline, defaultReadOptions());
+    if (!reply)
+      co_return reply.error();
+    co_return Payload(readBytes(reply.value()));
+  }
+
+  Task<Result<void>> write(std::string       devicePath,
+                           std::string       uuid,
+                           Payload           value,
+                           Clock::time_point deadline)
+  {
+    auto path = characteristicPath(devicePath, uuid);
+    if (!path)
+      co_return path.error();
+
+    auto reply = co_await call(path.value(), GATT_CHAR_INTERFACE,
+                               "WriteValue", deadline, value.view(),
+                               requestWriteOptions());
+    if (!reply)
+      co_return reply.error();
+    co_return Result<void>();
+  }
+
+  // Queues the characteristic's notifications for nextNotification(). The
+  // watch is in place before StartNotify, so no early value is lost.
+  Task<Result<void>> startNotify(std::string       devicePath,
+                                 std::string       uuid,
+                                 Clock::time_point deadline)
+  {
+    auto path = characteristicPath(devicePath, uuid);
+    if (!path)
+      co_return path.error();
+
+    auto queue   = std::make_shared<NotificationQueue>(loop);
+    queue->watch = connection.addMatch(
+      "type='signal',sender='" + BLUEZ_SERVICE + "',path='" + path.value() +
+        "',interface='" + PROPERTIES_INTERFACE +
+        "',member='PropertiesChanged',arg0='" + GATT_CHAR_INTERFACE + "'",
+      [owner = queue.get()](sdbus::Message msg) {
+        std::span<const uint8_t> value;
+        if (!readChangedValue(msg, value))
+          return;
+        owner->values.emplace_back(value);
+        owner->arrived.fire();
+      },
+      sdbus::return_slot);
+
+    auto reply = co_await call(path.value(), GATT_CHAR_INTERFACE,
+                               "StartNotify", deadline);
+    if (!reply)
+      co_return reply.error();
+
+    // The device may have been disconnected while StartNotify was pending
+    auto link = links.find(devicePath);
+    if (link == links.end())
+      co_return CallError{ERROR_NOT_CONNECTED, devicePath + " disconnected"};
+    link->second.notifications[canonical(uuid)] = queue;
+    co_return Result<void>();
+  }
+
+  // Next value notified since startNotify(), in arrival order. One waiter
+  // per characteristic at a time.
+  Task<Result<Payload>> nextNotification(std::string       devicePath,
+                                         std::string       uuid,
+                                         Clock::time_point deadline)
+  {
+    auto link = links.find(devicePath);
+    if (link == links.end())
+      co_return CallError{ERROR_NOT_CONNECTED,
+                          devicePath + " is not connected"};
+    auto it = link->second.notifications.find(canonical(uuid));
+    if (it == link->second.notifications.end())
+      co_return CallError{"org.freedesktop.DBus.Error.InvalidArgs",
+                          "Notifications from " + uuid + " are not started"};
+
+    // Held across the wait, in case the device is disconnected meanwhile
+    std::shared_ptr<NotificationQueue> queue = it->second;
+    while (queue->values.empty() && !queue->closed)
+    {
+      if (!co_await queue->arrived.wait(deadline))
+        co_return CallError{CALL_TIMED_OUT, "No notification in time"};
+    }
+    if (queue->values.empty())
+      co_return CallError{ERROR_NOT_CONNECTED, devicePath + " disconnected"};
+
+    Payload value = std::move(queue->values.front());
+    queue->values.pop_front();
+    co_return value;
+  }
+
+  // Stops notifications, waking their waiters, and disconnects
+  Task<Result<void>> disconnect(std::string       devicePath,
+                                Clock::time_point deadline)
+  {
+    auto link = links.find(devicePath);
+    if (link != links.end())
+    {
+      for (auto& [uuid, queue] : link->second.notifications)
+      {
+        queue->watch.reset();
+        queue->closed = true;
+        queue->arrived.fire();
+      }
+      links.erase(link);
+    }
+
+    auto reply = co_await call(devicePath, DEVICE_INTERFACE, "Disconnect",
+                               deadline);
+    if (!reply)
+      co_return reply.error();
+    co_return Result<void>();
+  }
+
+  SleepAwaiter sleep(Clock::duration duration)
+  {
+    return {loop, Clock::now() + duration};
+  }
+};
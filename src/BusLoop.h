@@ -0,0 +1,254 @@
+#pragma once
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <sdbus-c++/sdbus-c++.h>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "IdleMode.h"
+
+// The D-Bus event loop, run on one thread in place of sdbus-c++'s own. It
+// blocks in poll() on the bus fd, sdbus-c++'s wakeup eventfd, an eventfd
+// for work posted from other threads and a timerfd for the earliest timer,
+// so it only wakes when there is something to do. Timer deadlines are
+// coalesced to the idle mode slack.
+//
+// Timers and everything they and posted work touch belong to the loop
+// thread; post() is the only member that may be called from elsewhere
+// once run() has started.
+class BusLoop
+{
+public:
+  using Clock   = std::chrono::steady_clock;
+  using TimerId = uint64_t;
+
+private:
+  using Timers = std::multimap<Clock::time_point,
+                               std::pair<TimerId, std::function<void()>>>;
+
+  sdbus::IConnection& connection;
+  const IdleMode&     idle;
+  int                 wakeFd;
+  int                 timerFd;
+
+  std::mutex                         postMutex;
+  std::vector<std::function<void()>> posted;
+  bool                               stopping = false;
+  std::vector<std::function<void()>> deferred;
+
+  using TimerIndex = std::map<TimerId, Timers::iterator>;
+
+  Timers            timers;
+  TimerIndex        timerIndex;
+  TimerId           nextTimer = 1;
+  Clock::time_point armedFor  = Clock::time_point::max();
+
+  // Nodes of fired and cancelled timers, reused by addTimer() so that a
+  // timer armed over and over (a batch flush, say) does not allocate
+  std::vector<Timers::node_type>     spareTimers;
+  std::vector<TimerIndex::node_type> spareIndex;
+
+  static void drain(int fd)
+  {
+    uint64_t count;
+    while (read(fd, &count, sizeof(count)) == sizeof(count))
+    {
+    }
+  }
+
+  // Returns false once stop() has been called
+  bool runPosted()
+  {
+    std::vector<std::function<void()>> work;
+    {
+      std::lock_guard<std::mutex> lock(postMutex);
+      work.swap(posted);
+      if (stopping)
+        return false;
+    }
+    for (auto& task : work)
+      task();
+    return true;
+  }
+
+  // Dispatches bus messages and deferred work until neither has any left
+  void dispatch()
+  {
+    bool busy = true;
+    while (busy)
+    {
+      busy = connection.processPendingEvent();
+      while (!deferred.empty())
+      {
+        std::vector<std::function<void()>> work;
+        work.swap(deferred);
+        for (auto& task : work)
+          task();
+        busy = true;
+      }
+    }
+  }
+
+  void fireTimers()
+  {
+    auto now = Clock::now();
+    while (!timers.empty() && timers.begin()->first <= now)
+    {
+      auto task = std::move(timers.begin()->second.second);
+      release(timers.begin()->second.first, timers.begin());
+      task();
+    }
+  }
+
+  void release(TimerId id, Timers::iterator timer)
+  {
+    auto node = timers.extract(timer);
+    node.mapped().second = nullptr;
+    spareTimers.push_back(std::move(node));
+    spareIndex.push_back(timerIndex.extract(id));
+  }
+
+  void armTimer()
+  {
+    Clock::time_point next = timers.empty()
+                               ? Clock::time_point::max()
+                               : idle.coalesce(timers.begin()->first);
+    if (next == armedFor)
+      return;
+    armedFor = next;
+
+    // steady_clock is CLOCK_MONOTONIC on Linux; all zeroes disarms
+    itimerspec when{};
+    if (next != Clock::time_point::max())
+    {
+      auto since = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     next.time_since_epoch())
+                     .count();
+      when.it_value.tv_sec  = static_cast<time_t>(since / 1000000000);
+      when.it_value.tv_nsec = static_cast<long>(since % 1000000000);
+      if (when.it_value.tv_sec == 0 && when.it_value.tv_nsec == 0)
+        when.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &when, nullptr);
+  }
+
+public:
+  BusLoop(sdbus::IConnection& busConnection, const IdleMode& idleMode)
+    : connection(busConnection),
+      idle(idleMode),
+      wakeFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+      timerFd(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK))
+  {
+  }
+
+  ~BusLoop()
+  {
+    close(wakeFd);
+    close(timerFd);
+  }
+
+  BusLoop(const BusLoop&)            = delete;
+  BusLoop& operator=(const BusLoop&) = delete;
+
+  // Runs `task` on the loop thread
+  void post(std::function<void()> task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(postMutex);
+      posted.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    (void)!write(wakeFd, &one, sizeof(one));
+  }
+
+  // Runs `task` on the loop thread once the current handler has returned.
+  // Loop thread only; it saves the wakeup that post() costs.
+  void defer(std::function<void()> task)
+  {
+    deferred.push_back(std::move(task));
+  }
+
+  TimerId addTimer(Clock::time_point at, std::function<void()> task)
+  {
+    TimerId id = nextTimer++;
+    if (spareTimers.empty())
+    {
+      timerIndex[id] = timers.emplace(at, std::make_pair(id, std::move(task)));
+      return id;
+    }
+
+    auto timer = std::move(spareTimers.back());
+    auto index = std::move(spareIndex.back());
+    spareTimers.pop_back();
+    spareIndex.pop_back();
+    timer.key()    = at;
+    timer.mapped() = std::make_pair(id, std::move(task));
+    index.key()    = id;
+    index.mapped() = timers.insert(std::move(timer));
+    timerIndex.insert(std::move(index));
+    return id;
+  }
+
+  bool cancelTimer(TimerId id)
+  {
+    auto it = timerIndex.find(id);
+    if (it == timerIndex.end())
+      return false;
+    release(id, it->second);
+    return true;
+  }
+
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(postMutex);
+      stopping = true;
+    }
+    uint64_t one = 1;
+    (void)!write(wakeFd, &one, sizeof(one));
+  }
+
+  void run()
+  {
+    int64_t slack = 0;
+    while (true)
+    {
+      dispatch();
+      if (!runPosted())
+        return;
+      fireTimers();
+      dispatch();
+
+      idle.applyToThread(slack);
+      armTimer();
+      auto   data   = connection.getEventLoopPollData();
+      pollfd fds[4] = {};
+      fds[0].fd     = data.fd;
+      fds[0].events = data.events;
+      fds[1].fd     = data.eventFd;
+      fds[1].events = POLLIN;
+      fds[2].fd     = wakeFd;
+      fds[2].events = POLLIN;
+      fds[3].fd     = timerFd;
+      fds[3].events = POLLIN;
+      poll(fds, 4, data.getPollTimeout());
+
+      if (fds[2].revents & POLLIN)
+        drain(wakeFd);
+      if (fds[3].revents & POLLIN)
+      {
+        drain(timerFd);
+        armedFor = Clock::time_point::max();
+      }
+    }
+  }
+};
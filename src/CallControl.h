@@ -0,0 +1,520 @@
+#pragma once
+
+#include <sdbus-c++/sdbus-c++.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "Result.h"
+
+// Shared cancellation flag. Copies observe the same state, so one copy can
+// be handed to an operation and another kept to cancel it from elsewhere.
+// A default-constructed token can never be cancelled.
+class CancellationToken
+{
+private:
+public:
+  struct Listener;
+
+private:
+  struct State
+  {
+    std::mutex                                 mutex;
+    bool                                       cancelled = false;
+    uint64_t                                   nextId    = 0;
+    std::map<uint64_t, std::function<void()>> callbacks;
+    Listener*                                  listeners = nullptr;
+  };
+
+  std::shared_ptr<State> state;
+
+public:
+  // Told of cancellation like a subscribe() callback, but linked into the
+  // token rather than stored in it, so listening allocates nothing. For
+  // waits on a hot path. `notify` runs on the cancelling thread with the
+  // token's lock held, so it may only wake whoever is waiting.
+  struct Listener
+  {
+    void (*notify)(Listener&) = nullptr;
+    void*     context         = nullptr;
+    Listener* previous        = nullptr;
+    Listener* next            = nullptr;
+    bool      linked          = false;
+  };
+
+  // Unregisters its callback when destroyed
+  class Registration
+  {
+  private:
+    std::weak_ptr<State> state;
+    uint64_t             id = 0;
+
+  public:
+    Registration() = default;
+    Registration(std::weak_ptr<State> owner, uint64_t callbackId)
+      : state(std::move(owner)), id(callbackId)
+    {
+    }
+    ~Registration()
+    {
+      if (auto owner = state.lock())
+      {
+        std::lock_guard<std::mutex> lock(owner->mutex);
+        owner->callbacks.erase(id);
+      }
+    }
+
+    Registration(const Registration&)            = delete;
+    Registration& operator=(const Registration&) = delete;
+  };
+
+  static CancellationToken create()
+  {
+    CancellationToken token;
+    token.state = std::make_shared<State>();
+    return token;
+  }
+
+  bool cancellable() const { return state != nullptr; }
+
+  bool cancelled() const
+  {
+    if (!state)
+      return false;
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->cancelled;
+  }
+
+  // Callbacks run on the cancelling thread, outside the token's lock
+  void cancel() const
+  {
+    if (!state)
+      return;
+
+    std::vector<std::function<void()>> pending;
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (state->cancelled)
+        return;
+      state->cancelled = true;
+      for (auto& [id, callback] : state->callbacks)
+        pending.push_back(std::move(callback));
+      state->callbacks.clear();
+
+      for (Listener* listener = state->listeners; listener;)
+      {
+        Listener* next   = listener->next;
+        listener->linked = false;
+        listener->notify(*listener);
+        listener = next;
+      }
+      state->listeners = nullptr;
+    }
+    for (auto& callback : pending)
+      callback();
+  }
+
+  // Runs `callback` on cancellation, or straight away if already cancelled
+  std::unique_ptr<Registration> subscribe(std::function<void()> callback) const
+  {
+    if (!state)
+      return std::make_unique<Registration>();
+
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (!state->cancelled)
+      {
+        uint64_t id           = state->nextId++;
+        state->callbacks[id] = std::move(callback);
+        return std::make_unique<Registration>(state, id);
+      }
+    }
+    callback();
+    return std::make_unique<Registration>();
+  }
+
+  // Links `listener` until stopListening(). Returns false, leaving it
+  // unlinked, if the token is already cancelled.
+  bool listen(Listener& listener) const
+  {
+    if (!state)
+      return true;
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->cancelled)
+      return false;
+    listener.previous = nullptr;
+    listener.next     = state->listeners;
+    if (state->listeners)
+      state->listeners->previous = &listener;
+    state->listeners = &listener;
+    listener.linked  = true;
+    return true;
+  }
+
+  // Once this returns, `notify` is not running and will not be called
+  void stopListening(Listener& listener) const
+  {
+    if (!state)
+      return;
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (!listener.linked)
+      return;
+    if (listener.previous)
+      listener.previous->next = listener.next;
+    else
+      state->listeners = listener.next;
+    if (listener.next)
+      listener.next->previous = listener.previous;
+    listener.linked = false;
+  }
+};
+
+// Deadline and cancellation for a single BlueZ operation. Without a
+// deadline, D-Bus's default method timeout applies.
+struct CallOptions
+{
+  using Clock = std::chrono::steady_clock;
+
+  std::optional<Clock::time_point> deadline;
+  CancellationToken                token;
+
+  static CallOptions within(std::chrono::milliseconds timeout,
+                            CancellationToken         cancel = {})
+  {
+    CallOptions options;
+    if (timeout.count() > 0)
+      options.deadline = Clock::now() + timeout;
+    options.token = std::move(cancel);
+    return options;
+  }
+};
+
+// Sleeps for `duration`, waking early if the token is cancelled. Returns
+// false if it was.
+inline bool sleepUnlessCancelled(const CancellationToken&  token,
+                                 std::chrono::milliseconds duration)
+{
+  struct Waiter
+  {
+    std::mutex              mutex;
+    std::condition_variable wakeup;
+  };
+
+  auto waiter       = std::make_shared<Waiter>();
+  auto registration = token.subscribe([waiter] {
+    std::lock_guard<std::mutex> lock(waiter->mutex);
+    waiter->wakeup.notify_all();
+  });
+
+  std::unique_lock<std::mutex> lock(waiter->mutex);
+  waiter->wakeup.wait_for(lock, duration, [&] { return token.cancelled(); });
+  return !token.cancelled();
+}
+
+inline const char* const CALL_CANCELLED = "blemanager.Error.Cancelled";
+inline const char* const CALL_TIMED_OUT = "org.freedesktop.DBus.Error.Timeout";
+
+// The D-Bus timeout to send a call with under `options`: the time left
+// until the deadline, or 0 for sd-bus's default. Returns why the call
+// should not be sent at all, if it should not.
+inline std::optional<CallError> sendTimeout(const CallOptions&         options,
+                                            std::chrono::microseconds& timeout)
+{
+  timeout = std::chrono::microseconds(0);
+  if (options.token.cancelled())
+    return CallError{CALL_CANCELLED, "Call cancelled"};
+  if (options.deadline)
+  {
+    timeout = std::chrono::duration_cast<std::chrono::microseconds>(
+      *options.deadline - CallOptions::Clock::now());
+    if (timeout.count() <= 0)
+      return CallError{CALL_TIMED_OUT,
+                       "Deadline passed before the call was sent"};
+  }
+  return std::nullopt;
+}
+
+// A method call and the proxy of the object it is addressed to
+struct OutgoingCall
+{
+  sdbus::IProxy*    proxy;
+  sdbus::MethodCall call;
+};
+
+// Sends all `calls` at once, each with the time left until the deadline as
+// its D-Bus timeout, then waits for every reply. The calls are in flight
+// together, so the total wait is that of the slowest rather than the sum.
+// Cancelling the token cancels the calls still pending, which releases their
+// reply slots in sd-bus. Errors come back through the async callback as
+// values, so no failure path throws. Must not be called from the event loop
+// thread, which delivers the replies.
+inline std::vector<Result<sdbus::MethodReply>>
+awaitReplies(const std::vector<OutgoingCall>& calls,
+             const CallOptions&               options)
+{
+  struct Pending
+  {
+    std::mutex                               mutex;
+    std::condition_variable                  wakeup;
+    size_t                                   remaining;
+    std::vector<bool>                        finished;
+    std::vector<sdbus::MethodReply>          replies;
+    std::vector<std::optional<sdbus::Error>> errors;
+  };
+
+  std::vector<Result<sdbus::MethodReply>> results;
+  std::chrono::microseconds               timeout;
+  if (auto unsent = sendTimeout(options, timeout))
+  {
+    results.assign(calls.size(), *unsent);
+    return results;
+  }
+
+  auto state       = std::make_shared<Pending>();
+  state->remaining = calls.size();
+  state->finished.assign(calls.size(), false);
+  state->replies.resize(calls.size());
+  state->errors.resize(calls.size());
+
+  std::vector<sdbus::PendingAsyncCall> pending;
+  pending.reserve(calls.size());
+  for (size_t i = 0; i < calls.size(); ++i)
+  {
+    pending.push_back(calls[i].proxy->callMethodAsync(
+      calls[i].call,
+      [state, i](sdbus::MethodReply reply, std::optional<sdbus::Error> error) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->replies[i]  = std::move(reply);
+        state->errors[i]   = std::move(error);
+        state->finished[i] = true;
+        if (--state->remaining == 0)
+          state->wakeup.notify_all();
+      },
+      timeout));
+  }
+
+  auto registration = options.token.subscribe([state] {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->wakeup.notify_all();
+  });
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  auto ready = [&] {
+    return state->remaining == 0 || options.token.cancelled();
+  };
+  bool done = true;
+  if (options.deadline)
+  {
+    // sd-bus times the calls out itself; this only guards against a stalled
+    // event loop
+    done = state->wakeup.wait_until(
+      lock, *options.deadline + std::chrono::milliseconds(100), ready);
+  }
+  else
+  {
+    state->wakeup.wait(lock, ready);
+  }
+
+  std::vector<size_t> unfinished;
+  for (size_t i = 0; i < calls.size(); ++i)
+  {
+    if (!state->finished[i])
+    {
+      unfinished.push_back(i);
+      results.push_back(
+        done ? CallError{CALL_CANCELLED, "Call cancelled"}
+             : CallError{CALL_TIMED_OUT, "Deadline exceeded"});
+    }
+    else if (state->errors[i])
+      results.push_back(CallError{state->errors[i]->getName(),
+                                  state->errors[i]->getMessage()});
+    else
+      results.push_back(std::move(state->replies[i]));
+  }
+  lock.unlock();
+
+  for (size_t i : unfinished)
+    pending[i].cancel();
+  return results;
+}
+
+// Reply state for one blocking call at a time, so a single call allocates
+// nothing of its own. A thread takes a slot from a shared pool the first
+// time it calls awaitReply() and hands it back when it exits. Slots are
+// never freed, so a reply that arrives after its caller gave up still finds
+// its slot, and the call number tells it the slot has moved on.
+class ReplySlot
+{
+private:
+  struct Pool
+  {
+    std::mutex mutex;
+    ReplySlot* free = nullptr;
+  };
+
+  struct Lease
+  {
+    ReplySlot* slot;
+
+    Lease()
+    {
+      Pool&                       shared = pool();
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      if (shared.free)
+      {
+        slot        = shared.free;
+        shared.free = slot->nextFree;
+      }
+      else
+      {
+        slot = new ReplySlot();
+      }
+    }
+
+    ~Lease()
+    {
+      Pool&                       shared = pool();
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      slot->nextFree = shared.free;
+      shared.free    = slot;
+    }
+
+    Lease(const Lease&)            = delete;
+    Lease& operator=(const Lease&) = delete;
+  };
+
+  std::mutex                  mutex;
+  std::condition_variable     wakeup;
+  uint64_t                    callNumber = 0; // of the call awaited
+  bool                        finished   = false;
+  bool                        cancelled  = false;
+  sdbus::MethodReply          reply;
+  std::optional<sdbus::Error> error;
+  CancellationToken::Listener listener;
+  ReplySlot*                  nextFree = nullptr;
+
+  ReplySlot()
+  {
+    listener.notify  = &ReplySlot::onCancel;
+    listener.context = this;
+  }
+
+  // Outlives every thread, including those still running at exit
+  static Pool& pool()
+  {
+    static Pool* const shared = new Pool();
+    return *shared;
+  }
+
+  static void onCancel(CancellationToken::Listener& listener)
+  {
+    auto* slot = static_cast<ReplySlot*>(listener.context);
+
+    std::lock_guard<std::mutex> lock(slot->mutex);
+    slot->cancelled = true;
+    slot->wakeup.notify_all();
+  }
+
+  void complete(uint64_t                    number,
+                sdbus::MethodReply          message,
+                std::optional<sdbus::Error> failure)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (number != callNumber)
+      return;
+    reply    = std::move(message);
+    error    = std::move(failure);
+    finished = true;
+    wakeup.notify_all();
+  }
+
+public:
+  static ReplySlot& forThisThread()
+  {
+    static thread_local Lease lease;
+    return *lease.slot;
+  }
+
+  // Sends `call` with `timeout` and waits for its reply as awaitReplies()
+  // does. The reply callback holds only the slot and the call number, which
+  // std::function stores without allocating.
+  template <typename Proxy>
+  Result<sdbus::MethodReply> await(Proxy&                    proxy,
+                                   const sdbus::MethodCall&  call,
+                                   std::chrono::microseconds timeout,
+                                   const CallOptions&        options)
+  {
+    uint64_t number;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      number    = ++callNumber;
+      finished  = false;
+      cancelled = false;
+    }
+    if (!options.token.listen(listener))
+      return CallError{CALL_CANCELLED, "Call cancelled"};
+
+    auto pending = proxy.callMethodAsync(
+      call,
+      [slot = this, number](sdbus::MethodReply          message,
+                            std::optional<sdbus::Error> failure) {
+        slot->complete(number, std::move(message), std::move(failure));
+      },
+      timeout);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    auto ready = [this] { return finished || cancelled; };
+    bool done  = true;
+    if (options.deadline)
+    {
+      // sd-bus times the call out itself; this only guards against a
+      // stalled event loop
+      done = wakeup.wait_until(
+        lock, *options.deadline + std::chrono::milliseconds(100), ready);
+    }
+    else
+    {
+      wakeup.wait(lock, ready);
+    }
+
+    bool                       unfinished = !finished;
+    Result<sdbus::MethodReply> result(std::move(reply));
+    if (unfinished)
+      result = done ? CallError{CALL_CANCELLED, "Call cancelled"}
+                    : CallError{CALL_TIMED_OUT, "Deadline exceeded"};
+    else if (error)
+      result = CallError{error->getName(), error->getMessage()};
+    ++callNumber; // a late reply is now dropped
+    reply = sdbus::MethodReply();
+    error.reset();
+    lock.unlock();
+
+    options.token.stopListening(listener);
+    if (unfinished)
+      pending.cancel();
+    return result;
+  }
+};
+
+// awaitReplies() for a single call, through the calling thread's
+// ReplySlot. `Proxy` is sdbus::IProxy or anything with the same
+// callMethodAsync().
+template <typename Proxy>
+Result<sdbus::MethodReply> awaitReply(Proxy&                   proxy,
+                                      const sdbus::MethodCall& call,
+                                      const CallOptions&       options)
+{
+  std::chrono::microseconds timeout;
+  if (auto unsent = sendTimeout(options, timeout))
+    return *unsent;
+  return ReplySlot::forThisThread().await(proxy, call, timeout, options);
+}
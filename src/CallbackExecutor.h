@@ -0,0 +1,386 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A move-only callable for the executor. Callables of up to CAPACITY bytes,
+// such as a value callback holding a Payload, are stored inline, so
+// submitting one allocates nothing; larger ones go to the heap.
+class ExecutorTask
+{
+public:
+  static constexpr size_t CAPACITY = 96;
+
+private:
+  struct Operations
+  {
+    void (*invoke)(void* callable);
+    void (*relocate)(void* from, void* to); // move-constructs, destroys from
+    void (*destroy)(void* callable);
+  };
+
+  template <typename F>
+  static constexpr bool fitsInline =
+    sizeof(F) <= CAPACITY && alignof(F) <= alignof(std::max_align_t) &&
+    std::is_nothrow_move_constructible_v<F>;
+
+  template <typename F>
+  static constexpr Operations inlineOperations = {
+    [](void* callable) { (*static_cast<F*>(callable))(); },
+    [](void* from, void* to) {
+      new (to) F(std::move(*static_cast<F*>(from)));
+      static_cast<F*>(from)->~F();
+    },
+    [](void* callable) { static_cast<F*>(callable)->~F(); }};
+
+  template <typename F>
+  static constexpr Operations heapOperations = {
+    [](void* callable) { (**static_cast<F**>(callable))(); },
+    [](void* from, void* to) {
+      *static_cast<F**>(to) = std::exchange(*static_cast<F**>(from), nullptr);
+    },
+    [](void* callable) { delete *static_cast<F**>(callable); }};
+
+  alignas(std::max_align_t) unsigned char storage[CAPACITY];
+  const Operations* operations = nullptr;
+
+  void reset()
+  {
+    if (operations)
+      operations->destroy(storage);
+    operations = nullptr;
+  }
+
+public:
+  ExecutorTask() = default;
+
+  template <typename F,
+            typename = std::enable_if_t<
+              !std::is_same_v<std::decay_t<F>, ExecutorTask>>>
+  ExecutorTask(F&& callable)
+  {
+    using Callable = std::decay_t<F>;
+    if constexpr (fitsInline<Callable>)
+    {
+      new (storage) Callable(std::forward<F>(callable));
+      operations = &inlineOperations<Callable>;
+    }
+    else
+    {
+      new (storage) Callable*(new Callable(std::forward<F>(callable)));
+      operations = &heapOperations<Callable>;
+    }
+  }
+
+  ExecutorTask(ExecutorTask&& other) noexcept : operations(other.operations)
+  {
+    if (operations)
+      operations->relocate(other.storage, storage);
+    other.operations = nullptr;
+  }
+
+  ExecutorTask& operator=(ExecutorTask&& other) noexcept
+  {
+    if (this != &other)
+    {
+      reset();
+      operations = other.operations;
+      if (operations)
+        operations->relocate(other.storage, storage);
+      other.operations = nullptr;
+    }
+    return *this;
+  }
+
+  ExecutorTask(const ExecutorTask&)            = delete;
+  ExecutorTask& operator=(const ExecutorTask&) = delete;
+
+  ~ExecutorTask() { reset(); }
+
+  explicit operator bool() const { return operations != nullptr; }
+  void     operator()() { operations->invoke(storage); }
+};
+
+// A FIFO of tasks in a ring buffer. Unlike a deque it keeps its capacity as
+// it drains, so a queue that has reached its working size stops
+// allocating.
+class TaskQueue
+{
+private:
+  std::vector<ExecutorTask> slots;
+  size_t                    head  = 0;
+  size_t                    count = 0;
+
+  void grow()
+  {
+    std::vector<ExecutorTask> larger(std::max<size_t>(slots.size() * 2, 16));
+    for (size_t i = 0; i < count; ++i)
+      larger[i] = std::move(slots[(head + i) % slots.size()]);
+    slots.swap(larger);
+    head = 0;
+  }
+
+public:
+  bool   empty() const { return count == 0; }
+  size_t size() const { return count; }
+
+  void push_back(ExecutorTask task)
+  {
+    if (count == slots.size())
+      grow();
+    slots[(head + count) % slots.size()] = std::move(task);
+    ++count;
+  }
+
+  ExecutorTask pop_front()
+  {
+    ExecutorTask task = std::move(slots[head]);
+    head              = (head + 1) % slots.size();
+    --count;
+    return task;
+  }
+
+  ExecutorTask pop_back()
+  {
+    --count;
+    return std::move(slots[(head + count) % slots.size()]);
+  }
+};
+
+struct ExecutorStats
+{
+  size_t   threads  = 0;
+  size_t   strands  = 0; // with callbacks queued or running
+  uint64_t executed = 0; // tasks, a strand's batch counting once
+  uint64_t stolen   = 0; // tasks taken from another worker's queue
+};
+
+// Runs callbacks off the event loop thread on a pool of workers. Each
+// worker has its own queue, and a worker whose queue is empty steals from
+// the others before it sleeps, so a burst submitted to one queue spreads
+// over every core.
+//
+// Callbacks submitted under a key (a device path) form a strand: they run
+// one at a time in submission order, though not always on the same worker.
+// Different strands run in parallel. A strand runs at most STRAND_BATCH
+// callbacks before yielding its worker, so a busy device cannot starve the
+// others. Strands are kept once created, one per key ever used, so a
+// device's steady stream of callbacks allocates nothing here.
+class CallbackExecutor
+{
+public:
+  static constexpr size_t STRAND_BATCH = 32;
+
+private:
+  using Task = ExecutorTask;
+
+  struct Worker
+  {
+    std::mutex  mutex;
+    TaskQueue   tasks;
+    std::thread thread;
+  };
+
+  struct Strand
+  {
+    TaskQueue tasks;
+    bool      scheduled = false; // a batch is queued or running
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<size_t>                  nextWorker{0};
+  std::atomic<size_t>                  queued{0};
+  std::atomic<size_t>                  sleepers{0};
+  std::atomic<uint64_t>                executed{0};
+  std::atomic<uint64_t>                stolen{0};
+
+  // Idle workers sleep here until something is queued
+  std::mutex              idleMutex;
+  std::condition_variable idleWakeup;
+  bool                    stopping = false;
+
+  std::mutex                    strandsMutex;
+  std::map<std::string, Strand> strands;
+  size_t                        activeStrands = 0; // scheduled ones
+
+  // Worker the calling thread is, so a worker's own submissions stay local
+  static inline thread_local const CallbackExecutor* currentPool  = nullptr;
+  static inline thread_local size_t                  currentIndex = 0;
+
+  void enqueue(Task task)
+  {
+    size_t index = currentPool == this
+                     ? currentIndex
+                     : nextWorker.fetch_add(1) % workers.size();
+    {
+      std::lock_guard<std::mutex> lock(workers[index]->mutex);
+      workers[index]->tasks.push_back(std::move(task));
+    }
+    // Pairs with the check in workerLoop(); both are sequentially
+    // consistent, so either the sleeper sees the task or we see it asleep
+    queued.fetch_add(1);
+    if (sleepers.load() > 0)
+    {
+      std::lock_guard<std::mutex> lock(idleMutex);
+      idleWakeup.notify_one();
+    }
+  }
+
+  // Own queue from the front, then other queues from the back
+  bool take(size_t index, Task& task)
+  {
+    for (size_t offset = 0; offset < workers.size(); ++offset)
+    {
+      Worker&                     worker = *workers[(index + offset) %
+                                                    workers.size()];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      if (worker.tasks.empty())
+        continue;
+      if (offset == 0)
+      {
+        task = worker.tasks.pop_front();
+      }
+      else
+      {
+        task = worker.tasks.pop_back();
+        ++stolen;
+      }
+      queued.fetch_sub(1);
+      return true;
+    }
+    return false;
+  }
+
+  void workerLoop(size_t index)
+  {
+    currentPool  = this;
+    currentIndex = index;
+    Task task;
+    while (true)
+    {
+      if (take(index, task))
+      {
+        task();
+        task = Task();
+        ++executed;
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(idleMutex);
+      sleepers.fetch_add(1);
+      idleWakeup.wait(lock, [&] { return queued.load() > 0 || stopping; });
+      sleepers.fetch_sub(1);
+      if (stopping && queued.load() == 0)
+        return;
+    }
+  }
+
+  // Strands are never erased, so `strand` stays valid
+  void runStrand(Strand* strand)
+  {
+    std::array<Task, STRAND_BATCH> batch;
+    size_t                         count = 0;
+    {
+      std::lock_guard<std::mutex> lock(strandsMutex);
+      while (!strand->tasks.empty() && count < STRAND_BATCH)
+        batch[count++] = strand->tasks.pop_front();
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+      batch[i]();
+      batch[i] = Task();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(strandsMutex);
+      if (strand->tasks.empty())
+      {
+        strand->scheduled = false;
+        --activeStrands;
+        return;
+      }
+    }
+    enqueue([this, strand] { runStrand(strand); });
+  }
+
+public:
+  explicit CallbackExecutor(
+    size_t threads = std::thread::hardware_concurrency())
+  {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i)
+      workers.push_back(std::make_unique<Worker>());
+    for (size_t i = 0; i < threads; ++i)
+    {
+      workers[i]->thread = std::thread([this, i] {
+        std::string name = "callback-" + std::to_string(i);
+        pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+        workerLoop(i);
+      });
+    }
+  }
+
+  // Runs every callback already submitted, then joins the workers
+  ~CallbackExecutor()
+  {
+    {
+      std::lock_guard<std::mutex> lock(idleMutex);
+      stopping = true;
+    }
+    idleWakeup.notify_all();
+    for (auto& worker : workers)
+      worker->thread.join();
+  }
+
+  CallbackExecutor(const CallbackExecutor&)            = delete;
+  CallbackExecutor& operator=(const CallbackExecutor&) = delete;
+
+  // Runs `task` on some worker, unordered with respect to anything else
+  void submit(Task task) { enqueue(std::move(task)); }
+
+  // Runs `task` after every task submitted earlier under the same key
+  void submit(const std::string& key, Task task)
+  {
+    Strand* idle = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(strandsMutex);
+
+      Strand& strand = strands.try_emplace(key).first->second;
+      strand.tasks.push_back(std::move(task));
+      if (!strand.scheduled)
+      {
+        strand.scheduled = true;
+        ++activeStrands;
+        idle = &strand;
+      }
+    }
+    if (idle)
+      enqueue([this, idle] { runStrand(idle); });
+  }
+
+  ExecutorStats stats()
+  {
+    ExecutorStats result;
+    result.threads  = workers.size();
+    result.executed = executed;
+    result.stolen   = stolen;
+    std::lock_guard<std::mutex> lock(strandsMutex);
+    result.strands = activeStrands;
+    return result;
+  }
+};
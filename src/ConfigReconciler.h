@@ -0,0 +1,222 @@
+#pragma once
+
+#include <fstream>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "FleetProvisioner.h"
+#include "Result.h"
+#include "Uuid.h"
+
+struct DesiredValue
+{
+  std::string              uuid; // canonical lowercase form
+  std::vector<uint8_t>     value;
+  std::vector<std::string> after; // written before this one, if written
+};
+
+// The configuration a device should end up with. Loaded from a text file
+// with one directive per line ('#' starts a comment):
+//
+//   set <uuid> <hex>           desired value, hex as in a provisioning job
+//   after <uuid> <uuid>...     write the first only after the others
+//
+// Values are otherwise written in file order.
+struct DesiredState
+{
+  std::vector<DesiredValue> values;
+
+  static bool load(const std::string& path,
+                   DesiredState&      state,
+                   std::string&       error)
+  {
+    std::ifstream file(path);
+    if (!file)
+    {
+      error = "cannot open " + path;
+      return false;
+    }
+
+    DesiredState                  parsed;
+    std::map<std::string, size_t> index;
+    std::string                   line;
+    size_t                        lineNumber = 0;
+    auto fail = [&](const std::string& what) {
+      error = path + ":" + std::to_string(lineNumber) + ": " + what;
+      return false;
+    };
+    auto canonical = [](const std::string& text, std::string& uuid) {
+      Uuid128 parsedUuid;
+      if (!Uuid128::parse(text, parsedUuid))
+        return false;
+      uuid = parsedUuid.toString();
+      return true;
+    };
+
+    std::vector<std::pair<std::string, std::string>> orderings;
+    while (std::getline(file, line))
+    {
+      ++lineNumber;
+      line = line.substr(0, line.find('#'));
+
+      std::istringstream stream(line);
+      std::string        directive;
+      std::string        argument;
+      if (!(stream >> directive))
+        continue;
+      if (!(stream >> argument))
+        return fail("missing UUID");
+
+      std::string uuid;
+      if (!canonical(argument, uuid))
+        return fail("invalid UUID '" + argument + "'");
+
+      if (directive == "set")
+      {
+        std::string  rest;
+        DesiredValue desired;
+        std::getline(stream, rest);
+        desired.uuid = uuid;
+        if (!ProvisionJob::parseHex(rest, desired.value))
+          return fail("invalid value for " + uuid);
+        if (!index.emplace(uuid, parsed.values.size()).second)
+          return fail(uuid + " is set twice");
+        parsed.values.push_back(std::move(desired));
+      }
+      else if (directive == "after")
+      {
+        std::string dependency;
+        while (stream >> argument)
+        {
+          if (!canonical(argument, dependency))
+            return fail("invalid UUID '" + argument + "'");
+          orderings.emplace_back(uuid, dependency);
+        }
+      }
+      else
+      {
+        return fail("invalid directive '" + line + "'");
+      }
+    }
+
+    for (const auto& [uuid, dependency] : orderings)
+    {
+      auto it = index.find(uuid);
+      if (it == index.end() || !index.count(dependency))
+      {
+        error = path + ": 'after' names " +
+                (it == index.end() ? uuid : dependency) + ", which is not set";
+        return false;
+      }
+      parsed.values[it->second].after.push_back(dependency);
+    }
+
+    if (parsed.values.empty())
+    {
+      error = path + ": no set directives";
+      return false;
+    }
+    state = std::move(parsed);
+    return true;
+  }
+
+  // Indices into `values` with every value after the ones it depends on,
+  // and in file order where the dependencies leave a choice
+  bool writeOrder(std::vector<size_t>& order, std::string& error) const
+  {
+    std::map<std::string, size_t> index;
+    for (size_t i = 0; i < values.size(); ++i)
+      index[values[i].uuid] = i;
+
+    std::vector<size_t>              waitingOn(values.size(), 0);
+    std::vector<std::vector<size_t>> dependents(values.size());
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+      for (const std::string& dependency : values[i].after)
+      {
+        ++waitingOn[i];
+        dependents[index.at(dependency)].push_back(i);
+      }
+    }
+
+    std::set<size_t> ready;
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+      if (waitingOn[i] == 0)
+        ready.insert(i);
+    }
+
+    order.clear();
+    while (!ready.empty())
+    {
+      size_t next = *ready.begin();
+      ready.erase(ready.begin());
+      order.push_back(next);
+      for (size_t dependent : dependents[next])
+      {
+        if (--waitingOn[dependent] == 0)
+          ready.insert(dependent);
+      }
+    }
+
+    if (order.size() != values.size())
+    {
+      for (size_t i = 0; i < values.size(); ++i)
+      {
+        if (waitingOn[i] > 0)
+        {
+          error = "'after' directives form a cycle through " + values[i].uuid;
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+};
+
+// One desired value compared with what the device holds. A value that
+// could not be read is unknown and always written.
+struct ReconcileStep
+{
+  const DesiredValue*                 desired = nullptr;
+  std::optional<std::vector<uint8_t>> current;
+  bool                                cached = false; // current not re-read
+  std::optional<CallError>            readError;
+
+  bool needsWrite() const { return !current || *current != desired->value; }
+};
+
+using CurrentValues = std::map<std::string, Result<std::vector<uint8_t>>>;
+
+// The diff between `state` and the `current` values (UUID -> value or read
+// error), in write order. UUIDs in `cached` were not read from the device.
+inline bool planReconcile(const DesiredState&          state,
+                          const CurrentValues&         current,
+                          const std::set<std::string>& cached,
+                          std::vector<ReconcileStep>&  plan,
+                          std::string&                 error)
+{
+  std::vector<size_t> order;
+  if (!state.writeOrder(order, error))
+    return false;
+
+  plan.clear();
+  for (size_t i : order)
+  {
+    ReconcileStep step;
+    step.desired = &state.values[i];
+    step.cached  = cached.count(step.desired->uuid) > 0;
+    auto it      = current.find(step.desired->uuid);
+    if (it != current.end() && it->second)
+      step.current = it->second.value();
+    else if (it != current.end())
+      step.readError = it->second.error();
+    plan.push_back(std::move(step));
+  }
+  return true;
+}
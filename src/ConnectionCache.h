@@ -0,0 +1,160 @@
+#pragma once
+
+#include <sdbus-c++/sdbus-c++.h>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct ConnectionStats
+{
+  uint64_t hits      = 0; // operations served by a live cached connection
+  uint64_t misses    = 0; // operations that needed a (re)connect
+  uint64_t evictions = 0; // least recently used connections closed for room
+  uint64_t drops     = 0; // links lost underneath the cache
+};
+
+// A connected device kept warm by the cache, with its GATT characteristics
+struct Connection
+{
+  using Clock   = std::chrono::steady_clock;
+  using Values  = std::map<std::string, std::vector<uint8_t>>;
+  using Proxies = std::map<std::string, std::shared_ptr<sdbus::IProxy>>;
+
+  std::string                        path;
+  std::map<std::string, std::string> characteristics; // UUID -> object path
+  Proxies                            proxies; // UUID -> characteristic
+  sdbus::Slot                        watch; // Device1 PropertiesChanged
+  std::map<std::string, sdbus::Slot> notifications; // UUID -> Value signal
+  Values                             values; // UUID -> last value seen
+  bool                               linkUp = true;
+  Clock::time_point                  connectedAt;
+  Clock::time_point                  lastUsed;
+  uint64_t                           uses = 0;
+};
+
+// Keeps up to `capacity` devices connected, ordered by last use. When a new
+// connection is needed and the controller's slots are all taken, the least
+// recently used device is handed back to the caller to disconnect, so that
+// frequently polled devices never pay for a reconnect.
+//
+// Entries are handed out of the cache (rather than destroyed inside it) when
+// removed, so the owner can release their signal slots outside its lock.
+class ConnectionCache
+{
+public:
+  using Clock = Connection::Clock;
+
+private:
+  std::list<Connection> order; // most recently used first
+  std::unordered_map<std::string, std::list<Connection>::iterator> byPath;
+  size_t                                                           limit;
+  ConnectionStats                                                  counters;
+
+  Connection extract(std::list<Connection>::iterator it)
+  {
+    Connection removed = std::move(*it);
+    byPath.erase(removed.path);
+    order.erase(it);
+    return removed;
+  }
+
+public:
+  explicit ConnectionCache(size_t capacity = 4)
+    : limit(capacity > 0 ? capacity : 1)
+  {
+  }
+
+  // Returns the live connection for `path` and marks it most recently used,
+  // or nullptr if the device has to be (re)connected
+  Connection* use(const std::string& path, Clock::time_point now)
+  {
+    auto it = byPath.find(path);
+    if (it == byPath.end() || !it->second->linkUp)
+    {
+      ++counters.misses;
+      return nullptr;
+    }
+
+    order.splice(order.begin(), order, it->second);
+    Connection& entry = order.front();
+    entry.lastUsed    = now;
+    ++entry.uses;
+    ++counters.hits;
+    return &entry;
+  }
+
+  Connection* find(const std::string& path)
+  {
+    auto it = byPath.find(path);
+    return it == byPath.end() ? nullptr : &*it->second;
+  }
+
+  Connection* mostRecent()
+  {
+    return order.empty() ? nullptr : &order.front();
+  }
+
+  bool full() const { return order.size() >= limit; }
+
+  Connection& insert(Connection entry)
+  {
+    order.push_front(std::move(entry));
+    byPath[order.front().path] = order.begin();
+    return order.front();
+  }
+
+  bool take(const std::string& path, Connection& out)
+  {
+    auto it = byPath.find(path);
+    if (it == byPath.end())
+      return false;
+    out = extract(it->second);
+    return true;
+  }
+
+  bool takeLeastRecent(Connection& out)
+  {
+    if (order.empty())
+      return false;
+    out = extract(std::prev(order.end()));
+    ++counters.evictions;
+    return true;
+  }
+
+  // Shrinking the cache hands back the connections that no longer fit
+  std::vector<Connection> setCapacity(size_t capacity)
+  {
+    limit = capacity > 0 ? capacity : 1;
+
+    std::vector<Connection> removed;
+    while (order.size() > limit)
+    {
+      removed.push_back(extract(std::prev(order.end())));
+      ++counters.evictions;
+    }
+    return removed;
+  }
+
+  // Called when BlueZ reports the device disconnected
+  bool markDown(const std::string& path)
+  {
+    Connection* entry = find(path);
+    if (!entry || !entry->linkUp)
+      return false;
+    entry->linkUp = false;
+    ++counters.drops;
+    return true;
+  }
+
+  const std::list<Connection>& all() const { return order; }
+  size_t                       size() const { return order.size(); }
+  size_t                       capacity() const { return limit; }
+  const ConnectionStats&       stats() const { return counters; }
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Uuid.h"
+
+// Characteristics to bring up as soon as a device's services are resolved.
+// UUIDs are stored in the canonical lowercase form BlueZ reports.
+struct ConnectionProfile
+{
+  std::vector<std::string> subscribe; // StartNotify on connect
+  std::vector<std::string> read;      // read once on connect
+
+  bool empty() const { return subscribe.empty() && read.empty(); }
+
+  // Parses a comma- or space-separated list of full or short-form UUIDs
+  static bool parseUuids(const std::string&        text,
+                         std::vector<std::string>& out,
+                         std::string&              error)
+  {
+    std::string token;
+    std::string separated = text;
+    for (char& c : separated)
+    {
+      if (c == ',')
+        c = ' ';
+    }
+
+    std::istringstream stream(separated);
+    while (stream >> token)
+    {
+      Uuid128 uuid;
+      if (!Uuid128::parse(token, uuid))
+      {
+        error = "invalid UUID '" + token + "'";
+        return false;
+      }
+      out.push_back(uuid.toString());
+    }
+    return true;
+  }
+};
+
+// Connection profiles keyed by 48-bit device address, with an optional
+// default for devices that have none of their own
+class ConnectionProfiles
+{
+private:
+  std::map<uint64_t, ConnectionProfile> byAddress;
+  std::optional<ConnectionProfile>      fallback;
+
+public:
+  void set(uint64_t address, ConnectionProfile profile)
+  {
+    byAddress[address] = std::move(profile);
+  }
+  void setDefault(ConnectionProfile profile) { fallback = std::move(profile); }
+
+  bool remove(uint64_t address) { return byAddress.erase(address) > 0; }
+  void removeDefault() { fallback.reset(); }
+
+  const ConnectionProfile* find(uint64_t address) const
+  {
+    auto it = byAddress.find(address);
+    if (it != byAddress.end())
+      return &it->second;
+    return fallback ? &*fallback : nullptr;
+  }
+
+  const std::map<uint64_t, ConnectionProfile>& all() const
+  {
+    return byAddress;
+  }
+  const std::optional<ConnectionProfile>& defaultProfile() const
+  {
+    return fallback;
+  }
+};
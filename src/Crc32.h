@@ -0,0 +1,188 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#elif defined(__PCLMUL__) && defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+// Incremental CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320), the
+// checksum used by zlib and most BLE DFU protocols. Feed data in any number
+// of pieces with update(); value() is the CRC of everything fed so far.
+//
+// The implementation is picked at compile time: the ARMv8 CRC32
+// instructions, carry-less multiply folding on x86 (SSE4.2's crc32
+// instruction computes CRC-32C, a different polynomial), or slicing-by-8
+// tables elsewhere.
+class Crc32
+{
+private:
+  uint32_t state = 0xffffffff; // pre-inverted
+
+  using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+  static const Tables& tables()
+  {
+    static const Tables built = [] {
+      Tables table{};
+      for (uint32_t i = 0; i < 256; ++i)
+      {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+          crc = (crc >> 1) ^ (0xedb88320 & (0u - (crc & 1)));
+        table[0][i] = crc;
+      }
+      for (uint32_t i = 0; i < 256; ++i)
+      {
+        for (size_t slice = 1; slice < 8; ++slice)
+        {
+          uint32_t previous = table[slice - 1][i];
+          table[slice][i]   = (previous >> 8) ^ table[0][previous & 0xff];
+        }
+      }
+      return table;
+    }();
+    return built;
+  }
+
+  static uint32_t updateTables(uint32_t crc, const uint8_t* data, size_t size)
+  {
+    const Tables& table = tables();
+    while (size >= 8)
+    {
+      uint32_t low;
+      uint32_t high;
+      std::memcpy(&low, data, 4);
+      std::memcpy(&high, data + 4, 4);
+      low ^= crc; // little-endian hosts only, like the rest of the tree
+      crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^
+            table[5][(low >> 16) & 0xff] ^ table[4][low >> 24] ^
+            table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^
+            table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+      data += 8;
+      size -= 8;
+    }
+    while (size--)
+      crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xff];
+    return crc;
+  }
+
+#if defined(__ARM_FEATURE_CRC32)
+  static uint32_t updateHardware(uint32_t crc, const uint8_t* data, size_t size)
+  {
+    while (size >= 8)
+    {
+      uint64_t word;
+      std::memcpy(&word, data, 8);
+      crc = __crc32d(crc, word);
+      data += 8;
+      size -= 8;
+    }
+    while (size--)
+      crc = __crc32b(crc, *data++);
+    return crc;
+  }
+#elif defined(__PCLMUL__) && defined(__SSE4_1__)
+  // Folds four 128-bit lanes at a time with carry-less multiplies, then
+  // reduces to 32 bits (Intel, "Fast CRC Computation for Generic Polynomials
+  // Using PCLMULQDQ Instruction"). Tail bytes go through the tables.
+  static uint32_t updateHardware(uint32_t crc, const uint8_t* data, size_t size)
+  {
+    if (size < 64)
+      return updateTables(crc, data, size);
+
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    auto load = [](const uint8_t* at) {
+      return _mm_loadu_si128(reinterpret_cast<const __m128i*>(at));
+    };
+    auto fold = [](__m128i lane, __m128i next, __m128i constants) {
+      __m128i low  = _mm_clmulepi64_si128(lane, constants, 0x00);
+      __m128i high = _mm_clmulepi64_si128(lane, constants, 0x11);
+      return _mm_xor_si128(_mm_xor_si128(high, low), next);
+    };
+
+    __m128i x1 = _mm_xor_si128(load(data),
+                               _mm_cvtsi32_si128(static_cast<int>(crc)));
+    __m128i x2 = load(data + 16);
+    __m128i x3 = load(data + 32);
+    __m128i x4 = load(data + 48);
+    data += 64;
+    size -= 64;
+
+    while (size >= 64)
+    {
+      x1 = fold(x1, load(data), k1k2);
+      x2 = fold(x2, load(data + 16), k1k2);
+      x3 = fold(x3, load(data + 32), k1k2);
+      x4 = fold(x4, load(data + 48), k1k2);
+      data += 64;
+      size -= 64;
+    }
+
+    x1 = fold(x1, x2, k3k4);
+    x1 = fold(x1, x3, k3k4);
+    x1 = fold(x1, x4, k3k4);
+    while (size >= 16)
+    {
+      x1 = fold(x1, load(data), k3k4);
+      data += 16;
+      size -= 16;
+    }
+
+    // 128 bits to 64
+    __m128i x2r = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1          = _mm_xor_si128(_mm_srli_si128(x1, 8), x2r);
+    x2r         = _mm_srli_si128(x1, 4);
+    x1          = _mm_and_si128(x1, mask);
+    x1          = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1          = _mm_xor_si128(x1, x2r);
+
+    // Barrett reduction to 32 bits
+    x2r = _mm_and_si128(x1, mask);
+    x2r = _mm_clmulepi64_si128(x2r, poly, 0x10);
+    x2r = _mm_and_si128(x2r, mask);
+    x2r = _mm_clmulepi64_si128(x2r, poly, 0x00);
+    x1  = _mm_xor_si128(x1, x2r);
+
+    crc = static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+    return updateTables(crc, data, size);
+  }
+#endif
+
+public:
+  static constexpr bool accelerated =
+#if defined(__ARM_FEATURE_CRC32) || (defined(__PCLMUL__) && defined(__SSE4_1__))
+    true;
+#else
+    false;
+#endif
+
+  void update(const uint8_t* data, size_t size)
+  {
+#if defined(__ARM_FEATURE_CRC32) || (defined(__PCLMUL__) && defined(__SSE4_1__))
+    state = updateHardware(state, data, size);
+#else
+    state = updateTables(state, data, size);
+#endif
+  }
+
+  uint32_t value() const { return ~state; }
+  void     reset() { state = 0xffffffff; }
+
+  static uint32_t of(const uint8_t* data, size_t size)
+  {
+    Crc32 crc;
+    crc.update(data, size);
+    return crc.value();
+  }
+};
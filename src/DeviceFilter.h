@@ -0,0 +1,600 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <strings.h>
+#include <vector>
+
+#include "DeviceTable.h"
+#include "Uuid.h"
+
+// Device filter expressions such as
+//
+//   rssi > -70 && name ~ "^SENS-" && (uuid == 180d || mfg == 0x0059)
+//
+// Fields: rssi, txpower (integers), name, address (strings), uuid (service
+// UUID: short form, full or hex prefix), mfg (manufacturer company ID),
+// connected, paired (booleans; a bare field name means "== true").
+// Operators: == != < <= > >= and ~ for patterns, combined with && || ! and
+// parentheses. Patterns support literal characters, '.', '*' (repeat the
+// previous item), '^' and '$'.
+//
+// An expression is compiled once into a flat instruction list over a single
+// boolean register, with && and || as conditional jumps, so evaluating it
+// against a record never allocates.
+class DeviceFilter
+{
+public:
+  enum class Field : uint8_t
+  {
+    Rssi,
+    TxPower,
+    Name,
+    Address,
+    Uuid,
+    Manufacturer,
+    Connected,
+    Paired
+  };
+
+  enum class Op : uint8_t
+  {
+    Equal,
+    NotEqual,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    Match
+  };
+
+private:
+  enum class Opcode : uint8_t
+  {
+    Test,        // result = field <op> constant
+    Not,         // result = !result
+    JumpIfFalse, // short-circuit &&
+    JumpIfTrue   // short-circuit ||
+  };
+
+  struct Instruction
+  {
+    Opcode   opcode;
+    Field    field;
+    Op       op;
+    uint16_t operand; // constant index for Test, target for jumps
+    int32_t  number;
+  };
+
+  enum class TokenKind
+  {
+    Word,
+    String,
+    Operator,
+    End
+  };
+
+  struct Token
+  {
+    TokenKind   kind;
+    std::string text;
+  };
+
+  std::vector<Instruction> code;
+  std::vector<std::string> strings;
+  std::vector<UuidPattern> patterns;
+  std::string              source;
+
+  // Parser state, only used while compiling
+  std::vector<Token> tokens;
+  size_t             position = 0;
+  std::string        error;
+
+  static bool tokenize(const std::string& text, std::vector<Token>& out,
+                       std::string& error)
+  {
+    size_t i = 0;
+    while (i < text.size())
+    {
+      char c = text[i];
+      if (std::isspace(static_cast<unsigned char>(c)))
+      {
+        ++i;
+        continue;
+      }
+
+      if (c == '"')
+      {
+        size_t end = text.find('"', i + 1);
+        if (end == std::string::npos)
+        {
+          error = "unterminated string";
+          return false;
+        }
+        out.push_back({TokenKind::String, text.substr(i + 1, end - i - 1)});
+        i = end + 1;
+        continue;
+      }
+
+      static const char* const operators[] = {"&&", "||", "==", "!=", "<=",
+                                              ">=", "<",  ">",  "~",  "!",
+                                              "(",  ")"};
+      bool matched = false;
+      for (const char* op : operators)
+      {
+        size_t length = std::char_traits<char>::length(op);
+        if (text.compare(i, length, op) == 0)
+        {
+          out.push_back({TokenKind::Operator, op});
+          i += length;
+          matched = true;
+          break;
+        }
+      }
+      if (matched)
+        continue;
+
+      size_t start = i;
+      while (i < text.size() &&
+             (std::isalnum(static_cast<unsigned char>(text[i])) ||
+              text[i] == '_' || text[i] == '-' || text[i] == ':' ||
+              text[i] == '.'))
+      {
+        ++i;
+      }
+      if (i == start)
+      {
+        error = std::string("unexpected character '") + c + "'";
+        return false;
+      }
+      out.push_back({TokenKind::Word, text.substr(start, i - start)});
+    }
+    out.push_back({TokenKind::End, ""});
+    return true;
+  }
+
+  const Token& peek() const { return tokens[position]; }
+
+  bool accept(const char* op)
+  {
+    if (peek().kind == TokenKind::Operator && peek().text == op)
+    {
+      ++position;
+      return true;
+    }
+    return false;
+  }
+
+  size_t emit(Opcode opcode)
+  {
+    code.push_back({opcode, Field::Rssi, Op::Equal, 0, 0});
+    return code.size() - 1;
+  }
+
+  void patchJump(size_t at)
+  {
+    code[at].operand = static_cast<uint16_t>(code.size());
+  }
+
+  bool parseOr()
+  {
+    if (!parseAnd())
+      return false;
+
+    std::vector<size_t> jumps;
+    while (accept("||"))
+    {
+      jumps.push_back(emit(Opcode::JumpIfTrue));
+      if (!parseAnd())
+        return false;
+    }
+    for (size_t jump : jumps)
+    {
+      patchJump(jump);
+    }
+    return true;
+  }
+
+  bool parseAnd()
+  {
+    if (!parseUnary())
+      return false;
+
+    std::vector<size_t> jumps;
+    while (accept("&&"))
+    {
+      jumps.push_back(emit(Opcode::JumpIfFalse));
+      if (!parseUnary())
+        return false;
+    }
+    for (size_t jump : jumps)
+    {
+      patchJump(jump);
+    }
+    return true;
+  }
+
+  bool parseUnary()
+  {
+    if (accept("!"))
+    {
+      if (!parseUnary())
+        return false;
+      emit(Opcode::Not);
+      return true;
+    }
+    if (accept("("))
+    {
+      if (!parseOr())
+        return false;
+      if (!accept(")"))
+      {
+        error = "expected ')'";
+        return false;
+      }
+      return true;
+    }
+    return parseComparison();
+  }
+
+  static bool parseField(const std::string& name, Field& field)
+  {
+    static const std::pair<const char*, Field> fields[] = {
+      {"rssi", Field::Rssi},
+      {"txpower", Field::TxPower},
+      {"name", Field::Name},
+      {"address", Field::Address},
+      {"uuid", Field::Uuid},
+      {"mfg", Field::Manufacturer},
+      {"connected", Field::Connected},
+      {"paired", Field::Paired}};
+
+    for (const auto& [text, value] : fields)
+    {
+      if (name == text)
+      {
+        field = value;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool parseNumber(const std::string& text, int32_t& number)
+  {
+    if (text.empty())
+      return false;
+
+    char* end  = nullptr;
+    errno      = 0;
+    long value = std::strtol(text.c_str(), &end, 0);
+    if (*end != '\0' || errno != 0 || value < INT32_MIN || value > INT32_MAX)
+      return false;
+
+    number = static_cast<int32_t>(value);
+    return true;
+  }
+
+  bool parseComparison()
+  {
+    Token fieldToken = peek();
+    Field field;
+    if (fieldToken.kind != TokenKind::Word ||
+        !parseField(fieldToken.text, field))
+    {
+      error = "expected field name, got '" + fieldToken.text + "'";
+      return false;
+    }
+    ++position;
+
+    Instruction test{Opcode::Test, field, Op::Equal, 0, 1};
+    bool isBool = field == Field::Connected || field == Field::Paired;
+
+    static const std::pair<const char*, Op> ops[] = {
+      {"==", Op::Equal},
+      {"!=", Op::NotEqual},
+      {"<", Op::Less},
+      {"<=", Op::LessEqual},
+      {">", Op::Greater},
+      {">=", Op::GreaterEqual},
+      {"~", Op::Match}};
+
+    bool hasOp = false;
+    for (const auto& [text, op] : ops)
+    {
+      if (accept(text))
+      {
+        test.op = op;
+        hasOp   = true;
+        break;
+      }
+    }
+
+    if (!hasOp)
+    {
+      if (!isBool)
+      {
+        error = "expected operator after '" + fieldToken.text + "'";
+        return false;
+      }
+      code.push_back(test);
+      return true;
+    }
+
+    const Token value = peek();
+    if (value.kind != TokenKind::Word && value.kind != TokenKind::String)
+    {
+      error = "expected value after operator";
+      return false;
+    }
+    ++position;
+
+    bool ordered = test.op != Op::Equal && test.op != Op::NotEqual;
+    switch (field)
+    {
+      case Field::Rssi:
+      case Field::TxPower:
+        if (test.op == Op::Match || !parseNumber(value.text, test.number))
+        {
+          error = "expected number for '" + fieldToken.text + "'";
+          return false;
+        }
+        break;
+
+      case Field::Name:
+      case Field::Address:
+        if (ordered && test.op != Op::Match)
+        {
+          error = "only ==, != and ~ apply to '" + fieldToken.text + "'";
+          return false;
+        }
+        test.operand = static_cast<uint16_t>(strings.size());
+        strings.push_back(value.text);
+        break;
+
+      case Field::Uuid:
+      {
+        UuidPattern pattern;
+        if (ordered || !UuidPattern::parse(value.text, pattern))
+        {
+          error = "expected == or != and a UUID for 'uuid'";
+          return false;
+        }
+        test.operand = static_cast<uint16_t>(patterns.size());
+        patterns.push_back(pattern);
+        break;
+      }
+
+      case Field::Manufacturer:
+        if (ordered || !parseNumber(value.text, test.number) ||
+            test.number < 0 || test.number > 0xffff)
+        {
+          error = "expected == or != and a company ID for 'mfg'";
+          return false;
+        }
+        break;
+
+      case Field::Connected:
+      case Field::Paired:
+        if (ordered)
+        {
+          error = "only == and != apply to '" + fieldToken.text + "'";
+          return false;
+        }
+        if (value.text == "true" || value.text == "1")
+          test.number = 1;
+        else if (value.text == "false" || value.text == "0")
+          test.number = 0;
+        else
+        {
+          error = "expected true or false for '" + fieldToken.text + "'";
+          return false;
+        }
+        break;
+    }
+
+    code.push_back(test);
+    return true;
+  }
+
+  // Rob Pike's matcher: c . * ^ $, iterative over the text, no allocation
+  static bool matchHere(const char* pattern, const char* text)
+  {
+    while (true)
+    {
+      if (pattern[0] == '\0')
+        return true;
+      if (pattern[1] == '*')
+        return matchStar(pattern[0], pattern + 2, text);
+      if (pattern[0] == '$' && pattern[1] == '\0')
+        return *text == '\0';
+      if (*text == '\0' || (pattern[0] != '.' && pattern[0] != *text))
+        return false;
+      ++pattern;
+      ++text;
+    }
+  }
+
+  static bool matchStar(char c, const char* pattern, const char* text)
+  {
+    do
+    {
+      if (matchHere(pattern, text))
+        return true;
+    } while (*text != '\0' && (*text++ == c || c == '.'));
+    return false;
+  }
+
+  static bool match(const char* pattern, const char* text)
+  {
+    if (pattern[0] == '^')
+      return matchHere(pattern + 1, text);
+    do
+    {
+      if (matchHere(pattern, text))
+        return true;
+    } while (*text++ != '\0');
+    return false;
+  }
+
+  static bool compare(int32_t value, Op op, int32_t constant)
+  {
+    switch (op)
+    {
+      case Op::Equal:
+        return value == constant;
+      case Op::NotEqual:
+        return value != constant;
+      case Op::Less:
+        return value < constant;
+      case Op::LessEqual:
+        return value <= constant;
+      case Op::Greater:
+        return value > constant;
+      case Op::GreaterEqual:
+        return value >= constant;
+      case Op::Match:
+        break;
+    }
+    return false;
+  }
+
+  bool test(const Instruction& in, const DeviceRecord& device) const
+  {
+    switch (in.field)
+    {
+      case Field::Rssi:
+        return device.hasRssi && compare(device.rssi, in.op, in.number);
+
+      case Field::TxPower:
+        return device.hasTxPower && compare(device.txPower, in.op, in.number);
+
+      case Field::Name:
+      case Field::Address:
+      {
+        const std::string& value =
+          in.field == Field::Name ? device.name : device.address;
+        const std::string& constant = strings[in.operand];
+
+        if (in.op == Op::Match)
+          return match(constant.c_str(), value.c_str());
+
+        // Addresses compare case-insensitively
+        bool equal = in.field == Field::Name
+                       ? value == constant
+                       : strcasecmp(value.c_str(), constant.c_str()) == 0;
+        return in.op == Op::Equal ? equal : !equal;
+      }
+
+      case Field::Uuid:
+      {
+        const UuidPattern& pattern = patterns[in.operand];
+        bool any = std::any_of(device.serviceUuids.begin(),
+                               device.serviceUuids.end(),
+                               [&](const Uuid128& uuid) {
+                                 return pattern.matches(uuid);
+                               });
+        return in.op == Op::Equal ? any : !any;
+      }
+
+      case Field::Manufacturer:
+      {
+        bool any = std::any_of(device.manufacturerData.begin(),
+                               device.manufacturerData.end(),
+                               [&](const auto& entry) {
+                                 return entry.first == in.number;
+                               });
+        return in.op == Op::Equal ? any : !any;
+      }
+
+      case Field::Connected:
+      case Field::Paired:
+      {
+        bool value = in.field == Field::Connected ? device.connected
+                                                  : device.paired;
+        return compare(value ? 1 : 0, in.op, in.number);
+      }
+    }
+    return false;
+  }
+
+public:
+  // Compiles `text`; on failure returns false and describes the problem in
+  // `errorMessage`. An empty expression matches every device.
+  static bool compile(const std::string& text, DeviceFilter& out,
+                      std::string& errorMessage)
+  {
+    DeviceFilter filter;
+    filter.source = text;
+
+    if (!tokenize(text, filter.tokens, errorMessage))
+      return false;
+
+    if (filter.peek().kind != TokenKind::End)
+    {
+      if (!filter.parseOr())
+      {
+        errorMessage = filter.error;
+        return false;
+      }
+      if (filter.peek().kind != TokenKind::End)
+      {
+        errorMessage = "unexpected '" + filter.peek().text + "'";
+        return false;
+      }
+    }
+
+    filter.tokens.clear();
+    filter.tokens.shrink_to_fit();
+    out = std::move(filter);
+    return true;
+  }
+
+  bool empty() const { return code.empty(); }
+
+  const std::string& expression() const { return source; }
+
+  bool evaluate(const DeviceRecord& device) const
+  {
+    bool   result = true;
+    size_t pc     = 0;
+    while (pc < code.size())
+    {
+      const Instruction& in = code[pc];
+      switch (in.opcode)
+      {
+        case Opcode::Test:
+          result = test(in, device);
+          break;
+        case Opcode::Not:
+          result = !result;
+          break;
+        case Opcode::JumpIfFalse:
+          if (!result)
+          {
+            pc = in.operand;
+            continue;
+          }
+          break;
+        case Opcode::JumpIfTrue:
+          if (result)
+          {
+            pc = in.operand;
+            continue;
+          }
+          break;
+      }
+      ++pc;
+    }
+    return result;
+  }
+
+  bool operator()(const DeviceRecord& device) const
+  {
+    return evaluate(device);
+  }
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include "CallControl.h"
+
+// How a BlueZ call against a device ended, as far as its health is concerned
+enum class CallOutcome
+{
+  Success,
+  Failure,     // counts towards the device's error rate
+  Unreachable, // out of range, timed out or gone: opens the breaker at once
+  Ignored,     // caller or local error that says nothing about the device
+};
+
+enum class BreakerState
+{
+  Closed,   // calls go through
+  Open,     // calls fail immediately until the retry time
+  HalfOpen, // a single probe call is allowed through
+};
+
+struct BreakerPolicy
+{
+  size_t               window      = 8; // recent outcomes considered
+  size_t               minSamples  = 4;
+  unsigned             failPercent = 50;
+  std::chrono::seconds openFor{15};
+  std::chrono::seconds maxOpenFor{300}; // cap for the doubling back-off
+};
+
+struct DeviceBreaker
+{
+  using Clock = std::chrono::steady_clock;
+
+  BreakerState      state = BreakerState::Closed;
+  std::deque<bool>  recent; // true for failures, newest last
+  size_t            failures = 0;
+  unsigned          trips    = 0; // consecutive openings, for back-off
+  bool              probing  = false;
+  Clock::time_point retryAt;
+  std::string       lastError;
+  uint64_t          rejected = 0;
+};
+
+// Per-device circuit breakers. A device that keeps failing, or fails in a
+// way that means it cannot be reached, is opened so that later calls fail
+// straight away instead of each waiting out a D-Bus timeout. Once the open
+// period has passed one probe call is let through; success closes the
+// breaker, failure reopens it for twice as long.
+class DeviceHealth
+{
+public:
+  using Clock = DeviceBreaker::Clock;
+
+private:
+  std::unordered_map<std::string, DeviceBreaker> breakers;
+  BreakerPolicy                                  policy;
+
+  void open(DeviceBreaker& breaker, Clock::time_point now)
+  {
+    auto backoff = policy.openFor * (1LL << std::min(breaker.trips, 10u));
+    breaker.state   = BreakerState::Open;
+    breaker.retryAt = now + std::min<std::chrono::seconds>(
+                              backoff, policy.maxOpenFor);
+    breaker.probing = false;
+    ++breaker.trips;
+  }
+
+  void close(DeviceBreaker& breaker)
+  {
+    breaker.state    = BreakerState::Closed;
+    breaker.probing  = false;
+    breaker.trips    = 0;
+    breaker.failures = 0;
+    breaker.recent.clear();
+  }
+
+public:
+  // Maps a D-Bus error name (and BlueZ's message for the catch-all
+  // org.bluez.Error.Failed) onto an outcome
+  static CallOutcome classify(const std::string& name,
+                              const std::string& message)
+  {
+    if (name == "org.freedesktop.DBus.Error.NoReply" ||
+        name == "org.freedesktop.DBus.Error.Timeout" ||
+        name == "org.freedesktop.DBus.Error.TimedOut" ||
+        name == "org.freedesktop.DBus.Error.UnknownObject" ||
+        name == "org.bluez.Error.DoesNotExist")
+      return CallOutcome::Unreachable;
+
+    if (name == "org.bluez.Error.Failed" &&
+        (message.find("abort-by-local") != std::string::npos ||
+         message.find("Timeout") != std::string::npos ||
+         message.find("timed out") != std::string::npos ||
+         message.find("Host is down") != std::string::npos))
+      return CallOutcome::Unreachable;
+
+    if (name == "org.bluez.Error.InProgress" ||
+        name == "org.bluez.Error.AlreadyConnected" ||
+        name == "org.bluez.Error.InvalidArguments" ||
+        name == "org.bluez.Error.NotPermitted" ||
+        name == "org.bluez.Error.NotAuthorized" ||
+        name == "org.bluez.Error.NotSupported" ||
+        name == "org.freedesktop.DBus.Error.InvalidArgs" ||
+        name == "org.freedesktop.DBus.Error.AccessDenied" ||
+        name == CALL_CANCELLED)
+      return CallOutcome::Ignored;
+
+    return CallOutcome::Failure;
+  }
+
+  // True for failures a later attempt might not run into, such as a lost
+  // link or a device out of range
+  static bool transient(const CallError& error)
+  {
+    if (error.name == ERROR_CIRCUIT_OPEN || error.name == ERROR_NOT_CONNECTED)
+      return true;
+    if (error.name == ERROR_NO_CHARACTERISTIC ||
+        error.name == ERROR_VERIFY_FAILED)
+      return false;
+
+    CallOutcome outcome = classify(error.name, error.message);
+    return outcome == CallOutcome::Unreachable ||
+           outcome == CallOutcome::Failure;
+  }
+
+  void setPolicy(const BreakerPolicy& newPolicy) { policy = newPolicy; }
+  const BreakerPolicy& getPolicy() const { return policy; }
+
+  // Returns false if calls to the device should fail fast, with the time
+  // left until the next probe in `retryIn`. A true result from a half-open
+  // breaker is the probe, and must be followed by record().
+  bool allow(const std::string&         path,
+             Clock::time_point          now,
+             std::chrono::milliseconds& retryIn)
+  {
+    auto it = breakers.find(path);
+    if (it == breakers.end())
+      return true;
+
+    DeviceBreaker& breaker = it->second;
+    if (breaker.state == BreakerState::Open && now >= breaker.retryAt)
+      breaker.state = BreakerState::HalfOpen;
+
+    switch (breaker.state)
+    {
+      case BreakerState::Closed:
+        return true;
+
+      case BreakerState::HalfOpen:
+        if (!breaker.probing)
+        {
+          breaker.probing = true;
+          return true;
+        }
+        retryIn = std::chrono::milliseconds(0);
+        break;
+
+      case BreakerState::Open:
+        retryIn = std::chrono::duration_cast<std::chrono::milliseconds>(
+          breaker.retryAt - now);
+        break;
+    }
+    ++breaker.rejected;
+    return false;
+  }
+
+  void record(const std::string& path,
+              CallOutcome        outcome,
+              Clock::time_point  now,
+              const std::string& error = std::string())
+  {
+    if (outcome == CallOutcome::Ignored)
+    {
+      auto it = breakers.find(path);
+      if (it != breakers.end())
+        it->second.probing = false;
+      return;
+    }
+
+    DeviceBreaker& breaker = breakers[path];
+    bool           failed  = outcome != CallOutcome::Success;
+    if (failed)
+      breaker.lastError = error;
+
+    if (breaker.state == BreakerState::HalfOpen)
+    {
+      if (failed)
+        open(breaker, now);
+      else
+        close(breaker);
+      return;
+    }
+
+    breaker.recent.push_back(failed);
+    breaker.failures += failed;
+    if (breaker.recent.size() > policy.window)
+    {
+      breaker.failures -= breaker.recent.front();
+      breaker.recent.pop_front();
+    }
+
+    if (breaker.state != BreakerState::Closed || !failed)
+      return;
+    if (outcome == CallOutcome::Unreachable ||
+        (breaker.recent.size() >= policy.minSamples &&
+         breaker.failures * 100 >= breaker.recent.size() * policy.failPercent))
+      open(breaker, now);
+  }
+
+  void reset(const std::string& path) { breakers.erase(path); }
+
+  const DeviceBreaker* find(const std::string& path) const
+  {
+    auto it = breakers.find(path);
+    return it == breakers.end() ? nullptr : &it->second;
+  }
+
+  const std::unordered_map<std::string, DeviceBreaker>& all() const
+  {
+    return breakers;
+  }
+};
@@ -0,0 +1,801 @@
+#pragma once
+
+#include <sdbus-c++/sdbus-c++.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Uuid.h"
+
+enum class DeviceChange
+{
+  Added,
+  Updated,
+  Removed
+};
+
+struct DeviceRecord
+{
+  std::string                                            path;
+  std::map<std::string, sdbus::Variant>                  properties;
+  std::string                                            name;
+  std::string                                            address;
+  std::vector<std::string>                               uuids;
+  std::vector<Uuid128>                                   serviceUuids;
+  std::vector<std::pair<uint16_t, std::vector<uint8_t>>> manufacturerData;
+  std::vector<std::pair<Uuid128, std::vector<uint8_t>>>  serviceData;
+  int16_t                                                rssi        = 0;
+  bool                                                   hasRssi     = false;
+  int16_t                                                txPower     = 0;
+  bool                                                   hasTxPower  = false;
+  bool                                                   connected   = false;
+  bool                                                   paired      = false;
+  std::chrono::steady_clock::time_point                  lastSeen;
+  size_t                                                 footprint   = 0;
+  uint64_t                                               contentHash = 0;
+  uint64_t                                               generation  = 0;
+};
+
+// Limits applied by DeviceTable::evict(). Zero disables a limit.
+struct EvictionPolicy
+{
+  size_t               maxEntries = 0;
+  size_t               maxBytes   = 0;
+  std::chrono::seconds maxAge{0};
+};
+
+// Result of DeviceTable::changesSince(). When `resync` is set the change log
+// no longer reaches back to `fromGeneration` and `added` holds every device
+// currently in the table, so the consumer should rebuild its view.
+struct DeviceDelta
+{
+  uint64_t                 fromGeneration = 0;
+  uint64_t                 toGeneration   = 0;
+  bool                     resync         = false;
+  std::vector<std::string> added;
+  std::vector<std::string> updated;
+  std::vector<std::string> removed;
+};
+
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash)
+{
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i)
+  {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+inline uint64_t hashString(const std::string& value, uint64_t hash)
+{
+  // Include the length so adjacent strings cannot alias each other
+  uint64_t length = value.size();
+  hash            = hashBytes(&length, sizeof(length), hash);
+  return hashBytes(value.data(), value.size(), hash);
+}
+
+// Hashes the value held by a BlueZ property Variant. Only the types BlueZ
+// uses for Device1 properties are decoded; anything else hashes differently
+// every time, so a change to it is never mistaken for a repeat.
+inline uint64_t hashVariant(const sdbus::Variant& value, uint64_t hash)
+{
+  if (value.containsValueOfType<std::string>())
+    return hashString(value.get<std::string>(), hash);
+  if (value.containsValueOfType<sdbus::ObjectPath>())
+    return hashString(value.get<sdbus::ObjectPath>(), hash);
+  if (value.containsValueOfType<bool>())
+  {
+    uint8_t flag = value.get<bool>() ? 1 : 0;
+    return hashBytes(&flag, sizeof(flag), hash);
+  }
+  if (value.containsValueOfType<int16_t>())
+  {
+    int16_t number = value.get<int16_t>();
+    return hashBytes(&number, sizeof(number), hash);
+  }
+  if (value.containsValueOfType<uint16_t>())
+  {
+    uint16_t number = value.get<uint16_t>();
+    return hashBytes(&number, sizeof(number), hash);
+  }
+  if (value.containsValueOfType<uint32_t>())
+  {
+    uint32_t number = value.get<uint32_t>();
+    return hashBytes(&number, sizeof(number), hash);
+  }
+  if (value.containsValueOfType<std::vector<uint8_t>>())
+  {
+    auto bytes = value.get<std::vector<uint8_t>>();
+    return hashBytes(bytes.data(), bytes.size(), hash);
+  }
+  if (value.containsValueOfType<std::vector<std::string>>())
+  {
+    for (const auto& item : value.get<std::vector<std::string>>())
+      hash = hashString(item, hash);
+    return hash;
+  }
+  if (value.containsValueOfType<std::map<uint16_t, sdbus::Variant>>())
+  {
+    for (const auto& [key, item] :
+         value.get<std::map<uint16_t, sdbus::Variant>>())
+    {
+      hash = hashBytes(&key, sizeof(key), hash);
+      hash = hashVariant(item, hash);
+    }
+    return hash;
+  }
+  if (value.containsValueOfType<std::map<std::string, sdbus::Variant>>())
+  {
+    for (const auto& [key, item] :
+         value.get<std::map<std::string, sdbus::Variant>>())
+    {
+      hash = hashString(key, hash);
+      hash = hashVariant(item, hash);
+    }
+    return hash;
+  }
+  // AdvertisingData: AD type to payload
+  if (value.containsValueOfType<std::map<uint8_t, sdbus::Variant>>())
+  {
+    for (const auto& [key, item] :
+         value.get<std::map<uint8_t, sdbus::Variant>>())
+    {
+      hash = hashBytes(&key, sizeof(key), hash);
+      hash = hashVariant(item, hash);
+    }
+    return hash;
+  }
+  // Sets: coordinated set object to its properties
+  if (value.containsValueOfType<
+        std::map<sdbus::ObjectPath, std::map<std::string, sdbus::Variant>>>())
+  {
+    for (const auto& [key, item] :
+         value.get<std::map<sdbus::ObjectPath,
+                            std::map<std::string, sdbus::Variant>>>())
+    {
+      hash = hashString(key, hash);
+      hash = hashVariant(sdbus::Variant(item), hash);
+    }
+    return hash;
+  }
+
+  static std::atomic<uint64_t> unknown{0};
+  uint64_t                     serial = unknown.fetch_add(1) + 1;
+  return hashBytes(&serial, sizeof(serial), hash);
+}
+
+inline uint64_t
+hashProperties(const std::map<std::string, sdbus::Variant>& props)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const auto& [key, value] : props)
+  {
+    hash = hashString(key, hash);
+    hash = hashVariant(value, hash);
+  }
+  return hash;
+}
+
+// Device1 objects keyed by object path. Every modification bumps a global
+// generation counter, stamps the record with it and appends to a bounded
+// change log, so pollers can ask for what changed since the generation they
+// last saw instead of diffing the whole table.
+//
+// Secondary indexes (address, RSSI, last-seen, name, service UUID) are kept
+// in step with every insert and removal so lookups never walk the table.
+class DeviceTable
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+private:
+  struct ChangeEntry
+  {
+    uint64_t     generation;
+    std::string  path;
+    DeviceChange kind;
+  };
+
+  std::map<std::string, DeviceRecord> records;
+  std::deque<ChangeEntry>             changeLog;
+  uint64_t                            currentGeneration = 0;
+  uint64_t                            logFloor          = 0;
+  size_t                              maxLogEntries;
+  size_t                              memoryBytes   = 0;
+  uint64_t                            evictionCount = 0;
+
+  std::function<bool(const DeviceRecord&)> admit;
+
+  // Full properties of devices the admission filter rejected, so a later
+  // PropertiesChanged delta can be applied and the filter re-evaluated.
+  // BlueZ removes such devices from its object tree (and erase() from here)
+  // once they stop advertising.
+  std::unordered_map<std::string, std::map<std::string, sdbus::Variant>>
+    heldBack;
+
+  std::unordered_map<std::string, std::string>                    byAddress;
+  std::set<std::pair<int16_t, std::string>>                       byRssi;
+  std::set<std::pair<Clock::time_point, std::string>>             byLastSeen;
+  std::set<std::pair<std::string, std::string>>                   byName;
+  std::unordered_map<Uuid128, std::set<std::string>, Uuid128Hash> byService;
+
+  void record(const std::string& path, DeviceChange kind)
+  {
+    changeLog.push_back({currentGeneration, path, kind});
+    while (changeLog.size() > maxLogEntries)
+    {
+      logFloor = changeLog.front().generation;
+      changeLog.pop_front();
+    }
+  }
+
+  static void extractFields(DeviceRecord& device)
+  {
+    const auto& props = device.properties;
+
+    device.name    = "Unknown";
+    device.address = "Unknown";
+    device.uuids.clear();
+    device.hasRssi    = false;
+    device.hasTxPower = false;
+    device.connected  = false;
+    device.paired     = false;
+
+    if (props.find("Name") != props.end())
+    {
+      device.name = props.at("Name").get<std::string>();
+    }
+    if (props.find("Address") != props.end())
+    {
+      device.address = props.at("Address").get<std::string>();
+    }
+    if (props.find("UUIDs") != props.end())
+    {
+      device.uuids = props.at("UUIDs").get<std::vector<std::string>>();
+    }
+    if (props.find("RSSI") != props.end())
+    {
+      device.rssi    = props.at("RSSI").get<int16_t>();
+      device.hasRssi = true;
+    }
+    if (props.find("TxPower") != props.end())
+    {
+      device.txPower    = props.at("TxPower").get<int16_t>();
+      device.hasTxPower = true;
+    }
+    if (props.find("Connected") != props.end())
+    {
+      device.connected = props.at("Connected").get<bool>();
+    }
+    if (props.find("Paired") != props.end())
+    {
+      device.paired = props.at("Paired").get<bool>();
+    }
+
+    device.serviceUuids.clear();
+    for (const auto& text : device.uuids)
+    {
+      Uuid128 uuid;
+      if (Uuid128::parse(text, uuid))
+        device.serviceUuids.push_back(uuid);
+    }
+
+    // Advertisement payloads are unpacked from their Variants once here so
+    // parsers can work on views into the record.
+    device.manufacturerData.clear();
+    if (props.find("ManufacturerData") != props.end())
+    {
+      for (const auto& [companyId, value] :
+           props.at("ManufacturerData")
+             .get<std::map<uint16_t, sdbus::Variant>>())
+      {
+        device.manufacturerData.emplace_back(
+          companyId, value.get<std::vector<uint8_t>>());
+      }
+    }
+
+    device.serviceData.clear();
+    if (props.find("ServiceData") != props.end())
+    {
+      for (const auto& [text, value] :
+           props.at("ServiceData")
+             .get<std::map<std::string, sdbus::Variant>>())
+      {
+        Uuid128 uuid;
+        if (Uuid128::parse(text, uuid))
+          device.serviceData.emplace_back(uuid,
+                                          value.get<std::vector<uint8_t>>());
+      }
+    }
+
+    device.footprint = estimateFootprint(device);
+  }
+
+  // Approximate heap cost of one record including its map node and index
+  // entries. Variant payloads live in sd-bus messages whose size is not
+  // exposed, so each property is charged a fixed estimate.
+  static size_t estimateFootprint(const DeviceRecord& device)
+  {
+    constexpr size_t NODE_OVERHEAD    = 48;
+    constexpr size_t VARIANT_ESTIMATE = 96;
+    constexpr size_t INDEX_ENTRIES    = 5;
+
+    size_t bytes = sizeof(DeviceRecord) + NODE_OVERHEAD;
+    bytes += 2 * device.path.capacity() + device.name.capacity() +
+             device.address.capacity();
+    bytes += INDEX_ENTRIES * (NODE_OVERHEAD + device.path.capacity());
+    for (const auto& [key, value] : device.properties)
+    {
+      bytes += NODE_OVERHEAD + key.capacity() + sizeof(value) +
+               VARIANT_ESTIMATE;
+    }
+    for (const auto& uuid : device.uuids)
+    {
+      bytes += sizeof(uuid) + uuid.capacity();
+    }
+    bytes += device.serviceUuids.capacity() * sizeof(Uuid128);
+    for (const auto& [companyId, data] : device.manufacturerData)
+    {
+      bytes += sizeof(companyId) + sizeof(data) + data.capacity();
+    }
+    for (const auto& [uuid, data] : device.serviceData)
+    {
+      bytes += sizeof(uuid) + sizeof(data) + data.capacity();
+    }
+    return bytes;
+  }
+
+  static std::string normalizeAddress(std::string address)
+  {
+    std::transform(address.begin(), address.end(), address.begin(),
+                   [](unsigned char c) {
+                     return static_cast<char>(std::toupper(c));
+                   });
+    return address;
+  }
+
+  void index(const std::string& path, const DeviceRecord& device)
+  {
+    if (device.properties.find("Address") != device.properties.end())
+      byAddress[normalizeAddress(device.address)] = path;
+    if (device.hasRssi)
+      byRssi.emplace(device.rssi, path);
+    if (device.properties.find("Name") != device.properties.end())
+      byName.emplace(device.name, path);
+    for (const auto& uuid : device.serviceUuids)
+      byService[uuid].insert(path);
+    byLastSeen.emplace(device.lastSeen, path);
+    memoryBytes += device.footprint;
+  }
+
+  void unindex(const std::string& path, const DeviceRecord& device)
+  {
+    auto address = byAddress.find(normalizeAddress(device.address));
+    if (address != byAddress.end() && address->second == path)
+      byAddress.erase(address);
+    if (device.hasRssi)
+      byRssi.erase({device.rssi, path});
+    byName.erase({device.name, path});
+    for (const auto& uuid : device.serviceUuids)
+    {
+      auto service = byService.find(uuid);
+      if (service == byService.end())
+        continue;
+      service->second.erase(path);
+      if (service->second.empty())
+        byService.erase(service);
+    }
+    byLastSeen.erase({device.lastSeen, path});
+    memoryBytes -= device.footprint;
+  }
+
+  // Removes the stored record only; held-back properties are kept
+  bool drop(const std::string& path)
+  {
+    auto it = records.find(path);
+    if (it == records.end())
+      return false;
+
+    unindex(path, it->second);
+    records.erase(it);
+
+    ++currentGeneration;
+    record(path, DeviceChange::Removed);
+    return true;
+  }
+
+  template <typename Iterator>
+  std::vector<const DeviceRecord*> collect(Iterator first, Iterator last,
+                                           size_t count) const
+  {
+    std::vector<const DeviceRecord*> result;
+    for (; first != last && result.size() < count; ++first)
+    {
+      result.push_back(&records.at(first->second));
+    }
+    return result;
+  }
+
+public:
+  explicit DeviceTable(size_t logCapacity = 4096)
+    : maxLogEntries(logCapacity)
+  {
+  }
+
+  // Only devices accepted by `filter` are stored; devices already in the
+  // table that no longer pass are removed, and previously rejected devices
+  // that now pass are added back. An empty filter admits everything.
+  void setAdmissionFilter(std::function<bool(const DeviceRecord&)> filter)
+  {
+    admit = std::move(filter);
+
+    // Held-back devices may pass the new filter; upsert() holds back again
+    // whatever still does not.
+    std::vector<std::string> held;
+    for (const auto& [path, props] : heldBack)
+    {
+      held.push_back(path);
+    }
+
+    std::vector<std::string> rejected;
+    for (const auto& [path, device] : records)
+    {
+      if (admit && !admit(device))
+        rejected.push_back(path);
+    }
+    for (const auto& path : rejected)
+    {
+      heldBack[path] = records.at(path).properties;
+      drop(path);
+    }
+
+    for (const auto& path : held)
+    {
+      auto props = std::move(heldBack.at(path));
+      heldBack.erase(path);
+      upsert(path, props);
+    }
+  }
+
+  // Inserts or replaces a device's properties. Returns false (and leaves the
+  // generation untouched) when the content is identical to what is stored.
+  bool upsert(const std::string&                           path,
+              const std::map<std::string, sdbus::Variant>& props,
+              Clock::time_point                            now = Clock::now())
+  {
+    uint64_t hash = hashProperties(props);
+
+    auto it = records.find(path);
+    if (it != records.end() && it->second.contentHash == hash)
+      return false;
+
+    DeviceRecord candidate;
+    candidate.path        = path;
+    candidate.properties  = props;
+    candidate.contentHash = hash;
+    candidate.lastSeen    = now;
+    extractFields(candidate);
+
+    if (admit && !admit(candidate))
+    {
+      heldBack[path] = props;
+      return drop(path);
+    }
+    heldBack.erase(path);
+
+    DeviceChange kind = DeviceChange::Added;
+    if (it != records.end())
+    {
+      kind = DeviceChange::Updated;
+      unindex(path, it->second);
+    }
+
+    candidate.generation = ++currentGeneration;
+    DeviceRecord& device = records[path];
+    device               = std::move(candidate);
+    index(path, device);
+
+    record(path, kind);
+    return true;
+  }
+
+  // Applies a PropertiesChanged update on top of the stored properties. A
+  // device whose content did not change is only marked as seen. A delta is
+  // never turned into a record on its own: an unknown device is ignored
+  // until upsert() sees its full property set.
+  bool merge(const std::string&                           path,
+             const std::map<std::string, sdbus::Variant>& changed,
+             const std::vector<std::string>&              invalidated,
+             Clock::time_point                            now = Clock::now())
+  {
+    std::map<std::string, sdbus::Variant> props;
+
+    auto it = records.find(path);
+    if (it != records.end())
+    {
+      props = it->second.properties;
+    }
+    else
+    {
+      auto held = heldBack.find(path);
+      if (held == heldBack.end())
+        return false;
+      props = held->second;
+    }
+
+    for (const auto& [key, value] : changed)
+    {
+      props[key] = value;
+    }
+    for (const auto& key : invalidated)
+    {
+      props.erase(key);
+    }
+
+    if (upsert(path, props, now))
+      return true;
+
+    touch(path, now);
+    return false;
+  }
+
+  // Refreshes last-seen without bumping the generation
+  void touch(const std::string& path, Clock::time_point now = Clock::now())
+  {
+    auto it = records.find(path);
+    if (it == records.end())
+      return;
+
+    byLastSeen.erase({it->second.lastSeen, path});
+    it->second.lastSeen = now;
+    byLastSeen.emplace(now, path);
+  }
+
+  // Removes least recently seen devices until the table is within `policy`,
+  // skipping any record for which `pinned` returns true. Returns the paths
+  // that were evicted.
+  template <typename Pinned>
+  std::vector<std::string> evict(const EvictionPolicy& policy,
+                                 Clock::time_point     now,
+                                 Pinned                pinned)
+  {
+    std::vector<std::string> evicted;
+
+    auto overLimit = [&](const DeviceRecord& device) {
+      if (policy.maxAge.count() > 0 && now - device.lastSeen > policy.maxAge)
+        return true;
+      if (policy.maxEntries > 0 && records.size() > policy.maxEntries)
+        return true;
+      return policy.maxBytes > 0 && memoryBytes > policy.maxBytes;
+    };
+
+    auto it = byLastSeen.begin();
+    while (it != byLastSeen.end())
+    {
+      const DeviceRecord& device = records.at(it->second);
+      if (!overLimit(device))
+        break;
+
+      if (pinned(device))
+      {
+        ++it;
+        continue;
+      }
+
+      std::string path = it->second;
+      ++it;
+      erase(path);
+      evicted.push_back(path);
+      ++evictionCount;
+    }
+    return evicted;
+  }
+
+  // Forgets the device, including any properties held back by the filter
+  bool erase(const std::string& path)
+  {
+    heldBack.erase(path);
+    return drop(path);
+  }
+
+  // Makes the table match a full snapshot of Device1 objects, recording only
+  // the devices that actually appeared, changed or disappeared.
+  void sync(const std::map<std::string, std::map<std::string, sdbus::Variant>>&
+              snapshot)
+  {
+    std::vector<std::string> gone;
+    for (const auto& [path, device] : records)
+    {
+      if (snapshot.find(path) == snapshot.end())
+        gone.push_back(path);
+    }
+    for (const auto& [path, props] : heldBack)
+    {
+      if (snapshot.find(path) == snapshot.end())
+        gone.push_back(path);
+    }
+    for (const auto& path : gone)
+    {
+      erase(path);
+    }
+    for (const auto& [path, props] : snapshot)
+    {
+      upsert(path, props);
+    }
+  }
+
+  DeviceDelta changesSince(uint64_t generation) const
+  {
+    DeviceDelta delta;
+    delta.fromGeneration = generation;
+    delta.toGeneration   = currentGeneration;
+
+    if (generation >= currentGeneration)
+      return delta;
+
+    if (generation < logFloor)
+    {
+      delta.resync = true;
+      for (const auto& [path, device] : records)
+      {
+        delta.added.push_back(path);
+      }
+      return delta;
+    }
+
+    auto first = std::upper_bound(
+      changeLog.begin(), changeLog.end(), generation,
+      [](uint64_t gen, const ChangeEntry& entry) {
+        return gen < entry.generation;
+      });
+
+    // Fold repeated changes to one device into its net effect, keeping the
+    // order in which devices first changed.
+    struct NetChange
+    {
+      DeviceChange first;
+      DeviceChange last;
+    };
+    std::unordered_map<std::string, NetChange> net;
+    std::vector<const std::string*>            order;
+
+    for (auto it = first; it != changeLog.end(); ++it)
+    {
+      auto [entry, inserted] = net.try_emplace(it->path,
+                                               NetChange{it->kind, it->kind});
+      if (inserted)
+        order.push_back(&entry->first);
+      else
+        entry->second.last = it->kind;
+    }
+
+    for (const std::string* path : order)
+    {
+      const NetChange& change    = net.at(*path);
+      bool             existed   = change.first != DeviceChange::Added;
+      bool             existsNow = change.last != DeviceChange::Removed;
+
+      if (!existed && existsNow)
+        delta.added.push_back(*path);
+      else if (existed && existsNow)
+        delta.updated.push_back(*path);
+      else if (existed && !existsNow)
+        delta.removed.push_back(*path);
+    }
+    return delta;
+  }
+
+  uint64_t generation() const { return currentGeneration; }
+  size_t   approximateBytes() const { return memoryBytes; }
+  uint64_t evictions() const { return evictionCount; }
+
+  // Time the least recently seen device for which `pinned` returns false
+  // was last updated. Pass the predicate given to evict(), so the result is
+  // when evict() could next remove something by age.
+  template <typename Pinned>
+  bool oldestSeen(Clock::time_point& when, Pinned pinned) const
+  {
+    for (const auto& [seen, path] : byLastSeen)
+    {
+      if (pinned(records.at(path)))
+        continue;
+      when = seen;
+      return true;
+    }
+    return false;
+  }
+
+  const DeviceRecord* find(const std::string& path) const
+  {
+    auto it = records.find(path);
+    return it == records.end() ? nullptr : &it->second;
+  }
+
+  const std::map<std::string, DeviceRecord>& all() const { return records; }
+
+  const DeviceRecord* findByAddress(const std::string& address) const
+  {
+    auto it = byAddress.find(normalizeAddress(address));
+    return it == byAddress.end() ? nullptr : find(it->second);
+  }
+
+  // Devices with a known RSSI, strongest first
+  std::vector<const DeviceRecord*> strongest(size_t count) const
+  {
+    return collect(byRssi.rbegin(), byRssi.rend(), count);
+  }
+
+  // Devices updated or touched at or after `since`, most recent first
+  std::vector<const DeviceRecord*> seenSince(Clock::time_point since) const
+  {
+    auto last = byLastSeen.lower_bound({since, std::string()});
+    return collect(byLastSeen.rbegin(), std::make_reverse_iterator(last),
+                   records.size());
+  }
+
+  // Most recently updated devices first
+  std::vector<const DeviceRecord*> recentlySeen(size_t count) const
+  {
+    return collect(byLastSeen.rbegin(), byLastSeen.rend(), count);
+  }
+
+  std::vector<const DeviceRecord*>
+  findByNamePrefix(const std::string& prefix) const
+  {
+    std::vector<const DeviceRecord*> result;
+    for (auto it = byName.lower_bound({prefix, std::string()});
+         it != byName.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+         ++it)
+    {
+      result.push_back(&records.at(it->second));
+    }
+    return result;
+  }
+
+  // Exact patterns are a single hash lookup; partial patterns compare the
+  // masked bits of each distinct advertised UUID, which is far fewer than
+  // the number of devices.
+  std::vector<const DeviceRecord*>
+  findByService(const UuidPattern& pattern) const
+  {
+    std::set<std::string> paths;
+    if (pattern.exact())
+    {
+      auto it = byService.find(pattern.value);
+      if (it != byService.end())
+        paths = it->second;
+    }
+    else
+    {
+      for (const auto& [uuid, owners] : byService)
+      {
+        if (pattern.matches(uuid))
+          paths.insert(owners.begin(), owners.end());
+      }
+    }
+
+    std::vector<const DeviceRecord*> result;
+    result.reserve(paths.size());
+    for (const auto& path : paths)
+    {
+      result.push_back(&records.at(path));
+    }
+    return result;
+  }
+
+  bool   empty() const { return records.empty(); }
+  size_t size() const { return records.size(); }
+};
@@ -0,0 +1,363 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <sdbus-c++/sdbus-c++.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "CallControl.h"
+#include "Crc32.h"
+#include "Result.h"
+
+// Read-only memory mapping of a firmware image. Packets are copied straight
+// out of the page cache, so the image is never read into a buffer whole.
+class MappedImage
+{
+private:
+  void*  mapping = nullptr;
+  size_t length  = 0;
+
+public:
+  MappedImage() = default;
+  ~MappedImage()
+  {
+    if (mapping)
+      munmap(mapping, length);
+  }
+
+  MappedImage(const MappedImage&)            = delete;
+  MappedImage& operator=(const MappedImage&) = delete;
+
+  bool open(const std::string& path, std::string& error)
+  {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      error = "cannot open " + path + ": " + std::strerror(errno);
+      return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+      close(fd);
+      error = path + " is empty or unreadable";
+      return false;
+    }
+
+    size_t size = static_cast<size_t>(info.st_size);
+    void*  data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+      error = std::string("mmap failed: ") + std::strerror(errno);
+      return false;
+    }
+    // Read front to back, once
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    if (mapping)
+      munmap(mapping, length);
+    mapping = data;
+    length  = size;
+    return true;
+  }
+
+  const uint8_t* data() const { return static_cast<const uint8_t*>(mapping); }
+  size_t         size() const { return length; }
+};
+
+// How far a transfer got, saved next to the image so that a dropped link or
+// a restart resumes instead of starting over. The CRC covers the
+// acknowledged prefix and is checked against the image before resuming.
+struct TransferCheckpoint
+{
+  uint64_t imageSize = 0;
+  uint64_t offset    = 0; // bytes acknowledged by the device
+  uint32_t crc       = 0; // CRC-32 of the first `offset` bytes
+
+  static bool load(const std::string& path, TransferCheckpoint& checkpoint)
+  {
+    std::ifstream      file(path);
+    std::string        magic;
+    TransferCheckpoint loaded;
+    if (!(file >> magic >> loaded.imageSize >> loaded.offset >> std::hex >>
+          loaded.crc) ||
+        magic != "BLEDFU1" || loaded.offset > loaded.imageSize)
+      return false;
+    checkpoint = loaded;
+    return true;
+  }
+
+  // Written to a temporary file and renamed, so a crash mid-write leaves
+  // the previous checkpoint intact
+  bool save(const std::string& path) const
+  {
+    std::string temporary = path + ".tmp";
+    {
+      std::ofstream file(temporary, std::ios::trunc);
+      file << "BLEDFU1 " << imageSize << ' ' << offset << ' ' << std::hex
+           << crc << '\n';
+      if (!file.flush())
+        return false;
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+  }
+};
+
+struct TransferSettings
+{
+  size_t packetSize      = 20;    // ATT MTU - 3, including any offset prefix
+  size_t window          = 8;     // writes in flight at once
+  bool   framed          = true;  // prefix each packet with its offset
+  bool   withoutResponse = false; // "command" writes, acknowledged when queued
+  size_t checkpointEvery = 4096;  // bytes between checkpoint saves
+};
+
+struct TransferStats
+{
+  uint64_t                  startOffset = 0; // resumed from
+  uint64_t                  bytes       = 0; // acknowledged this session
+  uint64_t                  packets     = 0;
+  std::chrono::milliseconds elapsed{0};
+
+  double kilobytesPerSecond() const
+  {
+    return elapsed.count() > 0 ? static_cast<double>(bytes) /
+                                   static_cast<double>(elapsed.count())
+                               : 0.0;
+  }
+};
+
+// Streams an image to a GATT characteristic with a sliding window of
+// asynchronous WriteValue calls in flight. Writes complete out of order;
+// the acknowledged offset only advances over a contiguous prefix, and the
+// CRC is computed incrementally over that prefix as it grows.
+//
+// With `framed` set each packet starts with its offset as a little-endian
+// uint32, followed by up to packetSize - 4 bytes of the image, so the device
+// can place packets itself and a resumed transfer needs no handshake.
+class FirmwareTransfer
+{
+private:
+  const MappedImage& image;
+  std::string        checkpointPath;
+  TransferSettings   settings;
+  TransferCheckpoint progress;
+  Crc32              crc;
+  uint64_t           savedOffset = 0;
+
+  struct Window
+  {
+    std::mutex                 mutex;
+    std::condition_variable    wakeup;
+    size_t                     inFlight = 0;
+    std::map<uint64_t, size_t> completed; // offset -> length, out of order
+    std::optional<CallError>   failure;
+  };
+
+  size_t chunkSize() const
+  {
+    size_t header = settings.framed ? 4 : 0;
+    return settings.packetSize > header + 1 ? settings.packetSize - header
+                                            : 1;
+  }
+
+  std::vector<uint8_t> packet(uint64_t offset, size_t length) const
+  {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(length + 4);
+    if (settings.framed)
+    {
+      for (int shift = 0; shift < 32; shift += 8)
+        bytes.push_back(static_cast<uint8_t>(offset >> shift));
+    }
+    bytes.insert(bytes.end(), image.data() + offset,
+                 image.data() + offset + length);
+    return bytes;
+  }
+
+  void acknowledge(size_t length)
+  {
+    crc.update(image.data() + progress.offset, length);
+    progress.offset += length;
+    progress.crc     = crc.value();
+    if (progress.offset - savedOffset >= settings.checkpointEvery)
+      checkpoint();
+  }
+
+public:
+  FirmwareTransfer(const MappedImage& source,
+                   std::string        checkpointFile,
+                   TransferSettings   transferSettings)
+    : image(source),
+      checkpointPath(std::move(checkpointFile)),
+      settings(transferSettings)
+  {
+    progress.imageSize = image.size();
+    if (settings.window == 0)
+      settings.window = 1;
+  }
+
+  // Picks up from the saved checkpoint if it belongs to this image. Returns
+  // the offset the transfer will continue from.
+  uint64_t resume()
+  {
+    TransferCheckpoint saved;
+    if (!TransferCheckpoint::load(checkpointPath, saved) ||
+        saved.imageSize != image.size() ||
+        Crc32::of(image.data(), saved.offset) != saved.crc)
+      return progress.offset;
+
+    crc.reset();
+    crc.update(image.data(), saved.offset);
+    progress    = saved;
+    savedOffset = saved.offset;
+    return progress.offset;
+  }
+
+  void checkpoint()
+  {
+    if (progress.offset != savedOffset && progress.save(checkpointPath))
+      savedOffset = progress.offset;
+  }
+
+  // Called once the device has accepted the whole image
+  void finish() { std::remove(checkpointPath.c_str()); }
+
+  // The MTU can differ from one connection to the next
+  void setPacketSize(size_t bytes) { settings.packetSize = bytes; }
+
+  bool     complete() const { return progress.offset == image.size(); }
+  uint64_t offset() const { return progress.offset; }
+  uint32_t imageCrc() const { return progress.crc; }
+
+  // Sends the rest of the image through `characteristic` (a
+  // GattCharacteristic1 proxy). Returns once everything is acknowledged, or
+  // on the first failed write or cancellation with the acknowledged prefix
+  // checkpointed. Each write gets `callTimeout` (0 for the D-Bus default).
+  Result<void> send(sdbus::IProxy&            characteristic,
+                    const std::string&        interface,
+                    std::chrono::milliseconds callTimeout,
+                    const CancellationToken&  token,
+                    TransferStats&            stats)
+  {
+    using Clock = std::chrono::steady_clock;
+
+    auto started      = Clock::now();
+    stats.startOffset = progress.offset;
+    stats.bytes       = 0;
+    stats.packets     = 0;
+
+    std::map<std::string, sdbus::Variant> writeOptions;
+    writeOptions["type"] =
+      sdbus::Variant(settings.withoutResponse ? "command" : "request");
+
+    auto     window       = std::make_shared<Window>();
+    auto     registration = token.subscribe([window] {
+      std::lock_guard<std::mutex> lock(window->mutex);
+      window->wakeup.notify_all();
+    });
+    uint64_t next         = progress.offset;
+    size_t   chunk        = chunkSize();
+    std::map<uint64_t, sdbus::PendingAsyncCall> pending;
+    std::map<uint64_t, size_t> early; // completed beyond a gap
+
+    std::optional<CallError> failure;
+    while (!complete())
+    {
+      // Fill the window
+      while (next < image.size())
+      {
+        {
+          std::lock_guard<std::mutex> lock(window->mutex);
+          if (window->inFlight >= settings.window || window->failure)
+            break;
+          ++window->inFlight;
+        }
+
+        size_t length = static_cast<size_t>(
+          std::min<uint64_t>(chunk, image.size() - next));
+        auto call = characteristic.createMethodCall(
+          sdbus::InterfaceName(interface), sdbus::MethodName("WriteValue"));
+        call << packet(next, length) << writeOptions;
+
+        pending.emplace(
+          next,
+          characteristic.callMethodAsync(
+            call,
+            [window, offset = next, length](
+              sdbus::MethodReply, std::optional<sdbus::Error> error) {
+              std::lock_guard<std::mutex> lock(window->mutex);
+              --window->inFlight;
+              if (error && !window->failure)
+                window->failure =
+                  CallError{error->getName(), error->getMessage()};
+              else if (!error)
+                window->completed.emplace(offset, length);
+              window->wakeup.notify_all();
+            },
+            std::chrono::duration_cast<std::chrono::microseconds>(
+              callTimeout)));
+        next += length;
+        ++stats.packets;
+      }
+
+      // Collect acknowledgements, then advance over the contiguous prefix
+      std::map<uint64_t, size_t> completed;
+      {
+        std::unique_lock<std::mutex> lock(window->mutex);
+        window->wakeup.wait(lock, [&] {
+          return !window->completed.empty() || window->failure ||
+                 token.cancelled() ||
+                 (window->inFlight < settings.window && next < image.size());
+        });
+        completed.swap(window->completed);
+        failure = window->failure;
+      }
+      for (const auto& [offset, length] : completed)
+      {
+        pending.erase(offset);
+        early.emplace(offset, length);
+      }
+      for (auto it = early.begin();
+           it != early.end() && it->first == progress.offset;
+           it = early.erase(it))
+      {
+        acknowledge(it->second);
+        stats.bytes += it->second;
+      }
+
+      if (failure || token.cancelled())
+        break;
+    }
+
+    for (auto& [offset, call] : pending)
+      call.cancel();
+    checkpoint();
+    stats.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now() - started);
+
+    if (failure)
+      return *failure;
+    if (!complete())
+      return CallError{CALL_CANCELLED, "Transfer cancelled"};
+    return {};
+  }
+};
@@ -0,0 +1,360 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Set of provisioned device addresses checked on every scan update before
+// anything else is decoded. A Bloom filter rejects almost all unknown
+// addresses with a few bit probes; the rest fall through to a binary search
+// over the sorted address array.
+//
+// Two file formats are accepted. A text file holds one MAC address per line
+// ('#' starts a comment) and is parsed into memory. The binary format is
+// memory-mapped as is, so large fleets load instantly:
+//
+//   Header (little-endian, 32 bytes)
+//   uint64_t bloom[header.bloomWords]
+//   uint64_t addresses[header.count]   sorted ascending, 48-bit values
+class FleetAllowlist
+{
+private:
+  struct Header
+  {
+    char     magic[8];
+    uint64_t count;
+    uint64_t bloomWords;
+    uint32_t hashCount;
+    uint32_t reserved;
+  };
+
+  static constexpr char     MAGIC[8]      = {'B', 'L', 'E', 'A',
+                                             'L', 'W', '0', '1'};
+  static constexpr size_t   BITS_PER_ITEM = 10;
+  static constexpr uint32_t HASH_COUNT    = 7;
+
+  // Either points into `mapping` or into the owned vectors
+  const uint64_t* bloom      = nullptr;
+  size_t          bloomWords = 0;
+  const uint64_t* addresses  = nullptr;
+  size_t          count      = 0;
+  uint32_t        hashCount  = 0;
+
+  void*                 mapping     = nullptr;
+  size_t                mappingSize = 0;
+  std::vector<uint64_t> ownedBloom;
+  std::vector<uint64_t> ownedAddresses;
+
+  static uint64_t mix(uint64_t value)
+  {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+  }
+
+  // Double hashing: probe i is h1 + i * h2
+  bool bloomMayContain(uint64_t address) const
+  {
+    uint64_t hash  = mix(address);
+    uint64_t h1    = hash & 0xffffffffULL;
+    uint64_t h2    = (hash >> 32) | 1;
+    uint64_t nbits = bloomWords * 64;
+    for (uint32_t i = 0; i < hashCount; ++i)
+    {
+      uint64_t bit = (h1 + i * h2) % nbits;
+      if (!(bloom[bit / 64] & (1ULL << (bit % 64))))
+        return false;
+    }
+    return true;
+  }
+
+  void unmap()
+  {
+    if (mapping)
+      munmap(mapping, mappingSize);
+    mapping     = nullptr;
+    mappingSize = 0;
+  }
+
+  void adopt(std::vector<uint64_t> sorted)
+  {
+    unmap();
+    ownedAddresses = std::move(sorted);
+    ownedBloom.assign(
+      std::max<size_t>(1, (ownedAddresses.size() * BITS_PER_ITEM + 63) / 64),
+      0);
+
+    bloom      = ownedBloom.data();
+    bloomWords = ownedBloom.size();
+    addresses  = ownedAddresses.data();
+    count      = ownedAddresses.size();
+    hashCount  = HASH_COUNT;
+
+    uint64_t nbits = bloomWords * 64;
+    for (uint64_t address : ownedAddresses)
+    {
+      uint64_t hash = mix(address);
+      uint64_t h1   = hash & 0xffffffffULL;
+      uint64_t h2   = (hash >> 32) | 1;
+      for (uint32_t i = 0; i < hashCount; ++i)
+      {
+        uint64_t bit = (h1 + i * h2) % nbits;
+        ownedBloom[bit / 64] |= 1ULL << (bit % 64);
+      }
+    }
+  }
+
+  bool loadBinary(int fd, size_t size, std::string& error)
+  {
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+      error = std::string("mmap failed: ") + std::strerror(errno);
+      return false;
+    }
+
+    // Sizes are checked against the words actually present rather than
+    // summed, so hostile counts cannot wrap past the check
+    Header header;
+    std::memcpy(&header, data, sizeof(header));
+    size_t available = (size - sizeof(Header)) / sizeof(uint64_t);
+    if (header.bloomWords == 0 || header.hashCount == 0 ||
+        header.bloomWords > available ||
+        header.count > available - header.bloomWords)
+    {
+      munmap(data, size);
+      error = "truncated or corrupt allowlist";
+      return false;
+    }
+
+    // Lookups binary-search the address array
+    const auto* words = reinterpret_cast<const uint64_t*>(
+      static_cast<const char*>(data) + sizeof(Header));
+    if (!std::is_sorted(words + header.bloomWords,
+                        words + header.bloomWords + header.count))
+    {
+      munmap(data, size);
+      error = "allowlist addresses are not sorted";
+      return false;
+    }
+
+    clear();
+    mapping     = data;
+    mappingSize = size;
+
+    bloom      = words;
+    bloomWords = header.bloomWords;
+    addresses  = words + header.bloomWords;
+    count      = header.count;
+    hashCount  = header.hashCount;
+    return true;
+  }
+
+  bool loadText(const std::string& path, std::string& error)
+  {
+    std::ifstream file(path);
+    if (!file)
+    {
+      error = "cannot open " + path;
+      return false;
+    }
+
+    std::vector<uint64_t> parsed;
+    std::string           line;
+    size_t                lineNumber = 0;
+    while (std::getline(file, line))
+    {
+      ++lineNumber;
+      line = line.substr(0, line.find('#'));
+      line.erase(0, line.find_first_not_of(" \t\r"));
+      line.erase(line.find_last_not_of(" \t\r") + 1);
+      if (line.empty())
+        continue;
+
+      uint64_t address;
+      if (!parseAddress(line.c_str(), address))
+      {
+        error = path + ":" + std::to_string(lineNumber) +
+                ": invalid address '" + line + "'";
+        return false;
+      }
+      parsed.push_back(address);
+    }
+
+    std::sort(parsed.begin(), parsed.end());
+    parsed.erase(std::unique(parsed.begin(), parsed.end()), parsed.end());
+    adopt(std::move(parsed));
+    return true;
+  }
+
+public:
+  FleetAllowlist() = default;
+  ~FleetAllowlist() { unmap(); }
+
+  FleetAllowlist(const FleetAllowlist&)            = delete;
+  FleetAllowlist& operator=(const FleetAllowlist&) = delete;
+
+  // Parses "AA:BB:CC:DD:EE:FF" (':' or '_' separators) into a 48-bit value.
+  // Stops after the sixth octet, so it can be pointed at the tail of a BlueZ
+  // object path such as ".../dev_AA_BB_CC_DD_EE_FF".
+  static bool parseAddress(const char* text, uint64_t& address)
+  {
+    address = 0;
+    for (int octet = 0; octet < 6; ++octet)
+    {
+      if (octet > 0)
+      {
+        if (*text != ':' && *text != '_')
+          return false;
+        ++text;
+      }
+      for (int digit = 0; digit < 2; ++digit, ++text)
+      {
+        char     c = *text;
+        uint64_t nibble;
+        if (c >= '0' && c <= '9')
+          nibble = static_cast<uint64_t>(c - '0');
+        else if (c >= 'A' && c <= 'F')
+          nibble = static_cast<uint64_t>(c - 'A' + 10);
+        else if (c >= 'a' && c <= 'f')
+          nibble = static_cast<uint64_t>(c - 'a' + 10);
+        else
+          return false;
+        address = address << 4 | nibble;
+      }
+    }
+    return *text == '\0' || *text == '/';
+  }
+
+  static std::string formatAddress(uint64_t address)
+  {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string       text;
+    for (int shift = 40; shift >= 0; shift -= 8)
+    {
+      text += hex[(address >> (shift + 4)) & 0xf];
+      text += hex[(address >> shift) & 0xf];
+      if (shift > 0)
+        text += ':';
+    }
+    return text;
+  }
+
+  // Extracts the address from a BlueZ device object path
+  static bool parseDevicePath(const char* path, uint64_t& address)
+  {
+    const char* device = std::strstr(path, "/dev_");
+    return device && parseAddress(device + 5, address);
+  }
+
+  bool load(const std::string& path, std::string& error)
+  {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      error = "cannot open " + path + ": " + std::strerror(errno);
+      return false;
+    }
+
+    struct stat info;
+    char        magic[sizeof(MAGIC)] = {};
+    bool        isBinary             = false;
+    if (fstat(fd, &info) == 0 &&
+        static_cast<size_t>(info.st_size) >= sizeof(Header) &&
+        read(fd, magic, sizeof(magic)) == static_cast<ssize_t>(sizeof(magic)))
+    {
+      isBinary = std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+    }
+
+    bool loaded = isBinary ? loadBinary(fd, static_cast<size_t>(info.st_size),
+                                        error)
+                           : loadText(path, error);
+    close(fd);
+    return loaded;
+  }
+
+  // Writes the current set in the memory-mappable binary format. Written to
+  // a temporary file and renamed, since the set may be mapped from `path`
+  // itself and truncating it first would pull the pages out from under us.
+  bool save(const std::string& path, std::string& error) const
+  {
+    std::string temporary = path + ".tmp";
+    {
+      std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+      if (!file)
+      {
+        error = "cannot create " + temporary;
+        return false;
+      }
+
+      Header header{};
+      std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+      header.count      = count;
+      header.bloomWords = bloomWords;
+      header.hashCount  = hashCount;
+
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      file.write(reinterpret_cast<const char*>(bloom),
+                 static_cast<std::streamsize>(bloomWords * sizeof(uint64_t)));
+      file.write(reinterpret_cast<const char*>(addresses),
+                 static_cast<std::streamsize>(count * sizeof(uint64_t)));
+      if (!file.flush())
+      {
+        error = "write to " + temporary + " failed";
+        return false;
+      }
+    }
+
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+      error = "cannot replace " + path + ": " + std::strerror(errno);
+      return false;
+    }
+    return true;
+  }
+
+  void clear()
+  {
+    unmap();
+    ownedBloom.clear();
+    ownedAddresses.clear();
+    bloom      = nullptr;
+    bloomWords = 0;
+    addresses  = nullptr;
+    count      = 0;
+    hashCount  = 0;
+  }
+
+  bool   active() const { return bloom != nullptr; }
+  size_t size() const { return count; }
+  bool   isMapped() const { return mapping != nullptr; }
+
+  bool contains(uint64_t address) const
+  {
+    return bloomMayContain(address) &&
+           std::binary_search(addresses, addresses + count, address);
+  }
+
+  // True if the allowlist is inactive or admits the device at `path`
+  bool admitsDevicePath(const char* path) const
+  {
+    if (!active())
+      return true;
+
+    uint64_t address;
+    return parseDevicePath(path, address) && contains(address);
+  }
+};
@@ -0,0 +1,474 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CallControl.h"
+#include "DeviceHealth.h"
+#include "Result.h"
+#include "Uuid.h"
+
+struct ProvisionWrite
+{
+  std::string          uuid; // canonical lowercase form
+  std::vector<uint8_t> value;
+};
+
+// What to do to every device in a provisioning run. Loaded from a text file
+// with one directive per line ('#' starts a comment):
+//
+//   write <uuid> <hex>   value as bytes ("01 02 ff") or one run ("0102ff")
+//   verify on|off        read each value back after writing (default on)
+//   attempts <n>         tries per device when failures are transient
+//   backoff <ms>         delay before the first retry, doubled each time
+//                        (at most maxBackoff)
+struct ProvisionJob
+{
+  std::vector<ProvisionWrite> writes;
+  bool                        verify   = true;
+  unsigned                    attempts = 3;
+  std::chrono::milliseconds   backoff{1000};
+  std::chrono::milliseconds   maxBackoff{60000}; // give up rather than wait
+
+  static int hexNibble(char c)
+  {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  }
+
+  static bool parseHex(const std::string& text, std::vector<uint8_t>& out)
+  {
+    std::istringstream stream(text);
+    std::string        token;
+    while (stream >> token)
+    {
+      if (token.size() % 2 != 0)
+        return false;
+      for (size_t i = 0; i < token.size(); i += 2)
+      {
+        int high = hexNibble(token[i]);
+        int low  = hexNibble(token[i + 1]);
+        if (high < 0 || low < 0)
+          return false;
+        out.push_back(static_cast<uint8_t>(high << 4 | low));
+      }
+    }
+    return !out.empty();
+  }
+
+  // Whole argument as a non-negative decimal number
+  static bool parseCount(const std::string& text, unsigned long& value)
+  {
+    if (text.empty() || text[0] < '0' || text[0] > '9')
+      return false;
+    char* end;
+    errno = 0;
+    value = std::strtoul(text.c_str(), &end, 10);
+    return *end == '\0' && errno == 0;
+  }
+
+  static bool load(const std::string& path,
+                   ProvisionJob&      job,
+                   std::string&       error)
+  {
+    std::ifstream file(path);
+    if (!file)
+    {
+      error = "cannot open " + path;
+      return false;
+    }
+
+    ProvisionJob parsed;
+    std::string  line;
+    size_t       lineNumber = 0;
+    while (std::getline(file, line))
+    {
+      ++lineNumber;
+      line = line.substr(0, line.find('#'));
+
+      std::istringstream stream(line);
+      std::string        directive;
+      if (!(stream >> directive))
+        continue;
+
+      std::string argument;
+      stream >> argument;
+      std::string rest;
+      std::getline(stream, rest);
+
+      bool valid = !argument.empty();
+      if (valid && directive == "write")
+      {
+        ProvisionWrite write;
+        Uuid128        uuid;
+        valid = Uuid128::parse(argument, uuid) && parseHex(rest, write.value);
+        write.uuid = uuid.toString();
+        parsed.writes.push_back(std::move(write));
+      }
+      else if (valid && directive == "verify")
+      {
+        valid         = argument == "on" || argument == "off";
+        parsed.verify = argument == "on";
+      }
+      else if (valid && directive == "attempts")
+      {
+        unsigned long attempts = 0;
+        valid           = parseCount(argument, attempts) && attempts > 0 &&
+                          attempts <= UINT_MAX;
+        parsed.attempts = static_cast<unsigned>(attempts);
+      }
+      else if (valid && directive == "backoff")
+      {
+        // A first delay past maxBackoff would never be waited out
+        unsigned long backoff = 0;
+        valid = parseCount(argument, backoff) &&
+                backoff <= static_cast<unsigned long>(
+                             parsed.maxBackoff.count());
+        parsed.backoff =
+          std::chrono::milliseconds(static_cast<int64_t>(backoff));
+      }
+      else
+      {
+        valid = false;
+      }
+
+      if (!valid)
+      {
+        error = path + ":" + std::to_string(lineNumber) +
+                ": invalid directive '" + line + "'";
+        return false;
+      }
+    }
+
+    if (parsed.writes.empty())
+    {
+      error = path + ": no write directives";
+      return false;
+    }
+    job = std::move(parsed);
+    return true;
+  }
+
+  // One device address or object path per line; duplicates are dropped
+  static bool loadDevices(const std::string&        path,
+                          std::vector<std::string>& devices,
+                          std::string&              error)
+  {
+    std::ifstream file(path);
+    if (!file)
+    {
+      error = "cannot open " + path;
+      return false;
+    }
+
+    std::vector<std::string> parsed;
+    std::string              line;
+    while (std::getline(file, line))
+    {
+      std::istringstream stream(line.substr(0, line.find('#')));
+      std::string        device;
+      if (stream >> device &&
+          std::find(parsed.begin(), parsed.end(), device) == parsed.end())
+        parsed.push_back(device);
+    }
+    devices = std::move(parsed);
+    return true;
+  }
+};
+
+enum class ProvisionStage
+{
+  Connect,
+  Write,
+  Verify,
+  Disconnect,
+  Done,
+};
+
+inline const char* stageName(ProvisionStage stage)
+{
+  switch (stage)
+  {
+    case ProvisionStage::Connect:
+      return "connect";
+    case ProvisionStage::Write:
+      return "write";
+    case ProvisionStage::Verify:
+      return "verify";
+    case ProvisionStage::Disconnect:
+      return "disconnect";
+    case ProvisionStage::Done:
+      return "done";
+  }
+  return "unknown";
+}
+
+struct ProvisionResult
+{
+  std::string               device;
+  bool                      ok       = false;
+  unsigned                  attempts = 0;
+  ProvisionStage            stage    = ProvisionStage::Connect; // last reached
+  CallError                 error; // last failure, kept even after a retry
+  std::chrono::milliseconds elapsed{0};
+};
+
+// The device operations a provisioning run is built from, each already
+// bound to its deadline and cancellation token
+struct ProvisionSteps
+{
+  using Device = const std::string&;
+
+  std::function<Result<void>(Device)>                        connect;
+  std::function<Result<void>(Device, const ProvisionWrite&)> write;
+  std::function<Result<std::vector<uint8_t>>(Device, const std::string&)>
+                                      read;
+  std::function<Result<void>(Device)> disconnect;
+  // Earliest a retry could get through, e.g. while a circuit breaker is open
+  std::function<std::chrono::milliseconds(Device)> retryAfter;
+};
+
+// Runs a provisioning job over a list of devices on a pool of workers. Each
+// worker takes the next device and drives it through connect, write, verify
+// and disconnect, retrying the whole sequence on transient failures. Only
+// `connectSlots` devices are in the connect stage at a time, because the
+// controller creates connections one by one; the other workers meanwhile
+// carry on with the GATT traffic of devices that are already connected.
+class FleetProvisioner
+{
+private:
+  ProvisionJob      job;
+  ProvisionSteps    steps;
+  CancellationToken token;
+  size_t            workers;
+  size_t            connectSlots;
+
+  std::mutex              gateMutex;
+  std::condition_variable gateFree;
+  size_t                  connecting = 0;
+
+  bool enterConnect()
+  {
+    std::unique_lock<std::mutex> lock(gateMutex);
+    gateFree.wait(lock, [&] {
+      return connecting < connectSlots || token.cancelled();
+    });
+    if (token.cancelled())
+      return false;
+    ++connecting;
+    return true;
+  }
+
+  void leaveConnect()
+  {
+    std::lock_guard<std::mutex> lock(gateMutex);
+    --connecting;
+    gateFree.notify_one();
+  }
+
+  static std::string hex(const std::vector<uint8_t>& data)
+  {
+    static const char digits[] = "0123456789abcdef";
+    std::string       text;
+    for (uint8_t byte : data)
+    {
+      text += digits[byte >> 4];
+      text += digits[byte & 0xf];
+    }
+    return text;
+  }
+
+  Result<void> attempt(const std::string& device, ProvisionStage& stage)
+  {
+    stage = ProvisionStage::Connect;
+    if (!enterConnect())
+      return CallError{CALL_CANCELLED, "Call cancelled"};
+    auto connected = steps.connect(device);
+    leaveConnect();
+    if (!connected)
+      return connected.error();
+
+    // Leave the device disconnected whatever happens after this point
+    auto abandon = [&](const CallError& error) {
+      steps.disconnect(device);
+      return error;
+    };
+
+    stage = ProvisionStage::Write;
+    for (const ProvisionWrite& write : job.writes)
+    {
+      auto written = steps.write(device, write);
+      if (!written)
+        return abandon(written.error());
+    }
+
+    stage = ProvisionStage::Verify;
+    for (const ProvisionWrite& write : job.writes)
+    {
+      if (!job.verify)
+        break;
+
+      auto value = steps.read(device, write.uuid);
+      if (!value)
+        return abandon(value.error());
+      if (value.value() != write.value)
+        return abandon(CallError{ERROR_VERIFY_FAILED,
+                                 write.uuid + " reads back " +
+                                   hex(value.value()) + ", expected " +
+                                   hex(write.value)});
+    }
+
+    stage       = ProvisionStage::Disconnect;
+    auto closed = steps.disconnect(device);
+    if (!closed)
+      return closed.error();
+    stage = ProvisionStage::Done;
+    return {};
+  }
+
+  ProvisionResult provision(const std::string& device)
+  {
+    using Clock = std::chrono::steady_clock;
+
+    ProvisionResult result;
+    result.device = device;
+    auto started  = Clock::now();
+    for (unsigned tries = 1; tries <= job.attempts; ++tries)
+    {
+      result.attempts = tries;
+      auto outcome    = attempt(device, result.stage);
+      if (outcome)
+      {
+        result.ok = true;
+        break;
+      }
+      result.error = outcome.error();
+
+      // Past the disconnect stage the configuration is already in place
+      if (tries == job.attempts ||
+          result.stage == ProvisionStage::Disconnect ||
+          !DeviceHealth::transient(result.error))
+        break;
+
+      std::chrono::milliseconds delay =
+        job.backoff * (1 << std::min(tries - 1, 16u));
+      delay = std::max(delay, steps.retryAfter(device));
+      if (delay > job.maxBackoff || !sleepUnlessCancelled(token, delay))
+        break;
+    }
+    result.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now() - started);
+    return result;
+  }
+
+public:
+  FleetProvisioner(ProvisionJob      provisionJob,
+                   ProvisionSteps    provisionSteps,
+                   size_t            concurrency,
+                   CancellationToken cancel       = {},
+                   size_t            connectLimit = 1)
+    : job(std::move(provisionJob)),
+      steps(std::move(provisionSteps)),
+      token(std::move(cancel)),
+      workers(concurrency > 0 ? concurrency : 1),
+      connectSlots(connectLimit > 0 ? connectLimit : 1)
+  {
+  }
+
+  // Returns one result per device, in list order. `progress` is called as
+  // each device finishes, one call at a time.
+  std::vector<ProvisionResult>
+  run(const std::vector<std::string>&              devices,
+      std::function<void(const ProvisionResult&)> progress = {})
+  {
+    std::vector<ProvisionResult> results(devices.size());
+    std::atomic<size_t>          next{0};
+    std::mutex                   progressMutex;
+
+    auto registration = token.subscribe([this] {
+      std::lock_guard<std::mutex> lock(gateMutex);
+      gateFree.notify_all();
+    });
+
+    auto work = [&] {
+      for (size_t i = next++; i < devices.size(); i = next++)
+      {
+        if (token.cancelled())
+        {
+          results[i].device = devices[i];
+          results[i].error  = CallError{CALL_CANCELLED, "Call cancelled"};
+          continue;
+        }
+
+        results[i] = provision(devices[i]);
+        if (progress)
+        {
+          std::lock_guard<std::mutex> lock(progressMutex);
+          progress(results[i]);
+        }
+      }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < std::min(workers, devices.size()); ++i)
+      pool.emplace_back(work);
+    work();
+    for (std::thread& thread : pool)
+      thread.join();
+    return results;
+  }
+
+  // One CSV line per device
+  static bool writeReport(const std::string&                  path,
+                          const std::vector<ProvisionResult>& results,
+                          std::string&                        error)
+  {
+    std::ofstream file(path);
+    if (!file)
+    {
+      error = "cannot create " + path;
+      return false;
+    }
+
+    auto quoted = [](std::string text) {
+      for (size_t at = text.find('"'); at != std::string::npos;
+           at      = text.find('"', at + 2))
+        text.insert(at, 1, '"');
+      return '"' + text + '"';
+    };
+
+    file << "device,result,stage,attempts,elapsed_ms,error,message\n";
+    for (const ProvisionResult& result : results)
+    {
+      file << result.device << ',' << (result.ok ? "ok" : "failed") << ','
+           << stageName(result.stage) << ',' << result.attempts << ','
+           << result.elapsed.count() << ',' << result.error.name << ','
+           << quoted(result.error.message) << '\n';
+    }
+
+    if (!file.flush())
+    {
+      error = "cannot write " + path;
+      return false;
+    }
+    return true;
+  }
+};
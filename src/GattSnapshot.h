@@ -0,0 +1,175 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Result.h"
+
+// A characteristic or descriptor as captured by a snapshot. `value` is only
+// meaningful if the attribute was read and `error` is empty.
+struct SnapshotAttribute
+{
+  std::string              uuid;
+  std::string              path;
+  std::vector<std::string> flags;
+  bool                     read = false;
+  std::vector<uint8_t>     value;
+  std::optional<CallError> error;
+
+  // Any of BlueZ's read flags, whatever security they require
+  static bool readable(const std::vector<std::string>& flags)
+  {
+    for (const std::string& flag : flags)
+    {
+      if (flag == "read" || flag == "encrypt-read" ||
+          flag == "encrypt-authenticated-read" || flag == "secure-read")
+        return true;
+    }
+    return false;
+  }
+};
+
+struct SnapshotCharacteristic : SnapshotAttribute
+{
+  std::vector<SnapshotAttribute> descriptors;
+};
+
+struct SnapshotService
+{
+  std::string                         uuid;
+  std::string                         path;
+  std::vector<SnapshotCharacteristic> characteristics;
+};
+
+// Every readable value in a device's GATT database at one point in time
+struct GattSnapshot
+{
+  using Clock = std::chrono::system_clock;
+
+  std::string                  device;
+  std::string                  address;
+  Clock::time_point            taken;
+  std::chrono::milliseconds    elapsed{0};
+  std::vector<SnapshotService> services;
+
+  static void writeString(std::ostream& out, const std::string& text)
+  {
+    static const char hex[] = "0123456789abcdef";
+    out << '"';
+    for (char c : text)
+    {
+      auto byte = static_cast<unsigned char>(c);
+      if (c == '"' || c == '\\')
+        out << '\\' << c;
+      else if (byte < 0x20)
+        out << "\\u00" << hex[byte >> 4] << hex[byte & 0xf];
+      else
+        out << c;
+    }
+    out << '"';
+  }
+
+  static void writeAttribute(std::ostream&            out,
+                             const SnapshotAttribute& attribute,
+                             const std::string&       indent)
+  {
+    static const char hex[] = "0123456789abcdef";
+
+    out << indent << "\"uuid\": ";
+    writeString(out, attribute.uuid);
+    out << ",\n" << indent << "\"path\": ";
+    writeString(out, attribute.path);
+    out << ",\n" << indent << "\"flags\": [";
+    for (size_t i = 0; i < attribute.flags.size(); ++i)
+    {
+      out << (i ? ", " : "");
+      writeString(out, attribute.flags[i]);
+    }
+    out << "]";
+
+    if (attribute.error)
+    {
+      out << ",\n" << indent << "\"error\": {\"name\": ";
+      writeString(out, attribute.error->name);
+      out << ", \"message\": ";
+      writeString(out, attribute.error->message);
+      out << "}";
+    }
+    else if (attribute.read)
+    {
+      out << ",\n" << indent << "\"value\": \"";
+      for (uint8_t byte : attribute.value)
+        out << hex[byte >> 4] << hex[byte & 0xf];
+      out << "\"";
+    }
+  }
+
+  // Values are written as hex strings; attributes that failed to read carry
+  // the D-Bus error instead
+  bool writeJson(const std::string& path, std::string& error) const
+  {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+    {
+      error = "cannot create " + path;
+      return false;
+    }
+
+    std::time_t time = Clock::to_time_t(taken);
+    std::tm     utc{};
+    gmtime_r(&time, &utc);
+    char stamp[32];
+    std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &utc);
+
+    out << "{\n  \"device\": ";
+    writeString(out, device);
+    out << ",\n  \"address\": ";
+    writeString(out, address);
+    out << ",\n  \"taken\": \"" << stamp << "\",\n  \"elapsed_ms\": "
+        << elapsed.count() << ",\n  \"services\": [";
+
+    for (size_t s = 0; s < services.size(); ++s)
+    {
+      const SnapshotService& service = services[s];
+      out << (s ? "," : "") << "\n    {\n      \"uuid\": ";
+      writeString(out, service.uuid);
+      out << ",\n      \"path\": ";
+      writeString(out, service.path);
+      out << ",\n      \"characteristics\": [";
+
+      for (size_t c = 0; c < service.characteristics.size(); ++c)
+      {
+        const SnapshotCharacteristic& characteristic =
+          service.characteristics[c];
+        out << (c ? "," : "") << "\n        {\n";
+        writeAttribute(out, characteristic, "          ");
+        out << ",\n          \"descriptors\": [";
+        for (size_t d = 0; d < characteristic.descriptors.size(); ++d)
+        {
+          out << (d ? "," : "") << "\n            {\n";
+          writeAttribute(out, characteristic.descriptors[d],
+                         "              ");
+          out << "\n            }";
+        }
+        out << (characteristic.descriptors.empty() ? "" : "\n          ")
+            << "]\n        }";
+      }
+      out << (service.characteristics.empty() ? "" : "\n      ")
+          << "]\n    }";
+    }
+    out << (services.empty() ? "" : "\n  ") << "]\n}\n";
+
+    if (!out.flush())
+    {
+      error = "cannot write " + path;
+      return false;
+    }
+    return true;
+  }
+};
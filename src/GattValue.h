@@ -0,0 +1,51 @@
+#pragma once
+
+#include <sdbus-c++/sdbus-c++.h>
+#include <cstdint>
+#include <span>
+
+#include "CallControl.h"
+#include "Payload.h"
+#include "Result.h"
+
+// Single reads and writes of a characteristic value, the calls most
+// applications make most often. The names and options are built once, the
+// reply is awaited in the thread's ReplySlot and a read is copied straight
+// from the reply into the payload, so once warmed up neither allocates in
+// this code. `Proxy` is the characteristic's sdbus::IProxy, or anything
+// with the same createMethodCall() and callMethodAsync().
+
+inline const sdbus::InterfaceName& characteristicInterface()
+{
+  static const sdbus::InterfaceName name{"org.bluez.GattCharacteristic1"};
+  return name;
+}
+
+template <typename Proxy>
+Result<void> writeValue(Proxy&                   proxy,
+                        std::span<const uint8_t> data,
+                        const CallOptions&       options)
+{
+  static const sdbus::MethodName method{"WriteValue"};
+
+  auto call = proxy.createMethodCall(characteristicInterface(), method);
+  call << data << requestWriteOptions();
+  auto reply = awaitReply(proxy, call, options);
+  if (!reply)
+    return reply.error();
+  return {};
+}
+
+template <typename Proxy>
+Result<void> readValue(Proxy& proxy, Payload& value, const CallOptions& options)
+{
+  static const sdbus::MethodName method{"ReadValue"};
+
+  auto call = proxy.createMethodCall(characteristicInterface(), method);
+  call << defaultReadOptions();
+  auto reply = awaitReply(proxy, call, options);
+  if (!reply)
+    return reply.error();
+  value.assign(readBytes(reply.value()));
+  return {};
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <dirent.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Trades timer precision for fewer CPU wakeups on battery-powered gateways.
+// With a slack set, every background thread rounds its deadlines up to the
+// same slack grid, so timers that would fire a few milliseconds apart wake
+// the CPU once, and the kernel is allowed to defer them by up to the slack
+// to batch them with other activity. Zero slack is the normal, precise mode.
+class IdleMode
+{
+private:
+  std::atomic<int64_t> slackMs{0};
+
+public:
+  // Deadlines that may slip by more than this stop being timers at all
+  static constexpr std::chrono::milliseconds MAX_SLACK{1000};
+
+  // Negative slack is treated as zero and anything above MAX_SLACK clamped
+  void set(std::chrono::milliseconds slack)
+  {
+    slackMs = std::clamp(slack, std::chrono::milliseconds(0), MAX_SLACK)
+                .count();
+  }
+
+  bool                      enabled() const { return slackMs > 0; }
+  std::chrono::milliseconds slack() const
+  {
+    return std::chrono::milliseconds(slackMs.load());
+  }
+
+  // Next slack boundary at or after `deadline`. Boundaries are multiples of
+  // the slack since the clock's epoch, so they are shared by every thread.
+  template <typename TimePoint>
+  TimePoint coalesce(TimePoint deadline) const
+  {
+    auto grid = std::chrono::duration_cast<typename TimePoint::duration>(
+      slack());
+    if (grid.count() <= 0 || deadline == TimePoint::max())
+      return deadline;
+    auto since = deadline.time_since_epoch();
+    auto late  = since % grid;
+    return late.count() == 0 ? deadline : deadline + (grid - late);
+  }
+
+  // Applies the slack to the calling thread's timers. Called by each
+  // background thread as it goes back to sleep; `applied` is the thread's
+  // own record of what it last set, so the syscall only happens on change.
+  void applyToThread(int64_t& applied) const
+  {
+    int64_t wanted = slackMs;
+    if (wanted == applied)
+      return;
+    // 0 restores the thread's default slack
+    prctl(PR_SET_TIMERSLACK,
+          static_cast<unsigned long>(wanted) * 1000000UL, 0, 0, 0);
+    applied = wanted;
+  }
+};
+
+struct ThreadWakeups
+{
+  pid_t       tid = 0;
+  std::string name;
+  uint64_t    wakeups   = 0; // context switches during the sample
+  double      perSecond = 0;
+};
+
+// Counts how often each thread of the process was scheduled in over a
+// period, from the context switch counters in /proc/self/task. A thread
+// that blocks and is woken costs one voluntary switch; a preempted thread
+// one involuntary switch. Both are wakeups as far as power goes.
+class WakeupMeter
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+private:
+  struct Sample
+  {
+    std::string name;
+    uint64_t    switches = 0;
+  };
+
+  std::map<pid_t, Sample> before;
+  Clock::time_point       started;
+
+  static std::map<pid_t, Sample> sample()
+  {
+    std::map<pid_t, Sample> threads;
+    DIR*                    tasks = opendir("/proc/self/task");
+    if (!tasks)
+      return threads;
+
+    while (dirent* task = readdir(tasks))
+    {
+      pid_t tid = static_cast<pid_t>(std::strtol(task->d_name, nullptr, 10));
+      if (tid <= 0)
+        continue;
+
+      std::string   base = std::string("/proc/self/task/") + task->d_name;
+      std::ifstream status(base + "/status");
+      std::ifstream comm(base + "/comm");
+      Sample        thread;
+      std::getline(comm, thread.name);
+
+      std::string line;
+      while (std::getline(status, line))
+      {
+        std::istringstream fields(line);
+        std::string        key;
+        uint64_t           count = 0;
+        if (fields >> key >> count && (key == "voluntary_ctxt_switches:" ||
+                                       key == "nonvoluntary_ctxt_switches:"))
+          thread.switches += count;
+      }
+      threads[tid] = thread;
+    }
+    closedir(tasks);
+    return threads;
+  }
+
+public:
+  void start()
+  {
+    before  = sample();
+    started = Clock::now();
+  }
+
+  // Wakeups per thread since start(). The calling thread is left out, since
+  // measuring wakes it; threads that exited in between are not reported.
+  std::vector<ThreadWakeups> stop() const
+  {
+    auto   after   = sample();
+    double seconds = std::chrono::duration<double>(Clock::now() - started)
+                       .count();
+    pid_t  self    = static_cast<pid_t>(syscall(SYS_gettid));
+
+    std::vector<ThreadWakeups> threads;
+    for (const auto& [tid, now] : after)
+    {
+      if (tid == self)
+        continue;
+      auto          it = before.find(tid);
+      ThreadWakeups thread;
+      thread.tid     = tid;
+      thread.name    = now.name;
+      thread.wakeups = now.switches -
+                       (it != before.end() ? it->second.switches : 0);
+      thread.perSecond =
+        seconds > 0 ? static_cast<double>(thread.wakeups) / seconds : 0;
+      threads.push_back(thread);
+    }
+    return threads;
+  }
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+// One notification in a batch. `handle` identifies the characteristic
+// within its subscription; `payload` points into the batch and is only
+// valid during the consumer call.
+struct NotificationRecord
+{
+  std::chrono::steady_clock::time_point timestamp;
+  uint32_t                              handle = 0;
+  std::span<const uint8_t>              payload;
+};
+
+// Notifications accumulated between two deliveries. Payloads are copied
+// back to back into one arena, so once a batch's buffers have grown to the
+// steady-state size, filling it again allocates nothing.
+class NotificationBatch
+{
+private:
+  std::vector<NotificationRecord> records;
+  std::vector<size_t>             offsets; // into arena, until seal()
+  std::vector<uint8_t>            arena;
+
+public:
+  void add(std::chrono::steady_clock::time_point timestamp,
+           uint32_t                              handle,
+           std::span<const uint8_t>              payload)
+  {
+    records.push_back({timestamp, handle, {}});
+    offsets.push_back(arena.size());
+    arena.insert(arena.end(), payload.begin(), payload.end());
+  }
+
+  size_t size() const { return records.size(); }
+  size_t bytes() const { return arena.size(); }
+  bool   empty() const { return records.empty(); }
+
+  std::chrono::steady_clock::time_point first() const
+  {
+    return records.front().timestamp;
+  }
+
+  // Points the payloads into the arena, which no longer moves
+  std::span<const NotificationRecord> seal()
+  {
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+      size_t end = i + 1 < records.size() ? offsets[i + 1] : arena.size();
+      records[i].payload = {arena.data() + offsets[i], end - offsets[i]};
+    }
+    return records;
+  }
+
+  // Empties the batch, keeping its capacity
+  void clear()
+  {
+    records.clear();
+    offsets.clear();
+    arena.clear();
+  }
+};
+
+// Collects notifications into batches of at most `maxRecords`, each due for
+// delivery when full or `maxLatency` after its first record, whichever
+// comes first. The owner calls add() as values arrive, delivers what
+// take() returns when add() reports a full batch or deadline() passes, and
+// hands delivered batches back to the pool, usually from another thread.
+//
+// add() and take() belong to one thread; the pool is thread-safe.
+class NotificationBatcher
+{
+public:
+  using Clock    = std::chrono::steady_clock;
+  using Consumer = std::function<void(std::span<const NotificationRecord>)>;
+
+  // Delivered batches, kept for reuse
+  class Pool
+  {
+  private:
+    std::mutex                                      mutex;
+    std::vector<std::unique_ptr<NotificationBatch>> spares;
+
+  public:
+    std::unique_ptr<NotificationBatch> get()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (spares.empty())
+        return std::make_unique<NotificationBatch>();
+      auto batch = std::move(spares.back());
+      spares.pop_back();
+      return batch;
+    }
+
+    void recycle(std::unique_ptr<NotificationBatch> batch)
+    {
+      batch->clear();
+      std::lock_guard<std::mutex> lock(mutex);
+      spares.push_back(std::move(batch));
+    }
+  };
+
+private:
+  size_t                             maxRecords;
+  std::chrono::microseconds          maxLatency;
+  std::shared_ptr<Pool>              spares = std::make_shared<Pool>();
+  std::unique_ptr<NotificationBatch> filling;
+
+public:
+  NotificationBatcher(size_t maxBatch, std::chrono::microseconds latency)
+    : maxRecords(maxBatch > 0 ? maxBatch : 1), maxLatency(latency)
+  {
+  }
+
+  // Returns true if the batch is now full and should be taken
+  bool add(Clock::time_point        timestamp,
+           uint32_t                 handle,
+           std::span<const uint8_t> payload)
+  {
+    if (!filling)
+      filling = spares->get();
+    filling->add(timestamp, handle, payload);
+    return filling->size() >= maxRecords;
+  }
+
+  bool pending() const { return filling && !filling->empty(); }
+
+  // When the batch being filled is due; only meaningful if pending()
+  Clock::time_point deadline() const { return filling->first() + maxLatency; }
+
+  // The batch being filled, or null if it is empty. Give it back to pool()
+  // once it has been delivered.
+  std::unique_ptr<NotificationBatch> take()
+  {
+    if (!pending())
+      return nullptr;
+    return std::move(filling);
+  }
+
+  const std::shared_ptr<Pool>& pool() const { return spares; }
+};
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <sdbus-c++/sdbus-c++.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "AllocationTracker.h"
+#include "BusLoop.h"
+#include "CallbackExecutor.h"
+#include "NotificationBatcher.h"
+#include "Payload.h"
+
+// Formats `data` as hex followed by its printable characters, appending to
+// `out`, which allocates nothing once `out` has the capacity
+template <typename String>
+void appendHexData(String& out, std::span<const uint8_t> data)
+{
+  static const char DIGITS[] = "0123456789abcdef";
+  out.append("0x");
+  for (uint8_t byte : data)
+  {
+    out.push_back(DIGITS[byte >> 4]);
+    out.push_back(DIGITS[byte & 0x0f]);
+    out.push_back(' ');
+  }
+  out.append(" (");
+  for (uint8_t byte : data)
+  {
+    if (byte >= 32 && byte < 127)
+    {
+      out.push_back(static_cast<char>(byte));
+    }
+    else
+    {
+      out.push_back('.');
+    }
+  }
+  out.append(")");
+}
+
+// Where every value a device sends or a poll reads ends up. The value is
+// cached straight away; printing it or handing a batch to its consumer is
+// a user callback, which runs on the callback executor in the device's
+// strand so a slow consumer does not hold up D-Bus dispatch. The signal
+// handlers and the batch timers run on the event loop thread.
+//
+// Once a device's strand and the worker's line buffer have warmed up, none
+// of this allocates; checkAllocations() verifies that.
+class NotificationRouter
+{
+public:
+  // Caches the newest value of a device's characteristic
+  using Remember = std::function<void(const std::string&       devicePath,
+                                      const std::string&       uuid,
+                                      std::span<const uint8_t> value)>;
+
+  // Notifications from several characteristics of one device, delivered in
+  // batches. Apart from its setup, used on the event loop thread only.
+  struct BatchSubscription
+  {
+    std::string                                    devicePath;
+    std::vector<std::string>                       uuids; // handle -> UUID
+    std::vector<std::string>                       paths; // handle -> object
+    NotificationBatcher                            batcher;
+    std::shared_ptr<NotificationBatcher::Consumer> consumer;
+    std::vector<sdbus::Slot>                       watches;
+    std::optional<BusLoop::TimerId>                flushTimer;
+    std::vector<bool>                              seen; // for flushBatch()
+
+    BatchSubscription(size_t maxBatch, std::chrono::microseconds maxLatency)
+      : batcher(maxBatch, maxLatency)
+    {
+    }
+  };
+
+  // Heart Rate Measurement, the characteristic checkAllocations() uses
+  static constexpr const char* SELF_CHECK_UUID =
+    "00002a37-0000-1000-8000-00805f9b34fb";
+
+  // What the notification paths allocate, by handler and by callback
+  static inline AllocationTag notifyAllocations{"notify"};
+  static inline AllocationTag signalAllocations{"notify.signal",
+                                                &notifyAllocations};
+  static inline AllocationTag batchAllocations{"notify.batch",
+                                               &notifyAllocations};
+  static inline AllocationTag flushAllocations{"notify.flush",
+                                               &notifyAllocations};
+  static inline AllocationTag callbackAllocations{"callbacks"};
+  static inline AllocationTag valueCallbackAllocations{"callbacks.value",
+                                                       &callbackAllocations};
+  static inline AllocationTag batchCallbackAllocations{"callbacks.batch",
+                                                       &callbackAllocations};
+
+private:
+  CallbackExecutor& callbacks;
+  BusLoop&          loop;
+  Remember          remember;
+
+  // UUIDs that value callbacks carry, interned so a callback holds a
+  // pointer rather than a copy. Entries are never removed.
+  std::mutex            uuidNamesMutex;
+  std::set<std::string> uuidNames;
+
+  // Set while checkAllocations() pushes values through the callbacks
+  std::atomic<bool> muted{false};
+
+public:
+  NotificationRouter(CallbackExecutor& executor,
+                     BusLoop&          busLoop,
+                     Remember          rememberValue)
+    : callbacks(executor), loop(busLoop), remember(std::move(rememberValue))
+  {
+  }
+
+  NotificationRouter(const NotificationRouter&)            = delete;
+  NotificationRouter& operator=(const NotificationRouter&) = delete;
+
+  const std::string* internUuid(const std::string& uuid)
+  {
+    std::lock_guard<std::mutex> lock(uuidNamesMutex);
+    return &*uuidNames.insert(uuid).first;
+  }
+
+  // `uuid` comes from internUuid(), the value fits in the Payload and the
+  // task fits in the executor's inline storage
+  void deliverValue(const std::string&       devicePath,
+                    const std::string*       uuid,
+                    std::span<const uint8_t> value,
+                    const char*              source)
+  {
+    remember(devicePath, *uuid, value);
+    callbacks.submit(devicePath, [this, uuid, value = Payload(value), source] {
+      AllocationScope printing(valueCallbackAllocations);
+      // One write, so lines from parallel strands do not interleave. The
+      // line is built on the stack unless the value is longer than any
+      // attribute can be.
+      std::array<char, 4096>              buffer;
+      std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+      std::pmr::string                    line(&arena);
+      line.reserve(32 + std::strlen(source) + uuid->size() + 4 * value.size());
+      line.append("\n[").append(source).append(" ").append(*uuid);
+      line.append("] ");
+      appendHexData(line, value);
+      line.append("\n");
+      if (!muted)
+        std::cout << line << std::flush;
+    });
+  }
+
+  void onNotification(const std::string& devicePath,
+                      const std::string* uuid,
+                      sdbus::Message&    msg)
+  {
+    AllocationScope          allocations(signalAllocations);
+    std::span<const uint8_t> value;
+    if (readChangedValue(msg, value))
+      deliverValue(devicePath, uuid, value, "NOTIFY");
+  }
+
+  // Adds the notification to the subscription's batch, delivering it when
+  // it fills up or, through a loop timer, when its latency runs out
+  void onBatchNotification(BatchSubscription* subscription,
+                           uint32_t           handle,
+                           sdbus::Message&    msg)
+  {
+    AllocationScope          allocations(batchAllocations);
+    std::span<const uint8_t> value;
+    if (!readChangedValue(msg, value))
+      return;
+    if (subscription->batcher.add(NotificationBatcher::Clock::now(), handle,
+                                  value))
+    {
+      flushBatch(*subscription);
+    }
+    else if (!subscription->flushTimer)
+    {
+      subscription->flushTimer = loop.addTimer(
+        subscription->batcher.deadline(), [this, subscription] {
+          subscription->flushTimer.reset();
+          flushBatch(*subscription);
+        });
+    }
+  }
+
+  // Hands the pending batch to the consumer and caches the newest value of
+  // each characteristic in it, once per batch rather than per notification
+  void flushBatch(BatchSubscription& subscription)
+  {
+    AllocationScope allocations(flushAllocations);
+    if (subscription.flushTimer)
+    {
+      loop.cancelTimer(*subscription.flushTimer);
+      subscription.flushTimer.reset();
+    }
+    auto batch = subscription.batcher.take();
+    if (!batch)
+      return;
+
+    auto records = batch->seal();
+    subscription.seen.assign(subscription.uuids.size(), false);
+    for (auto it = records.rbegin(); it != records.rend(); ++it)
+    {
+      if (subscription.seen[it->handle])
+        continue;
+      subscription.seen[it->handle] = true;
+      remember(subscription.devicePath, subscription.uuids[it->handle],
+               it->payload);
+    }
+
+    // The batch goes back to the pool once consumed
+    callbacks.submit(subscription.devicePath,
+                     [consumer = subscription.consumer,
+                      pool     = subscription.batcher.pool(),
+                      batch    = std::move(batch),
+                      records]() mutable {
+                       AllocationScope consuming(batchCallbackAllocations);
+                       (*consumer)(records);
+                       pool->recycle(std::move(batch));
+                     });
+  }
+
+  // Delivers what is pending and releases the subscription's signal slots
+  // on the event loop thread, where its handlers run
+  void retireBatches(std::shared_ptr<BatchSubscription> subscription)
+  {
+    loop.post([this, subscription] { flushBatch(*subscription); });
+  }
+
+  // Pushes `rounds` values through each handler, as their signal matches
+  // do, and through the callbacks they hand off to, and checks that once
+  // warmed up neither side allocates. The PropertiesChanged signal is built
+  // on `connection` for a Heart Rate Measurement characteristic of a device
+  // that does not exist. Runs on the event loop thread; the callbacks are
+  // counted by their tags, so other traffic meanwhile can fail the check.
+  // Value callbacks print nothing until the check is done.
+  bool checkAllocations(sdbus::IConnection& connection,
+                        std::ostream&       out,
+                        size_t              rounds = 1024)
+  {
+    const std::string  devicePath = "/org/bluez/selfcheck";
+    const std::string  charPath   = devicePath + "/service0001/char0002";
+    const std::string* uuid       = internUuid(SELF_CHECK_UUID);
+
+    std::vector<uint8_t> value(20);
+    for (size_t i = 0; i < value.size(); ++i)
+      value[i] = static_cast<uint8_t>(i);
+    auto signal = connection.createSignal(
+      sdbus::ObjectPath{charPath},
+      sdbus::InterfaceName{"org.freedesktop.DBus.Properties"},
+      sdbus::SignalName{"PropertiesChanged"});
+    std::map<std::string, sdbus::Variant> changed;
+    changed["Value"] = sdbus::Variant(value);
+    signal << std::string("org.bluez.GattCharacteristic1") << changed
+           << std::vector<std::string>{};
+    signal.seal();
+
+    auto subscription = std::make_shared<BatchSubscription>(
+      16, std::chrono::milliseconds(50));
+    subscription->devicePath = devicePath;
+    subscription->uuids      = {*uuid};
+    subscription->paths      = {charPath};
+    subscription->consumer   = std::make_shared<NotificationBatcher::Consumer>(
+      [](std::span<const NotificationRecord>) {});
+
+    // Waits until the callbacks submitted so far have run; everything here
+    // shares the device's strand
+    auto drain = [&] {
+      std::promise<void> ran;
+      auto               done = ran.get_future();
+      callbacks.submit(devicePath, [&ran] { ran.set_value(); });
+      done.wait();
+    };
+
+    bool passed = true;
+    auto check  = [&](const char* name, AllocationTag& callbackTag,
+                     auto&& step) {
+      // Warm up with the strand held, so its queue and the batch pool grow
+      // to what a whole burst can need before anything is counted
+      std::promise<void> release;
+      auto               gate = release.get_future().share();
+      callbacks.submit(devicePath, [gate] { gate.wait(); });
+      for (size_t i = 0; i < rounds; ++i)
+        step();
+      release.set_value();
+      drain();
+
+      AllocationCounts  before = callbackTag.counts();
+      AllocationCounter counter;
+      for (size_t i = 0; i < rounds; ++i)
+        step();
+      AllocationCounts handled = counter.allocated();
+      drain();
+      AllocationCounts after  = callbackTag.counts();
+      uint64_t         handed = after.allocations - before.allocations;
+      bool             clean  = handled.allocations == 0 && handed == 0;
+      out << std::left << std::setw(24) << name << std::right << std::setw(8)
+          << handled.allocations << " in handlers, " << std::setw(8) << handed
+          << " in callbacks  " << (clean ? "PASS" : "FAIL") << std::endl;
+      passed = passed && clean;
+    };
+
+    muted = true;
+    out << rounds << " values each" << std::endl;
+    check("Notification", valueCallbackAllocations, [&] {
+      signal.rewind(true);
+      onNotification(devicePath, uuid, signal);
+    });
+    check("Batched notification", batchCallbackAllocations, [&] {
+      signal.rewind(true);
+      onBatchNotification(subscription.get(), 0, signal);
+    });
+
+    // Cancels the flush timer, which refers to the subscription
+    flushBatch(*subscription);
+    drain();
+    muted = false;
+    return passed;
+  }
+};
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <sdbus-c++/sdbus-c++.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Fixed-size blocks for values too long to keep inline. Freed blocks are
+// kept for reuse, so a steady stream of long values stops allocating once
+// the pool has warmed up.
+class PayloadBlocks
+{
+public:
+  static constexpr size_t BLOCK_SIZE = 512; // longest ATT attribute value
+  static constexpr size_t MAX_SPARE  = 256;
+
+private:
+  std::mutex            mutex;
+  std::vector<uint8_t*> spare;
+
+  PayloadBlocks() { spare.reserve(MAX_SPARE); }
+
+public:
+  ~PayloadBlocks()
+  {
+    for (uint8_t* block : spare)
+      delete[] block;
+  }
+
+  PayloadBlocks(const PayloadBlocks&)            = delete;
+  PayloadBlocks& operator=(const PayloadBlocks&) = delete;
+
+  static PayloadBlocks& shared()
+  {
+    static PayloadBlocks blocks;
+    return blocks;
+  }
+
+  uint8_t* get()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!spare.empty())
+      {
+        uint8_t* block = spare.back();
+        spare.pop_back();
+        return block;
+      }
+    }
+    return new uint8_t[BLOCK_SIZE];
+  }
+
+  void put(uint8_t* block)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (spare.size() < MAX_SPARE)
+      {
+        spare.push_back(block);
+        return;
+      }
+    }
+    delete[] block;
+  }
+};
+
+// A characteristic value. Values up to INLINE_CAPACITY bytes, which covers
+// a notification at the default ATT MTU, live inside the object; longer
+// ones up to the ATT maximum take a pooled block. Only values longer than
+// any attribute can hold go to the heap.
+class Payload
+{
+public:
+  static constexpr size_t INLINE_CAPACITY = 32;
+
+private:
+  uint8_t* external = nullptr; // block or heap buffer, if not inline
+  size_t   length   = 0;
+  size_t   capacity = INLINE_CAPACITY;
+  uint8_t  local[INLINE_CAPACITY];
+
+  void release()
+  {
+    if (!external)
+      return;
+    if (capacity == PayloadBlocks::BLOCK_SIZE)
+      PayloadBlocks::shared().put(external);
+    else
+      delete[] external;
+    external = nullptr;
+    capacity = INLINE_CAPACITY;
+  }
+
+  void moveFrom(Payload& other) noexcept
+  {
+    length   = other.length;
+    capacity = other.capacity;
+    if (other.external)
+      external = std::exchange(other.external, nullptr);
+    else
+      std::memcpy(local, other.local, other.length);
+    other.length   = 0;
+    other.capacity = INLINE_CAPACITY;
+  }
+
+public:
+  Payload() = default;
+  explicit Payload(std::span<const uint8_t> bytes) { assign(bytes); }
+  Payload(const Payload& other) { assign(other.view()); }
+  Payload(Payload&& other) noexcept { moveFrom(other); }
+  ~Payload() { release(); }
+
+  Payload& operator=(const Payload& other)
+  {
+    if (this != &other)
+      assign(other.view());
+    return *this;
+  }
+  Payload& operator=(Payload&& other) noexcept
+  {
+    if (this != &other)
+    {
+      release();
+      moveFrom(other);
+    }
+    return *this;
+  }
+
+  // Reuses the current storage when the new value fits in it
+  void assign(std::span<const uint8_t> bytes)
+  {
+    if (bytes.size() > capacity)
+    {
+      release();
+      if (bytes.size() <= PayloadBlocks::BLOCK_SIZE)
+      {
+        external = PayloadBlocks::shared().get();
+        capacity = PayloadBlocks::BLOCK_SIZE;
+      }
+      else
+      {
+        external = new uint8_t[bytes.size()];
+        capacity = bytes.size();
+      }
+    }
+    if (!bytes.empty())
+      std::memmove(data(), bytes.data(), bytes.size());
+    length = bytes.size();
+  }
+
+  uint8_t*       data() { return external ? external : local; }
+  const uint8_t* data() const { return external ? external : local; }
+  size_t         size() const { return length; }
+  bool           empty() const { return length == 0; }
+  const uint8_t* begin() const { return data(); }
+  const uint8_t* end() const { return data() + length; }
+
+  std::span<const uint8_t> view() const { return {data(), length}; }
+  operator std::span<const uint8_t>() const { return view(); }
+
+  std::vector<uint8_t> toVector() const { return {begin(), end()}; }
+
+  bool operator==(const Payload& other) const
+  {
+    return std::equal(begin(), end(), other.begin(), other.end());
+  }
+};
+
+// A byte array argument read from `message` as a view into the message,
+// so nothing is copied
+inline std::span<const uint8_t> readBytes(sdbus::Message& message)
+{
+  std::span<uint8_t> bytes;
+  message >> bytes;
+  return bytes;
+}
+
+// The Value property of a GattCharacteristic1 PropertiesChanged signal, as
+// a view into the message. Unlike reading the signal into a map of
+// Variants, this allocates nothing when Value is the only property, as it
+// is in a notification. Returns false if the signal carries no value.
+inline bool readChangedValue(sdbus::Message&           message,
+                             std::span<const uint8_t>& value)
+{
+  char* interface = nullptr;
+  char* name      = nullptr;
+  bool  found     = false;
+  message >> interface;
+  if (!message.enterContainer("{sv}"))
+    return false;
+  while (message.enterDictEntry("sv"))
+  {
+    message >> name;
+    if (!found && std::strcmp(name, "Value") == 0)
+    {
+      message.enterVariant("ay");
+      value = readBytes(message);
+      message.exitVariant();
+      found = true;
+    }
+    else
+    {
+      sdbus::Variant other;
+      message >> other;
+    }
+    message.exitDictEntry();
+  }
+  message.clearFlags();
+  message.exitContainer();
+  return found;
+}
+
+// Options for a plain ReadValue, shared rather than built per read
+inline const std::map<std::string, sdbus::Variant>& defaultReadOptions()
+{
+  static const std::map<std::string, sdbus::Variant> options;
+  return options;
+}
+
+// WriteValue options for a write with response. Built once per thread
+// rather than per write; a Variant is not safe to serialize from two
+// threads at once.
+inline const std::map<std::string, sdbus::Variant>& requestWriteOptions()
+{
+  static thread_local const std::map<std::string, sdbus::Variant> options = {
+    {"type", sdbus::Variant("request")}};
+  return options;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "TimingWheel.h"
+
+// A characteristic read at a fixed rate, for devices that cannot notify
+struct PollEntry
+{
+  std::string               device; // object path
+  std::string               uuid;   // canonical lowercase form
+  std::chrono::milliseconds interval{0};
+  uint64_t                  polls    = 0; // reads started
+  uint64_t                  skipped  = 0; // not connected, or still reading
+  uint64_t                  failures = 0;
+  bool                      inFlight = false;
+};
+
+// Decides when each poll is due, on a timing wheel with TICK resolution so
+// thousands of entries cost nothing while they wait. Entries with the same
+// interval are spread over it rather than started together: the n-th one
+// starts at fraction n * phi (mod 1) of the interval, which keeps any
+// number of them close to evenly spaced.
+//
+// Like RadioScheduler it only holds state; the caller performs the polls
+// that due() returns.
+class PollScheduler
+{
+public:
+  using Clock = std::chrono::steady_clock;
+  using Id    = uint64_t;
+
+  static constexpr std::chrono::milliseconds TICK{10};
+
+private:
+  using Wheel = TimingWheel<Id>;
+
+  Clock::time_point           epoch;
+  Wheel                       wheel;
+  std::map<Id, PollEntry>     entries;
+  std::map<Id, Wheel::Handle> timers;
+  std::map<int64_t, uint64_t> placed; // interval in ticks -> entries
+  Id                          nextId = 1;
+
+  uint64_t tickAt(Clock::time_point time) const
+  {
+    return time <= epoch ? 0
+                         : static_cast<uint64_t>((time - epoch) / TICK);
+  }
+
+  static uint64_t period(const PollEntry& entry)
+  {
+    return static_cast<uint64_t>(std::max<int64_t>(entry.interval / TICK, 1));
+  }
+
+public:
+  explicit PollScheduler(Clock::time_point start = Clock::now())
+    : epoch(start)
+  {
+  }
+
+  Id add(const std::string&        device,
+         const std::string&        uuid,
+         std::chrono::milliseconds interval,
+         Clock::time_point         now)
+  {
+    PollEntry entry;
+    entry.device   = device;
+    entry.uuid     = uuid;
+    entry.interval = std::max<std::chrono::milliseconds>(interval, TICK);
+
+    const double PHI   = 0.6180339887498949;
+    uint64_t     ticks = period(entry);
+    uint64_t     n     = placed[static_cast<int64_t>(ticks)]++;
+    double       phase = std::fmod(static_cast<double>(n) * PHI, 1.0);
+    uint64_t     first = tickAt(now) + 1 +
+                     static_cast<uint64_t>(phase * static_cast<double>(ticks));
+
+    Id id = nextId++;
+    entries.emplace(id, std::move(entry));
+    timers[id] = wheel.schedule(first, id);
+    return id;
+  }
+
+  bool remove(Id id)
+  {
+    auto it = entries.find(id);
+    if (it == entries.end())
+      return false;
+    --placed[static_cast<int64_t>(period(it->second))];
+    wheel.cancel(timers[id]);
+    timers.erase(id);
+    entries.erase(it);
+    return true;
+  }
+
+  PollEntry* find(Id id)
+  {
+    auto it = entries.find(id);
+    return it != entries.end() ? &it->second : nullptr;
+  }
+
+  const std::map<Id, PollEntry>& all() const { return entries; }
+
+  // Appends the polls due by `now` to `out` and schedules each one interval
+  // after the tick it was due at, so phases never drift. Polls missed while
+  // the caller was busy are dropped rather than fired in a burst.
+  void due(Clock::time_point now, std::vector<Id>& out)
+  {
+    uint64_t to = tickAt(now);
+    wheel.advance(to, [&](Id id, uint64_t dueTick) {
+      auto it = entries.find(id);
+      if (it == entries.end())
+        return;
+      out.push_back(id);
+
+      uint64_t ticks = period(it->second);
+      uint64_t next  = dueTick + ticks;
+      if (next <= to)
+        next += ((to - next) / ticks + 1) * ticks;
+      timers[id] = wheel.schedule(next, id);
+    });
+  }
+
+  bool nextDue(Clock::time_point& at) const
+  {
+    uint64_t tick;
+    if (!wheel.nextDue(tick))
+      return false;
+    at = epoch + TICK * static_cast<int64_t>(tick);
+    return true;
+  }
+};
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Alternates continuous discovery between scanning and idle phases. A zero
+// idle window scans without interruption.
+struct DutyCycle
+{
+  std::chrono::milliseconds scanWindow{0};
+  std::chrono::milliseconds idleWindow{0};
+
+  bool active() const
+  {
+    return scanWindow.count() > 0 && idleWindow.count() > 0;
+  }
+};
+
+struct ConnectLatency
+{
+  uint64_t                  attempts = 0;
+  uint64_t                  failures = 0;
+  std::chrono::microseconds total{0};
+  std::chrono::microseconds fastest = std::chrono::microseconds::max();
+  std::chrono::microseconds slowest{0};
+
+  void record(std::chrono::microseconds latency, bool succeeded)
+  {
+    ++attempts;
+    if (!succeeded)
+    {
+      ++failures;
+      return;
+    }
+    total += latency;
+    fastest = std::min(fastest, latency);
+    slowest = std::max(slowest, latency);
+  }
+
+  uint64_t successes() const { return attempts - failures; }
+};
+
+// Radio state a connect was made under, for latency comparison
+enum class ConnectMode
+{
+  Idle,     // no discovery running
+  Paused,   // discovery paused for the connect
+  Scanning, // discovery left running alongside the connect
+};
+
+// Decides whether the adapter should be discovering. Controllers share one
+// radio between scanning and connection establishment, so discovery is held
+// off while any connect is in flight and resumed once the last one finishes.
+// Connect latency is tracked per ConnectMode so the effect of the pause can
+// be measured.
+//
+// The scheduler only holds state; the caller applies `wantsDiscovery()` to
+// the adapter when `needsRequest()` says so, and reports the reply through
+// `finishRequest()`. `isDiscovering()` is the last state the adapter
+// confirmed, so a failed request is retried rather than assumed.
+class RadioScheduler
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Wait after a failed StartDiscovery/StopDiscovery before trying again
+  static constexpr std::chrono::seconds RETRY_DELAY{2};
+
+private:
+  unsigned          scanUsers    = 0;
+  bool              continuous   = false;
+  unsigned          connecting   = 0;
+  bool              connectPause = true;
+  bool              discovering  = false;
+  bool              requesting   = false; // a request awaits its reply
+  Clock::time_point retryAt;              // after a failed request
+  DutyCycle         cycle;
+  Clock::time_point cycleStart;
+  uint64_t          pauseCount = 0;
+  ConnectLatency    latencies[3];
+
+  // Position within the current scan + idle period
+  Clock::duration phase(Clock::time_point now) const
+  {
+    return (now - cycleStart) % (cycle.scanWindow + cycle.idleWindow);
+  }
+
+  bool inScanPhase(Clock::time_point now) const
+  {
+    return !cycle.active() || phase(now) < cycle.scanWindow;
+  }
+
+public:
+  // One-shot scans hold discovery on for as long as they run, regardless of
+  // the duty cycle
+  void acquireScan() { ++scanUsers; }
+  void releaseScan()
+  {
+    if (scanUsers > 0)
+      --scanUsers;
+  }
+
+  void setContinuous(bool enabled, Clock::time_point now)
+  {
+    continuous = enabled;
+    cycleStart = now;
+  }
+
+  void setDutyCycle(const DutyCycle& policy, Clock::time_point now)
+  {
+    cycle      = policy;
+    cycleStart = now;
+  }
+  const DutyCycle& dutyCycle() const { return cycle; }
+
+  void setPauseOnConnect(bool enabled) { connectPause = enabled; }
+  bool pauseOnConnect() const { return connectPause; }
+
+  bool wantsDiscovery(Clock::time_point now) const
+  {
+    if (connectPause && connecting > 0)
+      return false;
+    return scanUsers > 0 || (continuous && inScanPhase(now));
+  }
+
+  bool isDiscovering() const { return discovering; }
+
+  // True when the adapter should be told to start or stop discovering:
+  // its confirmed state is not the wanted one, no request is in flight and
+  // a failed request has waited out RETRY_DELAY
+  bool needsRequest(Clock::time_point now) const
+  {
+    return !requesting && now >= retryAt &&
+           wantsDiscovery(now) != discovering;
+  }
+
+  void beginRequest() { requesting = true; }
+
+  // A failed request leaves the confirmed state as it was
+  void finishRequest(bool active, bool succeeded, Clock::time_point now)
+  {
+    requesting = false;
+    if (succeeded)
+    {
+      discovering = active;
+      retryAt     = Clock::time_point();
+    }
+    else
+    {
+      retryAt = now + RETRY_DELAY;
+    }
+  }
+
+  // When a request that failed may be retried, if one is waiting to be
+  bool nextRetry(Clock::time_point now, Clock::time_point& when) const
+  {
+    if (requesting || retryAt <= now || wantsDiscovery(now) == discovering)
+      return false;
+    when = retryAt;
+    return true;
+  }
+
+  ConnectMode beginConnect()
+  {
+    ++connecting;
+    if (!discovering)
+      return ConnectMode::Idle;
+    if (!connectPause)
+      return ConnectMode::Scanning;
+    ++pauseCount;
+    return ConnectMode::Paused;
+  }
+
+  void endConnect(ConnectMode mode, Clock::duration latency, bool succeeded)
+  {
+    if (connecting > 0)
+      --connecting;
+    latencies[static_cast<size_t>(mode)].record(
+      std::chrono::duration_cast<std::chrono::microseconds>(latency),
+      succeeded);
+  }
+
+  // Next scan/idle boundary of the duty cycle, if one applies
+  bool nextTransition(Clock::time_point now, Clock::time_point& when) const
+  {
+    if (!continuous || scanUsers > 0 || !cycle.active())
+      return false;
+
+    Clock::duration into = phase(now);
+    when = into < cycle.scanWindow
+             ? now + (cycle.scanWindow - into)
+             : now + (cycle.scanWindow + cycle.idleWindow - into);
+    return true;
+  }
+
+  uint64_t              pauses() const { return pauseCount; }
+  const ConnectLatency& latency(ConnectMode mode) const
+  {
+    return latencies[static_cast<size_t>(mode)];
+  }
+};
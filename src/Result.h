@@ -0,0 +1,62 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+
+// Errors raised by the manager itself rather than by BlueZ
+inline const char* const ERROR_NOT_CONNECTED = "blemanager.Error.NotConnected";
+inline const char* const ERROR_NO_CHARACTERISTIC =
+  "blemanager.Error.CharacteristicNotFound";
+inline const char* const ERROR_CIRCUIT_OPEN = "blemanager.Error.CircuitOpen";
+inline const char* const ERROR_CONNECT_FAILED =
+  "blemanager.Error.ConnectFailed";
+inline const char* const ERROR_BAD_REPLY = "blemanager.Error.BadReply";
+inline const char* const ERROR_VERIFY_FAILED = "blemanager.Error.VerifyFailed";
+
+// A failed operation. `name` is the D-Bus error name as BlueZ reported it
+// (e.g. "org.bluez.Error.NotConnected"), or one of the names above.
+struct CallError
+{
+  std::string name;
+  std::string message;
+};
+
+// Value or CallError, returned by every BlueZ operation so that failures,
+// which are routine with out-of-range peripherals, never throw
+template <typename T>
+class Result
+{
+private:
+  std::variant<T, CallError> state;
+
+public:
+  Result(T value) : state(std::in_place_index<0>, std::move(value)) {}
+  Result(CallError error) : state(std::in_place_index<1>, std::move(error))
+  {
+  }
+
+  bool     ok() const { return state.index() == 0; }
+  explicit operator bool() const { return ok(); }
+
+  T&               value() { return std::get<0>(state); }
+  const T&         value() const { return std::get<0>(state); }
+  const CallError& error() const { return std::get<1>(state); }
+};
+
+template <>
+class Result<void>
+{
+private:
+  std::optional<CallError> failure;
+
+public:
+  Result() = default;
+  Result(CallError error) : failure(std::move(error)) {}
+
+  bool     ok() const { return !failure; }
+  explicit operator bool() const { return ok(); }
+
+  const CallError& error() const { return *failure; }
+};
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Hierarchical timing wheel over integer ticks. Level 0 has one slot per
+// tick of the current 64-tick rotation; each level above covers 64 times
+// the span of the one below, and its slots are cascaded down as the wheel
+// reaches them. Scheduling and cancelling are O(1), and advancing jumps
+// straight to the next occupied slot, so the cost depends on the timers
+// that fire rather than on how many are pending or how far time moves.
+//
+// Timers due further out than span() ticks fire at the end of the span.
+template <typename T>
+class TimingWheel
+{
+public:
+  using Handle = uint32_t;
+
+  static constexpr Handle   NONE   = UINT32_MAX;
+  static constexpr unsigned BITS   = 6;
+  static constexpr unsigned SLOTS  = 1u << BITS;
+  static constexpr unsigned LEVELS = 4;
+
+  static constexpr uint64_t span() { return uint64_t(1) << (BITS * LEVELS); }
+
+private:
+  struct Node
+  {
+    T        value{};
+    uint64_t due  = 0;
+    Handle   prev = NONE;
+    Handle   next = NONE;
+    unsigned slot = 0; // level * SLOTS + index
+    bool     live = false;
+  };
+
+  std::vector<Node>                   nodes;
+  std::vector<Handle>                 freeNodes;
+  std::array<Handle, LEVELS * SLOTS>  heads;
+  std::array<uint64_t, LEVELS>        occupied{}; // one bit per slot
+  uint64_t                            current = 0;
+  size_t                              count   = 0;
+  std::vector<std::pair<T, uint64_t>> firing; // expiring at the current tick
+
+  static unsigned indexAt(uint64_t tick, unsigned level)
+  {
+    return static_cast<unsigned>(tick >> (BITS * level)) & (SLOTS - 1);
+  }
+
+  // Files a node under the lowest level whose rotation contains its due
+  // tick. Nodes due at the current tick land in the level 0 slot that
+  // advance() is about to expire.
+  void link(Handle handle)
+  {
+    Node&    node = nodes[handle];
+    uint64_t due  = std::min(node.due, current + span() - 1);
+
+    unsigned level = 0;
+    while (level + 1 < LEVELS &&
+           (due >> (BITS * (level + 1))) != (current >> (BITS * (level + 1))))
+      ++level;
+
+    unsigned index = indexAt(due, level);
+    node.slot      = level * SLOTS + index;
+    node.prev      = NONE;
+    node.next      = heads[node.slot];
+    if (node.next != NONE)
+      nodes[node.next].prev = handle;
+    heads[node.slot] = handle;
+    occupied[level] |= uint64_t(1) << index;
+  }
+
+  void unlink(Handle handle)
+  {
+    Node& node = nodes[handle];
+    if (node.prev != NONE)
+      nodes[node.prev].next = node.next;
+    else
+      heads[node.slot] = node.next;
+    if (node.next != NONE)
+      nodes[node.next].prev = node.prev;
+    if (heads[node.slot] == NONE)
+      occupied[node.slot / SLOTS] &= ~(uint64_t(1) << (node.slot % SLOTS));
+  }
+
+  // Detaches a whole slot, returning its first node
+  Handle takeSlot(unsigned level, unsigned index)
+  {
+    Handle first = heads[level * SLOTS + index];
+    heads[level * SLOTS + index] = NONE;
+    occupied[level] &= ~(uint64_t(1) << index);
+    return first;
+  }
+
+public:
+  explicit TimingWheel(uint64_t start = 0) : current(start)
+  {
+    heads.fill(NONE);
+  }
+
+  uint64_t now() const { return current; }
+  size_t   size() const { return count; }
+
+  // Timers due at or before now() fire on the next tick
+  Handle schedule(uint64_t due, T value)
+  {
+    Handle handle;
+    if (!freeNodes.empty())
+    {
+      handle = freeNodes.back();
+      freeNodes.pop_back();
+    }
+    else
+    {
+      handle = static_cast<Handle>(nodes.size());
+      nodes.emplace_back();
+    }
+
+    Node& node = nodes[handle];
+    node.value = std::move(value);
+    node.due   = std::max(due, current + 1);
+    node.live  = true;
+    link(handle);
+    ++count;
+    return handle;
+  }
+
+  bool cancel(Handle handle)
+  {
+    if (handle >= nodes.size() || !nodes[handle].live)
+      return false;
+    unlink(handle);
+    nodes[handle].live  = false;
+    nodes[handle].value = T{};
+    freeNodes.push_back(handle);
+    --count;
+    return true;
+  }
+
+  // Earliest tick at which anything needs doing: the due tick of a timer in
+  // the current rotation, or the tick a higher level slot cascades at
+  bool nextDue(uint64_t& tick) const
+  {
+    if (count == 0)
+      return false;
+
+    tick = UINT64_MAX;
+    for (unsigned level = 0; level < LEVELS; ++level)
+    {
+      if (occupied[level] == 0)
+        continue;
+
+      unsigned shift    = BITS * level;
+      unsigned position = indexAt(current, level);
+      uint64_t rotation = (current >> (shift + BITS)) << (shift + BITS);
+      uint64_t ahead    = position + 1 < SLOTS
+                            ? occupied[level] & (~uint64_t(0) << (position + 1))
+                            : 0;
+      uint64_t slot;
+      if (ahead)
+        slot = rotation | (uint64_t(__builtin_ctzll(ahead)) << shift);
+      else // wrapped into the next rotation
+        slot = (rotation + (uint64_t(1) << (shift + BITS))) |
+               (uint64_t(__builtin_ctzll(occupied[level])) << shift);
+      tick = std::min(tick, slot);
+    }
+    return true;
+  }
+
+  // Moves the wheel forward to tick `to`, calling expired(value, due) for
+  // every timer that falls due on the way, in tick order. The callback may
+  // schedule and cancel timers, but not advance the wheel.
+  template <typename Expired>
+  void advance(uint64_t to, Expired&& expired)
+  {
+    uint64_t next;
+    while (current < to)
+    {
+      if (!nextDue(next) || next > to)
+      {
+        current = to;
+        break;
+      }
+      current = next;
+
+      // Higher levels first, so nothing is cascaded into a slot that has
+      // already been emptied at this tick
+      unsigned top = 0;
+      while (top + 1 < LEVELS &&
+             (current & ((uint64_t(1) << (BITS * (top + 1))) - 1)) == 0)
+        ++top;
+      for (unsigned level = top; level > 0; --level)
+      {
+        Handle handle = takeSlot(level, indexAt(current, level));
+        while (handle != NONE)
+        {
+          Handle following = nodes[handle].next;
+          link(handle);
+          handle = following;
+        }
+      }
+
+      // Detach everything first, so the callbacks see a consistent wheel
+      Handle handle = takeSlot(0, indexAt(current, 0));
+      while (handle != NONE)
+      {
+        Node& node = nodes[handle];
+        firing.emplace_back(std::move(node.value), node.due);
+        node.live  = false;
+        node.value = T{};
+        freeNodes.push_back(handle);
+        --count;
+        handle = node.next;
+      }
+      for (auto& [value, due] : firing)
+        expired(value, due);
+      firing.clear();
+    }
+  }
+};
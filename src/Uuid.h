@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 128-bit Bluetooth UUID held as two integers so index lookups and partial
+// matches are plain integer compares instead of string searches.
+struct Uuid128
+{
+  uint64_t high = 0;
+  uint64_t low  = 0;
+
+  bool operator==(const Uuid128& other) const
+  {
+    return high == other.high && low == other.low;
+  }
+  bool operator!=(const Uuid128& other) const { return !(*this == other); }
+  bool operator<(const Uuid128& other) const
+  {
+    return high != other.high ? high < other.high : low < other.low;
+  }
+
+  // 0000xxxx-0000-1000-8000-00805f9b34fb
+  static constexpr uint64_t BASE_HIGH = 0x0000000000001000ULL;
+  static constexpr uint64_t BASE_LOW  = 0x800000805f9b34fbULL;
+
+  static Uuid128 fromShort(uint32_t value)
+  {
+    return {BASE_HIGH | (static_cast<uint64_t>(value) << 32), BASE_LOW};
+  }
+
+  // Parses up to 32 hex digits (dashes ignored) into the leading nibbles of
+  // `out`. Returns the number of digits consumed, or 0 on malformed input.
+  static size_t parseHexDigits(const std::string& text, Uuid128& out)
+  {
+    out           = {};
+    size_t digits = 0;
+    for (char c : text)
+    {
+      if (c == '-')
+        continue;
+
+      uint64_t nibble;
+      if (c >= '0' && c <= '9')
+        nibble = static_cast<uint64_t>(c - '0');
+      else if (c >= 'a' && c <= 'f')
+        nibble = static_cast<uint64_t>(c - 'a' + 10);
+      else if (c >= 'A' && c <= 'F')
+        nibble = static_cast<uint64_t>(c - 'A' + 10);
+      else
+        return 0;
+
+      if (digits == 32)
+        return 0;
+
+      if (digits < 16)
+        out.high |= nibble << (60 - 4 * digits);
+      else
+        out.low |= nibble << (60 - 4 * (digits - 16));
+      ++digits;
+    }
+    return digits;
+  }
+
+  // Accepts the canonical 36-character form BlueZ reports, as well as the
+  // 16- and 32-bit short forms expanded against the Bluetooth base UUID.
+  static bool parse(const std::string& text, Uuid128& out)
+  {
+    Uuid128 digitsValue;
+    size_t  digits = parseHexDigits(text, digitsValue);
+
+    if (digits == 32)
+    {
+      out = digitsValue;
+      return true;
+    }
+    if (digits == 4 || digits == 8)
+    {
+      out = fromShort(static_cast<uint32_t>(digitsValue.high >>
+                                            (64 - 4 * digits)));
+      return true;
+    }
+    return false;
+  }
+
+  std::string toString() const
+  {
+    static const char hex[] = "0123456789abcdef";
+    std::string       text;
+    text.reserve(36);
+    for (size_t i = 0; i < 32; ++i)
+    {
+      if (i == 8 || i == 12 || i == 16 || i == 20)
+        text += '-';
+      uint64_t word  = i < 16 ? high : low;
+      size_t   shift = 60 - 4 * (i % 16);
+      text += hex[(word >> shift) & 0xf];
+    }
+    return text;
+  }
+};
+
+struct Uuid128Hash
+{
+  size_t operator()(const Uuid128& uuid) const
+  {
+    return static_cast<size_t>(uuid.high * 0x9e3779b97f4a7c15ULL ^ uuid.low);
+  }
+};
+
+// A UUID with a mask of significant bits, used for partial service matches.
+// Short forms ("180d", "0000fe95") match exactly on the base UUID; any other
+// run of fewer than 32 hex digits matches UUIDs starting with those digits.
+struct UuidPattern
+{
+  Uuid128 value;
+  Uuid128 mask;
+
+  bool exact() const { return mask.high == ~0ULL && mask.low == ~0ULL; }
+
+  bool matches(const Uuid128& uuid) const
+  {
+    return (uuid.high & mask.high) == value.high &&
+           (uuid.low & mask.low) == value.low;
+  }
+
+  static bool parse(const std::string& text, UuidPattern& out)
+  {
+    if (Uuid128::parse(text, out.value))
+    {
+      out.mask = {~0ULL, ~0ULL};
+      return true;
+    }
+
+    size_t digits = Uuid128::parseHexDigits(text, out.value);
+    if (digits == 0)
+      return false;
+
+    size_t bits   = digits * 4;
+    out.mask.high = bits >= 64 ? ~0ULL : ~(~0ULL >> bits);
+    out.mask.low  = bits <= 64 ? 0 : ~(~0ULL >> (bits - 64));
+    return true;
+  }
+};
@@ -1,24 +1,125 @@
+#include <pthread.h>
+
 #include <sdbus-c++/sdbus-c++.h>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <future>
 #include <iomanip>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <sstream>
+#include <span>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "AdvertisementCoalescer.h"
+#include "AdvertisementParser.h"
+#include "AllocationTracker.h"
+#include "BleCoroutines.h"
+#include "BusLoop.h"
+#include "CallControl.h"
+#include "CallbackExecutor.h"
+#include "ConfigReconciler.h"
+#include "ConnectionCache.h"
+#include "ConnectionProfile.h"
+#include "DeviceFilter.h"
+#include "DeviceHealth.h"
+#include "DeviceTable.h"
+#include "FirmwareTransfer.h"
+#include "FleetAllowlist.h"
+#include "FleetProvisioner.h"
+#include "GattSnapshot.h"
+#include "GattValue.h"
+#include "IdleMode.h"
+#include "NotificationBatcher.h"
+#include "NotificationRouter.h"
+#include "Payload.h"
+#include "PollScheduler.h"
+#include "RadioScheduler.h"
+
 class BluetoothManager
 {
 private:
-  std::unique_ptr<sdbus::IConnection>                          connection;
-  std::unique_ptr<sdbus::IProxy>                               adapterProxy;
-  std::string                                                  adapterPath;
-  std::map<std::string, std::map<std::string, sdbus::Variant>> devices;
-  std::string                                                  connectedDevice;
-  std::map<std::string, std::string>                           characteristics;
+  std::unique_ptr<sdbus::IConnection> connection;
+  std::unique_ptr<sdbus::IProxy>      adapterProxy;
+  std::string                         adapterPath;
+  DeviceTable                         devices;
+  AdvertisementParser                 advertisementParser;
+
+  // Connected devices; the most recently used one is the current device.
+  // Link-loss signals arrive on the event loop thread. Also guards `health`
+  // and `profiles`.
+  std::mutex         connectionsMutex;
+  ConnectionCache    connections;
+  DeviceHealth       health;
+  ConnectionProfiles profiles;
+
+  // Guards `devices`, the continuous scan state and the radio scheduler;
+  // signal handlers run on the event loop thread
+  std::mutex                                  devicesMutex;
+  std::condition_variable                     maintenanceWakeup;
+  std::condition_variable                     scanProgress;
+  size_t                                      scanWaiters = 0;
+  std::thread                                 maintenanceThread;
+  std::vector<sdbus::Slot>                    scanSlots;
+  EvictionPolicy                              evictionPolicy;
+  AdvertisementCoalescer                      advertisements;
+  std::vector<AdvertisementCoalescer::Update> coalescedUpdates;
+  DeviceFilter                                scanFilter;
+  FleetAllowlist                              allowlist;
+  uint64_t                                    allowlistChecked  = 0;
+  uint64_t                                    allowlistRejected = 0;
+  bool                                        continuousScan = false;
+  RadioScheduler                              radio;
+
+  // Guards the poll schedule; read replies arrive on the event loop thread.
+  // Taken before connectionsMutex when both are needed.
+  std::mutex                                                  pollMutex;
+  std::condition_variable                                     pollWakeup;
+  std::thread                                                 pollThread;
+  bool                                                        polling = false;
+  PollScheduler                                               polls;
+  std::map<PollScheduler::Id, std::unique_ptr<sdbus::IProxy>> pollProxies;
+
+  // Timer slack shared by the background threads
+  IdleMode idleMode;
+
+  // Our D-Bus event loop thread, which also runs the coroutine workflows.
+  // Stopped before `connection` goes.
+  std::unique_ptr<BusLoop>  busLoop;
+  std::unique_ptr<AsyncBle> asyncBle;
+  std::thread               busThread;
+
+  // Runs value callbacks off the event loop thread, in order per device
+  std::unique_ptr<CallbackExecutor> callbacks;
+
+  // Delivers notifications and poll results to the callbacks; created with
+  // the event loop
+  std::unique_ptr<NotificationRouter> router;
+
+  // Batched notification subscriptions. Only the map is guarded; the
+  // subscriptions themselves belong to the event loop thread.
+  using BatchSubscription = NotificationRouter::BatchSubscription;
+  std::mutex                                              batchesMutex;
+  std::map<uint64_t, std::shared_ptr<BatchSubscription>> batches;
+  uint64_t                                                nextBatchId = 1;
+
+  // What the value paths allocate, by subsystem and then by operation
+  static inline AllocationTag gattAllocations{"gatt"};
+  static inline AllocationTag readAllocations{"gatt.read", &gattAllocations};
+  static inline AllocationTag writeAllocations{"gatt.write",
+                                               &gattAllocations};
+  static inline AllocationTag pollAllocations{"poll"};
+  static inline AllocationTag replyAllocations{"poll.reply", &pollAllocations};
 
   const std::string BLUEZ_SERVICE          = "org.bluez";
   const std::string ADAPTER_INTERFACE      = "org.bluez.Adapter1";
@@ -28,14 +129,37 @@ private:
   const std::string PROPERTIES_INTERFACE   = "org.freedesktop.DBus.Properties";
   const std::string OBJECT_MANAGER_INTERFACE =
     "org.freedesktop.DBus.ObjectManager";
+  const std::string GATT_DESCRIPTOR_INTERFACE =
+    "org.bluez.GattDescriptor1";
+
+  // How long to wait for GATT discovery when the operation has no deadline
+  const std::chrono::seconds SERVICES_RESOLVE_TIMEOUT{30};
 
 public:
   BluetoothManager()
   {
     connection = sdbus::createSystemBusConnection();
+    callbacks  = std::make_unique<CallbackExecutor>();
     findAdapter();
   }
 
+  ~BluetoothManager()
+  {
+    stopPolling();
+    stopMaintenance();
+    scanSlots.clear();
+    if (busThread.joinable())
+    {
+      busLoop->stop();
+      busThread.join();
+    }
+    asyncBle.reset();
+    for (auto& [id, subscription] : batches)
+      router->flushBatch(*subscription);
+    batches.clear();
+    callbacks.reset();
+  }
+
   void findAdapter()
   {
     auto objectManager = sdbus::createProxy(
@@ -63,500 +187,3080 @@ public:
     throw std::runtime_error("No Bluetooth adapter found");
   }
 
+  // Discovery requests are counted by the radio scheduler, which keeps the
+  // adapter discovering while any scan needs it and no connect is pending
   void startDiscovery()
   {
-    try
-    {
-      adapterProxy->callMethod("StartDiscovery").onInterface(ADAPTER_INTERFACE);
-      std::cout << "Discovery started..." << std::endl;
-    }
-    catch (const sdbus::Error& e)
-    {
-      std::cerr << "Failed to start discovery: " << e.what() << std::endl;
-    }
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    radio.acquireScan();
+    updateRadio(DeviceTable::Clock::now());
+    std::cout << "Discovery started..." << std::endl;
   }
 
   void stopDiscovery()
   {
-    try
-    {
-      adapterProxy->callMethod("StopDiscovery").onInterface(ADAPTER_INTERFACE);
-      std::cout << "Discovery stopped." << std::endl;
-    }
-    catch (const sdbus::Error& e)
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    radio.releaseScan();
+    updateRadio(DeviceTable::Clock::now());
+    std::cout << "Discovery stopped." << std::endl;
+  }
+
+  // Sets whether discovery pauses while connecting, and the scan/idle duty
+  // cycle applied to continuous scanning
+  void setRadioPolicy(bool pauseOnConnect, const DutyCycle& cycle)
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    auto                        now = DeviceTable::Clock::now();
+    radio.setPauseOnConnect(pauseOnConnect);
+    radio.setDutyCycle(cycle, now);
+    updateRadio(now);
+    maintenanceWakeup.notify_all();
+  }
+
+  void showRadioStats()
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+
+    std::cout << "\n=== Radio ===" << std::endl;
+    std::cout << "Discovery:        "
+              << (radio.isDiscovering() ? "active" : "inactive") << std::endl;
+    std::cout << "Pause on connect: " << (radio.pauseOnConnect() ? "yes" : "no")
+              << " (" << radio.pauses() << " pauses)" << std::endl;
+    const DutyCycle& cycle = radio.dutyCycle();
+    std::cout << "Duty cycle:       ";
+    if (cycle.active())
+      std::cout << cycle.scanWindow.count() << " ms scan, "
+                << cycle.idleWindow.count() << " ms idle" << std::endl;
+    else
+      std::cout << "continuous" << std::endl;
+
+    std::cout << "Connect latency:" << std::endl;
+    const std::pair<ConnectMode, const char*> modes[] = {
+      {ConnectMode::Idle, "no discovery"},
+      {ConnectMode::Paused, "discovery paused"},
+      {ConnectMode::Scanning, "discovery running"}};
+    for (const auto& [mode, label] : modes)
     {
-      // Ignore if already stopped
+      const ConnectLatency& latency = radio.latency(mode);
+      std::cout << "  " << std::left << std::setw(18) << label << std::right
+                << latency.attempts << " attempts, " << latency.failures
+                << " failed";
+      if (latency.successes() > 0)
+      {
+        auto mean = latency.total / static_cast<int64_t>(latency.successes());
+        std::cout << "; mean " << mean.count() / 1000 << " ms, min "
+                  << latency.fastest.count() / 1000 << " ms, max "
+                  << latency.slowest.count() / 1000 << " ms";
+      }
+      std::cout << std::endl;
     }
   }
 
-  void scanDevices(int duration = 10)
+  void scanDevices(int duration = 10, const CancellationToken& token = {})
   {
-    devices.clear();
     startDiscovery();
 
     std::cout << "Scanning for " << duration << " seconds..." << std::endl;
-    std::this_thread::sleep_for(std::chrono::seconds(duration));
+    sleepUnlessCancelled(token, std::chrono::seconds(duration));
 
     stopDiscovery();
     updateDeviceList();
   }
 
-  void updateDeviceList()
+  // Scans until every target (MAC address or exact name) has been seen, or
+  // `timeout` expires, and stops discovery straight away. Returns the paths
+  // of the targets that were found.
+  std::vector<std::string>
+  scanForTargets(const std::vector<std::string>& targets,
+                 std::chrono::milliseconds       timeout)
+  {
+    return scanUntil(
+      [&](DeviceTable::Clock::time_point since,
+          std::vector<std::string>&      found) {
+        found.clear();
+        for (const auto& target : targets)
+        {
+          const DeviceRecord* device = findTarget(target);
+          if (device && device->lastSeen >= since)
+            found.push_back(device->path);
+        }
+        return found.size() == targets.size();
+      },
+      timeout);
+  }
+
+  // Scans until any device matching `filter` is seen or `timeout` expires
+  std::vector<std::string> scanForMatch(const DeviceFilter&       filter,
+                                        std::chrono::milliseconds timeout)
+  {
+    return scanUntil(
+      [&](DeviceTable::Clock::time_point since,
+          std::vector<std::string>&      found) {
+        found.clear();
+        for (const DeviceRecord* device : devices.seenSince(since))
+        {
+          if (filter.evaluate(*device))
+          {
+            found.push_back(device->path);
+            return true;
+          }
+        }
+        return false;
+      },
+      timeout);
+  }
+
+  void updateDeviceList(const CallOptions& options = {})
   {
     auto objectManager = sdbus::createProxy(
       *connection, sdbus::ServiceName(BLUEZ_SERVICE), sdbus::ObjectPath{"/"});
 
+    auto reply = invoke(*objectManager, OBJECT_MANAGER_INTERFACE,
+                        "GetManagedObjects", options);
+    if (!reply)
+    {
+      report("Error listing devices", reply.error());
+      return;
+    }
+
     std::map<sdbus::ObjectPath,
              std::map<std::string, std::map<std::string, sdbus::Variant>>>
       objects;
-    objectManager->callMethod("GetManagedObjects")
-      .onInterface(OBJECT_MANAGER_INTERFACE)
-      .storeResultsTo(objects);
+    reply.value() >> objects;
+
+    std::lock_guard<std::mutex> lock(devicesMutex);
 
+    std::map<std::string, std::map<std::string, sdbus::Variant>> snapshot;
     for (const auto& [path, interfaces] : objects)
     {
-      if (interfaces.find(DEVICE_INTERFACE) != interfaces.end())
+      if (interfaces.find(DEVICE_INTERFACE) != interfaces.end() &&
+          allowlist.admitsDevicePath(path.c_str()))
       {
-        devices[path] = interfaces.at(DEVICE_INTERFACE);
+        snapshot[path] = interfaces.at(DEVICE_INTERFACE);
       }
     }
+    devices.sync(snapshot);
   }
 
-  void listDevices(const std::string& filterService = "")
+  // Keeps discovery running and maintains the device table incrementally
+  // from BlueZ signals, evicting the least recently seen devices (from both
+  // the table and BlueZ) to stay within `policy`. Advertisement updates are
+  // coalesced so each device is updated at most once per `window`.
+  void startContinuousScan(const EvictionPolicy&     policy,
+                           std::chrono::milliseconds window =
+                             std::chrono::milliseconds(0))
   {
-    if (devices.empty())
     {
-      std::cout << "No devices found. Run scan first." << std::endl;
-      return;
+      std::lock_guard<std::mutex> lock(devicesMutex);
+      if (continuousScan)
+      {
+        std::cout << "Continuous scan already running." << std::endl;
+        return;
+      }
+      evictionPolicy = policy;
+      continuousScan = true;
+      advertisements.clear();
+      advertisements.setWindow(window);
     }
 
-    std::cout << "\n=== Available Devices ===" << std::endl;
-    int index = 1;
-
-    for (const auto& [path, props] : devices)
+    subscribeDeviceSignals();
+    updateDeviceList();
     {
-      std::string              name    = "Unknown";
-      std::string              address = "Unknown";
-      std::vector<std::string> uuids;
+      std::lock_guard<std::mutex> lock(devicesMutex);
+      auto                        now = DeviceTable::Clock::now();
+      radio.setContinuous(true, now);
+      updateRadio(now);
+    }
 
-      if (props.find("Name") != props.end())
-      {
-        name = props.at("Name").get<std::string>();
-      }
-      if (props.find("Address") != props.end())
-      {
-        address = props.at("Address").get<std::string>();
-      }
-      if (props.find("UUIDs") != props.end())
-      {
-        uuids = props.at("UUIDs").get<std::vector<std::string>>();
-      }
+    maintenanceThread = std::thread([this] {
+      pthread_setname_np(pthread_self(), "maintenance");
+      maintenanceLoop();
+    });
+    std::cout << "Continuous scan started." << std::endl;
+  }
 
-      // Filter by service UUID if specified
-      if (!filterService.empty())
+  void stopContinuousScan()
+  {
+    {
+      std::lock_guard<std::mutex> lock(devicesMutex);
+      if (!continuousScan)
       {
-        bool hasService = false;
-        for (const auto& uuid : uuids)
-        {
-          if (uuid.find(filterService) != std::string::npos)
-          {
-            hasService = true;
-            break;
-          }
-        }
-        if (!hasService)
-          continue;
+        std::cout << "Continuous scan is not running." << std::endl;
+        return;
       }
+    }
 
-      std::cout << index++ << ". " << name << " [" << address << "]"
-                << std::endl;
-      std::cout << "   Path: " << path << std::endl;
-
-      if (!uuids.empty())
-      {
-        std::cout << "   Services: ";
-        for (size_t i = 0; i < uuids.size() && i < 3; ++i)
-        {
-          std::cout << uuids[i];
-          if (i < uuids.size() - 1 && i < 2)
-            std::cout << ", ";
-        }
-        if (uuids.size() > 3)
-          std::cout << "...";
-        std::cout << std::endl;
-      }
-      std::cout << std::endl;
+    stopMaintenance();
+    scanSlots.clear();
+    {
+      std::lock_guard<std::mutex> lock(devicesMutex);
+      auto                        now = DeviceTable::Clock::now();
+      radio.setContinuous(false, now);
+      updateRadio(now);
     }
+    std::cout << "Continuous scan stopped." << std::endl;
   }
 
-  bool connectToDevice(const std::string& devicePath)
+  void showTableStats()
   {
-    try
-    {
-      auto deviceProxy = sdbus::createProxy(*connection,
-                                            sdbus::ServiceName(BLUEZ_SERVICE),
-                                            sdbus::ObjectPath{devicePath});
-
-      std::cout << "Connecting to device..." << std::endl;
-      deviceProxy->callMethod("Connect").onInterface(DEVICE_INTERFACE);
+    std::lock_guard<std::mutex> lock(devicesMutex);
 
-      // Wait for connection
-      std::this_thread::sleep_for(std::chrono::seconds(2));
-
-      // Check if connected
-      sdbus::Variant connectedVar;
-      deviceProxy->callMethod("Get")
-        .onInterface(PROPERTIES_INTERFACE)
-        .withArguments(DEVICE_INTERFACE, "Connected")
-        .storeResultsTo(connectedVar);
-
-      bool connected = connectedVar.get<bool>();
+    std::cout << "\n=== Device Table ===" << std::endl;
+    std::cout << "Continuous scan: " << (continuousScan ? "running" : "off")
+              << std::endl;
+    std::cout << "Devices:         " << devices.size() << std::endl;
+    std::cout << "Memory:          " << devices.approximateBytes() / 1024
+              << " KiB (approx.)" << std::endl;
+    std::cout << "Generation:      " << devices.generation() << std::endl;
+    std::cout << "Evictions:       " << devices.evictions() << std::endl;
+    const CoalescerStats& adverts = advertisements.stats();
+    std::cout << "Coalescing:      " << advertisements.getWindow().count()
+              << " ms window; " << adverts.received << " received, "
+              << adverts.dropped << " dropped, " << adverts.merged
+              << " merged, " << adverts.emitted << " emitted" << std::endl;
+    std::cout << "Scan filter:     "
+              << (scanFilter.empty() ? "none" : scanFilter.expression())
+              << std::endl;
+    std::cout << "Allowlist:       ";
+    if (allowlist.active())
+      std::cout << allowlist.size() << " addresses; " << allowlistChecked
+                << " checked, " << allowlistRejected << " rejected"
+                << std::endl;
+    else
+      std::cout << "off" << std::endl;
+    std::cout << "Limits:          "
+              << describeLimit(evictionPolicy.maxEntries, " entries") << ", "
+              << describeLimit(evictionPolicy.maxBytes / 1024, " KiB") << ", "
+              << describeLimit(
+                   static_cast<size_t>(evictionPolicy.maxAge.count()), " s")
+              << std::endl;
+  }
 
-      if (connected)
-      {
-        connectedDevice = devicePath;
-        std::cout << "Successfully connected!" << std::endl;
+  void listDevices(const std::string& filterService = "")
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
 
-        // Request MTU update
-        requestMTU(devicePath, 250);
+    if (devices.empty())
+    {
+      std::cout << "No devices found. Run scan first." << std::endl;
+      return;
+    }
 
-        // Discover services
-        discoverServices(devicePath);
+    std::vector<const DeviceRecord*> matches;
 
-        return true;
-      }
-      else
+    // Filter by service UUID if specified
+    if (filterService.empty())
+    {
+      for (const auto& [path, device] : devices.all())
       {
-        std::cout << "Failed to connect." << std::endl;
-        return false;
+        matches.push_back(&device);
       }
     }
-    catch (const sdbus::Error& e)
+    else
     {
-      std::cerr << "Connection error: " << e.what() << std::endl;
-      return false;
+      UuidPattern pattern;
+      if (!UuidPattern::parse(filterService, pattern))
+      {
+        std::cout << "Invalid service UUID." << std::endl;
+        return;
+      }
+      matches = devices.findByService(pattern);
     }
+
+    printDevices("Available Devices", matches);
   }
 
-  void requestMTU(const std::string& devicePath, uint16_t mtu)
+  void listStrongestDevices(size_t count)
   {
-    try
-    {
-      auto deviceProxy = sdbus::createProxy(*connection,
-                                            sdbus::ServiceName(BLUEZ_SERVICE),
-                                            sdbus::ObjectPath{devicePath});
-
-      // Note: BlueZ doesn't directly expose MTU exchange, but we can try
-      // setting it
-      std::cout << "Requesting MTU of " << mtu << " bytes..." << std::endl;
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    printDevices("Strongest Devices", devices.strongest(count));
+  }
 
-      // The MTU exchange typically happens automatically during connection
-      // We can check the current MTU
-      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  void listRecentDevices(size_t count)
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    printDevices("Recently Seen Devices", devices.recentlySeen(count));
+  }
 
-      std::cout << "MTU exchange completed (automatic during connection)"
-                << std::endl;
-    }
-    catch (const sdbus::Error& e)
-    {
-      std::cerr << "MTU request note: " << e.what() << std::endl;
-    }
+  void listDevicesByName(const std::string& prefix)
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    printDevices("Devices Named \"" + prefix + "...\"",
+                 devices.findByNamePrefix(prefix));
   }
 
-  void disconnectFromDevice()
+  void listDevicesMatching(const std::string& expression)
   {
-    if (connectedDevice.empty())
+    DeviceFilter filter;
+    std::string  error;
+    if (!DeviceFilter::compile(expression, filter, error))
     {
-      std::cout << "No device connected." << std::endl;
+      std::cout << "Invalid filter: " << error << std::endl;
       return;
     }
 
-    try
-    {
-      auto deviceProxy = sdbus::createProxy(*connection,
-                                            sdbus::ServiceName(BLUEZ_SERVICE),
-                                            sdbus::ObjectPath{connectedDevice});
-      deviceProxy->callMethod("Disconnect").onInterface(DEVICE_INTERFACE);
-      std::cout << "Disconnected from device." << std::endl;
-      connectedDevice.clear();
-      characteristics.clear();
-    }
-    catch (const sdbus::Error& e)
+    std::lock_guard<std::mutex>      lock(devicesMutex);
+    std::vector<const DeviceRecord*> matches;
+    for (const auto& [path, device] : devices.all())
     {
-      std::cerr << "Disconnect error: " << e.what() << std::endl;
+      if (filter.evaluate(device))
+        matches.push_back(&device);
     }
+    printDevices("Devices Matching Filter", matches);
   }
 
-  void forgetDevice(const std::string& devicePath)
+  // Applies `expression` to every scan update, one-shot or continuous;
+  // devices that do not match are not kept. An empty expression clears it.
+  bool setScanFilter(const std::string& expression)
   {
-    try
+    DeviceFilter filter;
+    std::string  error;
+    if (!DeviceFilter::compile(expression, filter, error))
     {
-      // Disconnect first if connected
-      if (connectedDevice == devicePath)
-      {
-        disconnectFromDevice();
-      }
+      std::cout << "Invalid filter: " << error << std::endl;
+      return false;
+    }
 
-      adapterProxy->callMethod("RemoveDevice")
-        .onInterface(ADAPTER_INTERFACE)
-        .withArguments(sdbus::ObjectPath(devicePath));
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    scanFilter = filter;
+    if (filter.empty())
+      devices.setAdmissionFilter(nullptr);
+    else
+      devices.setAdmissionFilter(filter);
 
-      devices.erase(devicePath);
-      std::cout << "Device forgotten." << std::endl;
-    }
-    catch (const sdbus::Error& e)
-    {
-      std::cerr << "Error forgetting device: " << e.what() << std::endl;
-    }
+    std::cout << (filter.empty() ? "Scan filter cleared."
+                                 : "Scan filter set.")
+              << std::endl;
+    return true;
   }
 
-  void discoverServices(const std::string& devicePath)
+  // Loads the fleet allowlist (text or binary); an empty path disables it.
+  // Devices already in the table that are not on the list are dropped.
+  bool loadAllowlist(const std::string& path)
   {
-    std::cout << "Discovering services and characteristics..." << std::endl;
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    std::lock_guard<std::mutex> lock(devicesMutex);
 
-    auto objectManager = sdbus::createProxy(
-      *connection, sdbus::ServiceName(BLUEZ_SERVICE), sdbus::ObjectPath{"/"});
-
-    std::map<sdbus::ObjectPath,
-             std::map<std::string, std::map<std::string, sdbus::Variant>>>
-      objects;
-    objectManager->callMethod("GetManagedObjects")
-      .onInterface(OBJECT_MANAGER_INTERFACE)
-      .storeResultsTo(objects);
+    if (path.empty())
+    {
+      allowlist.clear();
+      std::cout << "Allowlist disabled." << std::endl;
+      return true;
+    }
 
-    characteristics.clear();
+    std::string error;
+    if (!allowlist.load(path, error))
+    {
+      std::cerr << "Failed to load allowlist: " << error << std::endl;
+      return false;
+    }
 
-    for (const auto& [path, interfaces] : objects)
+    std::vector<std::string> rejected;
+    for (const auto& [devicePath, device] : devices.all())
     {
-      std::string pathStr = path;
+      if (!allowlist.admitsDevicePath(devicePath.c_str()))
+        rejected.push_back(devicePath);
+    }
+    for (const auto& devicePath : rejected)
+    {
+      devices.erase(devicePath);
+      advertisements.forget(devicePath);
+    }
 
-      // Check if this characteristic belongs to our device
-      if (pathStr.find(devicePath) == std::string::npos)
-        continue;
+    allowlistChecked  = 0;
+    allowlistRejected = 0;
+    std::cout << "Allowlist loaded: " << allowlist.size() << " addresses"
+              << (allowlist.isMapped() ? " (memory-mapped)" : "") << "."
+              << std::endl;
+    return true;
+  }
 
-      if (interfaces.find(GATT_CHAR_INTERFACE) != interfaces.end())
-      {
-        const auto& charProps = interfaces.at(GATT_CHAR_INTERFACE);
+  bool saveAllowlist(const std::string& path)
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    std::string                 error;
 
-        if (charProps.find("UUID") != charProps.end())
-        {
-          std::string uuid      = charProps.at("UUID").get<std::string>();
-          characteristics[uuid] = pathStr;
-        }
-      }
+    if (!allowlist.active())
+    {
+      std::cout << "No allowlist loaded." << std::endl;
+      return false;
+    }
+    if (!allowlist.save(path, error))
+    {
+      std::cerr << "Failed to save allowlist: " << error << std::endl;
+      return false;
     }
+    std::cout << "Allowlist written to " << path << std::endl;
+    return true;
+  }
 
-    std::cout << "Found " << characteristics.size() << " characteristics."
-              << std::endl;
+  void findDeviceByAddress(const std::string& address)
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    const DeviceRecord* device = devices.findByAddress(address);
+    if (!device)
+    {
+      std::cout << "No device with address " << address << "." << std::endl;
+      return;
+    }
+    printDevices("Device " + device->address, {device});
   }
 
-  void listCharacteristics()
+  void printDevices(const std::string&                      title,
+                    const std::vector<const DeviceRecord*>& list)
   {
-    if (characteristics.empty())
+    std::cout << "\n=== " << title << " ===" << std::endl;
+    if (list.empty())
     {
-      std::cout << "No characteristics available. Connect to a device first."
-                << std::endl;
+      std::cout << "No matching devices." << std::endl;
       return;
     }
 
-    std::cout << "\n=== Available Characteristics ===" << std::endl;
     int index = 1;
-    for (const auto& [uuid, path] : characteristics)
+    for (const DeviceRecord* device : list)
     {
-      std::cout << index++ << ". UUID: " << uuid << std::endl;
-      std::cout << "   Path: " << path << std::endl;
+      const std::vector<std::string>& uuids = device->uuids;
 
-      try
-      {
-        auto           charProxy = sdbus::createProxy(*connection,
-                                            sdbus::ServiceName(BLUEZ_SERVICE),
-                                            sdbus::ObjectPath{path});
-        sdbus::Variant flagsVar;
-        charProxy->callMethod("Get")
-          .onInterface(PROPERTIES_INTERFACE)
-          .withArguments(GATT_CHAR_INTERFACE, "Flags")
-          .storeResultsTo(flagsVar);
+      std::cout << index++ << ". " << device->name << " [" << device->address
+                << "]";
+      if (device->hasRssi)
+        std::cout << " RSSI " << device->rssi << " dBm";
+      std::cout << std::endl;
+      std::cout << "   Path: " << device->path << std::endl;
 
-        auto flags = flagsVar.get<std::vector<std::string>>();
-        std::cout << "   Flags: ";
-        for (size_t i = 0; i < flags.size(); ++i)
+      if (!uuids.empty())
+      {
+        std::cout << "   Services: ";
+        for (size_t i = 0; i < uuids.size() && i < 3; ++i)
         {
-          std::cout << flags[i];
-          if (i < flags.size() - 1)
+          std::cout << uuids[i];
+          if (i < uuids.size() - 1 && i < 2)
             std::cout << ", ";
         }
+        if (uuids.size() > 3)
+          std::cout << "...";
         std::cout << std::endl;
       }
-      catch (...)
-      {
-      }
 
+      advertisementParser.parse(*device, [](const AdvertisementFrame& frame) {
+        std::cout << "   Advertisement: " << describeFrame(frame) << std::endl;
+      });
       std::cout << std::endl;
     }
   }
 
-  void enableNotify(const std::string& characteristicUUID)
+  // Accepts either a D-Bus object path or a MAC address of a known device
+  std::string resolveDevicePath(const std::string& device)
   {
-    auto it = characteristics.find(characteristicUUID);
-    if (it == characteristics.end())
-    {
-      std::cout << "Characteristic not found." << std::endl;
-      return;
-    }
-
-    try
-    {
-      auto charProxy = sdbus::createProxy(*connection,
-                                          sdbus::ServiceName(BLUEZ_SERVICE),
-                                          sdbus::ObjectPath{it->second});
-
-      std::cout << "Notifications enabled for " << characteristicUUID
-                << std::endl;
+    if (device.empty() || device.front() == '/')
+      return device;
 
-      // Register signal handler for notifications
-      charProxy->uponSignal("PropertiesChanged")
-        .onInterface(PROPERTIES_INTERFACE)
-        .call([characteristicUUID](
-                const std::string&                           interface,
-                const std::map<std::string, sdbus::Variant>& changed,
-                const std::vector<std::string>&              invalidated) {
-          if (changed.find("Value") != changed.end())
-          {
-            auto value = changed.at("Value").get<std::vector<uint8_t>>();
-            std::cout << "\n[NOTIFY " << characteristicUUID << "] ";
-            printHexData(value);
-            std::cout << std::endl;
-          }
-        });
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    const DeviceRecord* record = devices.findByAddress(device);
+    return record ? record->path : device;
+  }
 
-      charProxy->callMethod("StartNotify").onInterface(GATT_CHAR_INTERFACE);
-    }
-    catch (const sdbus::Error& e)
+  // Connects to `device` and makes it the current device. A device that is
+  // still connected in the cache is reused without a round trip; otherwise
+  // the least recently used connection is closed if the cache is full.
+  Result<void> connectToDevice(const std::string& device,
+                               const CallOptions& options = {})
+  {
+    std::string devicePath = resolveDevicePath(device);
     {
-      std::cerr << "Error enabling notifications: " << e.what() << std::endl;
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      if (connections.use(devicePath, Connection::Clock::now()))
+      {
+        std::cout << "Using cached connection to " << devicePath << std::endl;
+        return {};
+      }
     }
+
+    auto admitted = admitCall(devicePath);
+    if (!admitted)
+      return report("Connection error", admitted.error());
+    auto opened = openConnection(devicePath, options);
+    if (!opened)
+      return report("Connection error", opened.error());
+    return {};
   }
 
-  void disableNotify(const std::string& characteristicUUID)
+  // Connects to the strongest device matching a filter expression
+  Result<void> connectToBestMatch(const std::string& expression,
+                                  const CallOptions& options = {})
   {
-    auto it = characteristics.find(characteristicUUID);
-    if (it == characteristics.end())
+    DeviceFilter filter;
+    std::string  error;
+    if (!DeviceFilter::compile(expression, filter, error))
     {
-      std::cout << "Characteristic not found." << std::endl;
-      return;
+      std::cout << "Invalid filter: " << error << std::endl;
+      return CallError{"org.freedesktop.DBus.Error.InvalidArgs", error};
     }
 
-    try
+    std::string best;
     {
-      auto charProxy = sdbus::createProxy(*connection,
-                                          sdbus::ServiceName(BLUEZ_SERVICE),
-                                          sdbus::ObjectPath{it->second});
-      charProxy->callMethod("StopNotify").onInterface(GATT_CHAR_INTERFACE);
-      std::cout << "Notifications disabled for " << characteristicUUID
-                << std::endl;
+      std::lock_guard<std::mutex> lock(devicesMutex);
+      for (const DeviceRecord* device : devices.strongest(devices.size()))
+      {
+        if (!device->connected && filter.evaluate(*device))
+        {
+          best = device->path;
+          break;
+        }
+      }
     }
-    catch (const sdbus::Error& e)
+
+    if (best.empty())
     {
-      std::cerr << "Error disabling notifications: " << e.what() << std::endl;
+      std::cout << "No unconnected device with RSSI matches the filter."
+                << std::endl;
+      return CallError{"org.bluez.Error.DoesNotExist",
+                       "No unconnected device matches the filter"};
     }
+    std::cout << "Best match: " << best << std::endl;
+    return connectToDevice(best, options);
   }
 
-  void writeCharacteristic(const std::string&          characteristicUUID,
-                           const std::vector<uint8_t>& data)
+  // Disconnects `device`, or the current device if none is given
+  Result<void> disconnectFromDevice(const std::string& device  = "",
+                                    const CallOptions& options = {})
   {
-    auto it = characteristics.find(characteristicUUID);
-    if (it == characteristics.end())
+    std::string devicePath = resolveDevicePath(device);
+    Connection  entry;
+    bool        found;
     {
-      std::cout << "Characteristic not found." << std::endl;
-      return;
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      if (devicePath.empty() && connections.mostRecent())
+        devicePath = connections.mostRecent()->path;
+      found = connections.take(devicePath, entry);
     }
 
-    try
+    if (!found)
     {
-      auto charProxy = sdbus::createProxy(*connection,
-                                          sdbus::ServiceName(BLUEZ_SERVICE),
-                                          sdbus::ObjectPath{it->second});
-
-      std::map<std::string, sdbus::Variant> options;
-      options["type"] = sdbus::Variant("request");
+      std::cout << "No device connected." << std::endl;
+      return CallError{ERROR_NOT_CONNECTED, "No device connected"};
+    }
 
-      charProxy->callMethod("WriteValue")
-        .onInterface(GATT_CHAR_INTERFACE)
-        .withArguments(data, options);
+    auto closed = closeConnection(entry, options);
+    if (!closed)
+      return report("Disconnect error", closed.error());
+    std::cout << "Disconnected from device." << std::endl;
+    return {};
+  }
 
-      std::cout << "Data written to characteristic " << characteristicUUID
-                << std::endl;
+  // Keeps at most `capacity` devices connected, closing the least recently
+  // used ones if there are more
+  void setConnectionLimit(size_t capacity)
+  {
+    std::vector<Connection> removed;
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      removed = connections.setCapacity(capacity);
     }
-    catch (const sdbus::Error& e)
+    for (Connection& entry : removed)
     {
-      std::cerr << "Error writing characteristic: " << e.what() << std::endl;
+      std::cout << "Disconnecting " << entry.path << std::endl;
+      auto closed = closeConnection(entry);
+      if (!closed)
+        report("Disconnect error", closed.error());
     }
   }
 
-  void readCharacteristic(const std::string& characteristicUUID)
+  // Sets the profile applied when `device` connects; "*" sets the default
+  // for devices without their own. An empty profile removes it.
+  void setConnectionProfile(const std::string& device,
+                            ConnectionProfile  profile)
   {
-    auto it = characteristics.find(characteristicUUID);
-    if (it == characteristics.end())
+    uint64_t address = 0;
+    if (device != "*" &&
+        !FleetAllowlist::parseAddress(device.c_str(), address) &&
+        !FleetAllowlist::parseDevicePath(device.c_str(), address))
     {
-      std::cout << "Characteristic not found." << std::endl;
+      std::cout << "Unknown device: " << device << std::endl;
       return;
     }
 
-    try
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    if (profile.empty())
     {
-      auto charProxy = sdbus::createProxy(*connection,
-                                          sdbus::ServiceName(BLUEZ_SERVICE),
-                                          sdbus::ObjectPath{it->second});
-
-      std::map<std::string, sdbus::Variant> options;
-      std::vector<uint8_t>                  value;
-
-      charProxy->callMethod("ReadValue")
-        .onInterface(GATT_CHAR_INTERFACE)
-        .withArguments(options)
-        .storeResultsTo(value);
-
-      std::cout << "Read from " << characteristicUUID << ": ";
-      printHexData(value);
+      if (device == "*")
+        profiles.removeDefault();
+      else
+        profiles.remove(address);
+      std::cout << "Connection profile removed." << std::endl;
+    }
+    else
+    {
+      if (device == "*")
+        profiles.setDefault(std::move(profile));
+      else
+        profiles.set(address, std::move(profile));
+      std::cout << "Connection profile set." << std::endl;
+    }
+  }
+
+  void listConnectionProfiles()
+  {
+    auto print = [](const std::string&       label,
+                    const ConnectionProfile& profile) {
+      std::cout << label << std::endl;
+      for (const std::string& uuid : profile.subscribe)
+        std::cout << "   subscribe " << uuid << std::endl;
+      for (const std::string& uuid : profile.read)
+        std::cout << "   read      " << uuid << std::endl;
+    };
+
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    std::cout << "\n=== Connection Profiles ===" << std::endl;
+    if (profiles.defaultProfile())
+      print("Default", *profiles.defaultProfile());
+    for (const auto& [address, profile] : profiles.all())
+      print(FleetAllowlist::formatAddress(address), profile);
+  }
+
+  // Runs `job` against every device in the list, `concurrency` devices at a
+  // time, and writes a CSV report. Each BlueZ call gets its own `timeout`.
+  void provisionFleet(const std::vector<std::string>& fleet,
+                      const ProvisionJob&             job,
+                      size_t                          concurrency,
+                      const std::string&              reportPath,
+                      std::chrono::milliseconds       timeout,
+                      const CancellationToken&        token)
+  {
+    {
+      // Workers beyond the cache capacity would evict each other
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      if (concurrency > connections.capacity())
+      {
+        concurrency = connections.capacity();
+        std::cout << "Concurrency limited to the connection limit of "
+                  << concurrency << "." << std::endl;
+      }
+    }
+
+    auto callOptions = [&] { return CallOptions::within(timeout, token); };
+
+    ProvisionSteps steps;
+    steps.connect = [&](const std::string& device) -> Result<void> {
+      std::string devicePath = resolveDevicePath(device);
+      if (devicePath.empty() || devicePath.front() != '/')
+        return CallError{"org.bluez.Error.DoesNotExist",
+                         "Device " + device + " has not been discovered"};
+      return connectToDevice(devicePath, callOptions());
+    };
+    steps.write = [&](const std::string&    device,
+                      const ProvisionWrite& write) {
+      return writeCharacteristic(resolveDevicePath(device), write.uuid,
+                                 write.value, callOptions());
+    };
+    steps.read = [&](const std::string& device, const std::string& uuid) {
+      return readCharacteristic(resolveDevicePath(device), uuid,
+                                callOptions());
+    };
+    steps.disconnect = [&](const std::string& device) {
+      return disconnectFromDevice(resolveDevicePath(device), callOptions());
+    };
+    steps.retryAfter = [&](const std::string& device) {
+      return breakerRetryIn(resolveDevicePath(device));
+    };
+
+    std::cout << "Provisioning " << fleet.size() << " devices, "
+              << concurrency << " at a time..." << std::endl;
+    auto             started = std::chrono::steady_clock::now();
+    FleetProvisioner provisioner(job, std::move(steps), concurrency, token);
+    auto             results =
+      provisioner.run(fleet, [](const ProvisionResult& result) {
+        std::cout << "[PROVISION] " << result.device << ": "
+                  << (result.ok ? "ok" : "failed at ")
+                  << (result.ok ? "" : stageName(result.stage));
+        if (!result.ok)
+          std::cout << " (" << result.error.name << ")";
+        std::cout << " after " << result.attempts << " attempt(s), "
+                  << result.elapsed.count() << " ms" << std::endl;
+      });
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - started);
+
+    size_t succeeded = static_cast<size_t>(
+      std::count_if(results.begin(), results.end(),
+                    [](const ProvisionResult& result) { return result.ok; }));
+    std::cout << succeeded << " of " << results.size()
+              << " devices provisioned in " << elapsed.count() << " ms."
+              << std::endl;
+
+    std::string error;
+    if (!FleetProvisioner::writeReport(reportPath, results, error))
+      std::cout << "Report not written: " << error << std::endl;
+    else
+      std::cout << "Report written to " << reportPath << std::endl;
+  }
+
+  // Streams a firmware image to the `dataUuid` characteristic, resuming
+  // from the last checkpoint and reconnecting when the link drops. With a
+  // control characteristic, the image size and CRC-32 are written to it at
+  // the end as two little-endian uint32 values.
+  void transferFirmware(const std::string&        device,
+                        const std::string&        imagePath,
+                        const std::string&        dataUuid,
+                        const std::string&        controlUuid,
+                        size_t                    window,
+                        std::chrono::milliseconds timeout,
+                        const CancellationToken&  token)
+  {
+    const unsigned MAX_RESUMES = 5;
+
+    MappedImage image;
+    std::string error;
+    if (!image.open(imagePath, error))
+    {
+      std::cout << "Cannot transfer: " << error << std::endl;
+      return;
+    }
+
+    std::string devicePath = resolveDevicePath(device);
+    uint64_t    address    = 0;
+    FleetAllowlist::parseDevicePath(devicePath.c_str(), address);
+    std::string tag = FleetAllowlist::formatAddress(address);
+    tag.erase(std::remove(tag.begin(), tag.end(), ':'), tag.end());
+
+    TransferSettings settings;
+    settings.window = window;
+    FirmwareTransfer transfer(image, imagePath + "." + tag + ".checkpoint",
+                              settings);
+    if (uint64_t resumed = transfer.resume())
+      std::cout << "Resuming at offset " << resumed << " of " << image.size()
+                << std::endl;
+
+    auto         started   = std::chrono::steady_clock::now();
+    uint64_t     startedAt = transfer.offset();
+    Result<void> sent;
+    for (unsigned resumes = 0;; ++resumes)
+    {
+      auto        options = CallOptions::within(timeout, token);
+      std::string charDevice;
+      auto        charPath =
+        findCharacteristic(devicePath, dataUuid, charDevice, options);
+      if (charPath)
+      {
+        auto charProxy = sdbus::createProxy(
+          *connection, sdbus::ServiceName(BLUEZ_SERVICE),
+          sdbus::ObjectPath{charPath.value()});
+        transfer.setPacketSize(attMtu(*charProxy, options) - 3);
+
+        TransferStats stats;
+        sent = transfer.send(*charProxy, GATT_CHAR_INTERFACE, timeout, token,
+                             stats);
+        recordCall(devicePath, sent);
+
+        std::ostringstream rate;
+        rate << std::fixed << std::setprecision(1)
+             << stats.kilobytesPerSecond();
+        std::cout << "Sent " << stats.bytes << " bytes in " << stats.packets
+                  << " packets, " << stats.elapsed.count() << " ms ("
+                  << rate.str() << " kB/s)" << std::endl;
+      }
+      else
+      {
+        sent = charPath.error();
+      }
+
+      if (sent || resumes == MAX_RESUMES || token.cancelled() ||
+          !DeviceHealth::transient(sent.error()))
+        break;
+
+      auto delay = std::max<std::chrono::milliseconds>(
+        std::chrono::seconds(1), breakerRetryIn(devicePath));
+      std::cout << "Transfer interrupted at offset " << transfer.offset()
+                << " (" << sent.error().name << "); retrying in "
+                << delay.count() << " ms..." << std::endl;
+      if (!sleepUnlessCancelled(token, delay))
+        break;
+    }
+
+    if (!sent)
+    {
+      report("Firmware transfer failed", sent.error());
+      std::cout << "Progress saved at offset " << transfer.offset() << " of "
+                << image.size() << "." << std::endl;
+      return;
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - started);
+    std::ostringstream crc;
+    crc << std::hex << std::setw(8) << std::setfill('0') << transfer.imageCrc();
+    std::cout << "Transferred " << image.size() - startedAt << " bytes in "
+              << elapsed.count() << " ms; image CRC-32 " << crc.str()
+              << std::endl;
+
+    if (!controlUuid.empty())
+    {
+      std::vector<uint8_t> commit;
+      for (uint32_t value : {static_cast<uint32_t>(image.size()),
+                             transfer.imageCrc()})
+      {
+        for (int shift = 0; shift < 32; shift += 8)
+          commit.push_back(static_cast<uint8_t>(value >> shift));
+      }
+      if (!writeCharacteristic(devicePath, controlUuid, commit,
+                               CallOptions::within(timeout, token)))
+        return;
+    }
+    transfer.finish();
+  }
+
+  void showDeviceHealth()
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    auto                        now = DeviceHealth::Clock::now();
+
+    std::cout << "\n=== Device Health ===" << std::endl;
+    if (health.all().empty())
+    {
+      std::cout << "No failures recorded." << std::endl;
+      return;
+    }
+
+    for (const auto& [path, breaker] : health.all())
+    {
+      std::cout << path << ": ";
+      switch (breaker.state)
+      {
+        case BreakerState::Closed:
+          std::cout << "closed";
+          break;
+        case BreakerState::Open:
+          std::cout << "open, probe in "
+                    << std::chrono::duration_cast<std::chrono::seconds>(
+                         std::max(breaker.retryAt - now,
+                                  DeviceHealth::Clock::duration::zero()))
+                         .count()
+                    << " s";
+          break;
+        case BreakerState::HalfOpen:
+          std::cout << "half-open";
+          break;
+      }
+      std::cout << std::endl;
+      std::cout << "   " << breaker.failures << "/" << breaker.recent.size()
+                << " recent calls failed, " << breaker.rejected
+                << " rejected, last error: "
+                << (breaker.lastError.empty() ? "none" : breaker.lastError)
+                << std::endl;
+    }
+  }
+
+  void listConnections()
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    auto                        now = Connection::Clock::now();
+
+    std::cout << "\n=== Connections (" << connections.size() << "/"
+              << connections.capacity() << ") ===" << std::endl;
+    for (const Connection& entry : connections.all())
+    {
+      auto idle = std::chrono::duration_cast<std::chrono::seconds>(
+        now - entry.lastUsed);
+      std::cout << entry.path << (entry.linkUp ? "" : " (link lost)")
+                << std::endl;
+      std::cout << "   " << entry.characteristics.size()
+                << " characteristics, " << entry.notifications.size()
+                << " subscribed, " << entry.uses << " uses, idle "
+                << idle.count() << " s" << std::endl;
+    }
+
+    const ConnectionStats& stats = connections.stats();
+    std::cout << "Hits: " << stats.hits << ", misses: " << stats.misses
+              << ", evictions: " << stats.evictions
+              << ", links lost: " << stats.drops << std::endl;
+  }
+
+  Result<void> forgetDevice(const std::string& device,
+                            const CallOptions& options = {})
+  {
+    std::string devicePath = resolveDevicePath(device);
+
+    // Disconnect first if connected
+    bool cached;
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      cached = connections.find(devicePath) != nullptr;
+    }
+    if (cached)
+    {
+      disconnectFromDevice(devicePath, options);
+    }
+
+    auto removed = invoke(*adapterProxy, ADAPTER_INTERFACE, "RemoveDevice",
+                          options, sdbus::ObjectPath(devicePath));
+    if (!removed)
+      return report("Error forgetting device", removed.error());
+
+    {
+      std::lock_guard<std::mutex> lock(devicesMutex);
+      devices.erase(devicePath);
+    }
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      health.reset(devicePath);
+    }
+    std::cout << "Device forgotten." << std::endl;
+    return {};
+  }
+
+  // Finds the GATT characteristics of `devicePath`, by UUID
+  Result<void>
+  discoverServices(const std::string&                  devicePath,
+                   std::map<std::string, std::string>& characteristics,
+                   const CallOptions&                  options = {})
+  {
+    std::cout << "Discovering services and characteristics..." << std::endl;
+
+    auto objectManager = sdbus::createProxy(
+      *connection, sdbus::ServiceName(BLUEZ_SERVICE), sdbus::ObjectPath{"/"});
+
+    auto reply = invoke(*objectManager, OBJECT_MANAGER_INTERFACE,
+                        "GetManagedObjects", options);
+    if (!reply)
+      return reply.error();
+
+    std::map<sdbus::ObjectPath,
+             std::map<std::string, std::map<std::string, sdbus::Variant>>>
+      objects;
+    reply.value() >> objects;
+
+    characteristics.clear();
+    for (const auto& [path, interfaces] : objects)
+    {
+      std::string pathStr = path;
+
+      // Check if this characteristic belongs to our device
+      if (pathStr.find(devicePath) == std::string::npos)
+        continue;
+
+      if (interfaces.find(GATT_CHAR_INTERFACE) != interfaces.end())
+      {
+        const auto& charProps = interfaces.at(GATT_CHAR_INTERFACE);
+
+        if (charProps.find("UUID") != charProps.end())
+        {
+          std::string uuid      = charProps.at("UUID").get<std::string>();
+          characteristics[uuid] = pathStr;
+        }
+      }
+    }
+
+    std::cout << "Found " << characteristics.size() << " characteristics."
+              << std::endl;
+    return {};
+  }
+
+  void listCharacteristics(const CallOptions& options = {})
+  {
+    std::map<std::string, std::string> characteristics;
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      if (const Connection* current = connections.mostRecent())
+        characteristics = current->characteristics;
+    }
+
+    if (characteristics.empty())
+    {
+      std::cout << "No characteristics available. Connect to a device first."
+                << std::endl;
+      return;
+    }
+
+    std::cout << "\n=== Available Characteristics ===" << std::endl;
+    int index = 1;
+    for (const auto& [uuid, path] : characteristics)
+    {
+      std::cout << index++ << ". UUID: " << uuid << std::endl;
+      std::cout << "   Path: " << path << std::endl;
+
+      auto charProxy = sdbus::createProxy(*connection,
+                                          sdbus::ServiceName(BLUEZ_SERVICE),
+                                          sdbus::ObjectPath{path});
+      auto reply = invoke(*charProxy, PROPERTIES_INTERFACE, "Get", options,
+                          GATT_CHAR_INTERFACE, "Flags");
+      sdbus::Variant flagsVar;
+      if (reply)
+        reply.value() >> flagsVar;
+
+      if (flagsVar.containsValueOfType<std::vector<std::string>>())
+      {
+        auto flags = flagsVar.get<std::vector<std::string>>();
+        std::cout << "   Flags: ";
+        for (size_t i = 0; i < flags.size(); ++i)
+        {
+          std::cout << flags[i];
+          if (i < flags.size() - 1)
+            std::cout << ", ";
+        }
+        std::cout << std::endl;
+      }
+
+      std::cout << std::endl;
+    }
+  }
+
+  Result<void> enableNotify(const std::string& characteristicUUID,
+                            const CallOptions& options = {})
+  {
+    std::string devicePath;
+    auto        charPath =
+      findCharacteristic("", characteristicUUID, devicePath, options);
+    if (!charPath)
+      return report("Error enabling notifications", charPath.error());
+
+    auto charProxy = sdbus::createProxy(*connection,
+                                        sdbus::ServiceName(BLUEZ_SERVICE),
+                                        sdbus::ObjectPath{charPath.value()});
+
+    // Subscribe before starting so the first notification is not missed
+    auto watch =
+      watchNotifications(devicePath, charPath.value(), characteristicUUID);
+    auto started = invoke(*charProxy, GATT_CHAR_INTERFACE, "StartNotify",
+                          options);
+    recordCall(devicePath, started);
+    if (!started)
+      return report("Error enabling notifications", started.error());
+    keepNotification(devicePath, characteristicUUID, std::move(watch));
+
+    std::cout << "Notifications enabled for " << characteristicUUID
+              << std::endl;
+    return {};
+  }
+
+  Result<void> disableNotify(const std::string& characteristicUUID,
+                             const CallOptions& options = {})
+  {
+    std::string devicePath;
+    auto        charPath =
+      findCharacteristic("", characteristicUUID, devicePath, options);
+    if (!charPath)
+      return report("Error disabling notifications", charPath.error());
+
+    auto charProxy = sdbus::createProxy(*connection,
+                                        sdbus::ServiceName(BLUEZ_SERVICE),
+                                        sdbus::ObjectPath{charPath.value()});
+    auto stopped =
+      invoke(*charProxy, GATT_CHAR_INTERFACE, "StopNotify", options);
+    recordCall(devicePath, stopped);
+    dropNotification(devicePath, characteristicUUID);
+    if (!stopped)
+      return report("Error disabling notifications", stopped.error());
+
+    std::cout << "Notifications disabled for " << characteristicUUID
+              << std::endl;
+    return {};
+  }
+
+  // Delivers notifications from `uuids` on `device` (the current device if
+  // empty) to `consumer` in batches of up to `maxBatch`, each no later than
+  // `maxLatency` after its first notification. Records carry the index of
+  // their UUID in `uuids` as their handle. The consumer runs on the callback
+  // executor, in order with the device's other callbacks. Returns the
+  // subscription id, or 0 if it failed.
+  uint64_t subscribeBatches(const std::string&              device,
+                            const std::vector<std::string>& uuids,
+                            size_t                          maxBatch,
+                            std::chrono::microseconds       maxLatency,
+                            NotificationBatcher::Consumer   consumer,
+                            const CallOptions&              options = {})
+  {
+    auto subscription =
+      std::make_shared<BatchSubscription>(maxBatch, maxLatency);
+    subscription->uuids    = uuids;
+    subscription->consumer = std::make_shared<NotificationBatcher::Consumer>(
+      std::move(consumer));
+
+    std::vector<std::unique_ptr<sdbus::IProxy>> proxies;
+    std::vector<OutgoingCall>                   calls;
+    for (const std::string& uuid : uuids)
+    {
+      auto charPath =
+        findCharacteristic(device, uuid, subscription->devicePath, options);
+      if (!charPath)
+      {
+        report("Error subscribing to batches", charPath.error());
+        return 0;
+      }
+      subscription->paths.push_back(charPath.value());
+    }
+
+    // Watch before starting so the first notifications are not missed
+    for (size_t i = 0; i < subscription->paths.size(); ++i)
+    {
+      subscription->watches.push_back(watchBatch(
+        subscription.get(), subscription->paths[i], static_cast<uint32_t>(i)));
+      proxies.push_back(sdbus::createProxy(
+        *connection, sdbus::ServiceName(BLUEZ_SERVICE),
+        sdbus::ObjectPath{subscription->paths[i]}));
+      calls.push_back({proxies.back().get(),
+                       makeCall(*proxies.back(), GATT_CHAR_INTERFACE,
+                                "StartNotify")});
+    }
+
+    auto   results = awaitReplies(calls, options);
+    size_t failed  = results.size();
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      recordCall(subscription->devicePath, results[i]);
+      if (!results[i] && failed == results.size())
+        failed = i;
+    }
+
+    if (failed < results.size())
+    {
+      // Stop the characteristics that did start, or BlueZ keeps notifying
+      // with nobody consuming. Not bound by `options`, whose deadline or
+      // cancellation may be what failed the subscription.
+      std::vector<OutgoingCall> stops;
+      for (size_t i = 0; i < results.size(); ++i)
+      {
+        if (results[i])
+          stops.push_back({proxies[i].get(),
+                           makeCall(*proxies[i], GATT_CHAR_INTERFACE,
+                                    "StopNotify")});
+      }
+      for (const auto& stopped : awaitReplies(stops, CallOptions{}))
+      {
+        recordCall(subscription->devicePath, stopped);
+      }
+
+      router->retireBatches(std::move(subscription));
+      report("Error subscribing to " + uuids[failed], results[failed].error());
+      return 0;
+    }
+
+    uint64_t id;
+    {
+      std::lock_guard<std::mutex> lock(batchesMutex);
+      id          = nextBatchId++;
+      batches[id] = subscription;
+    }
+    std::cout << "Batch subscription " << id << ": " << uuids.size()
+              << " characteristics on " << subscription->devicePath
+              << ", up to " << maxBatch << " per batch, "
+              << maxLatency.count() / 1000 << " ms latency" << std::endl;
+    return id;
+  }
+
+  // Delivers what is pending and stops the subscription's notifications
+  void unsubscribeBatches(uint64_t id, const CallOptions& options = {})
+  {
+    std::shared_ptr<BatchSubscription> subscription;
+    {
+      std::lock_guard<std::mutex> lock(batchesMutex);
+      auto                        it = batches.find(id);
+      if (it == batches.end())
+      {
+        std::cout << "No batch subscription " << id << "." << std::endl;
+        return;
+      }
+      subscription = std::move(it->second);
+      batches.erase(it);
+    }
+
+    std::vector<std::unique_ptr<sdbus::IProxy>> proxies;
+    std::vector<OutgoingCall>                   calls;
+    for (const std::string& path : subscription->paths)
+    {
+      proxies.push_back(sdbus::createProxy(*connection,
+                                           sdbus::ServiceName(BLUEZ_SERVICE),
+                                           sdbus::ObjectPath{path}));
+      calls.push_back({proxies.back().get(),
+                       makeCall(*proxies.back(), GATT_CHAR_INTERFACE,
+                                "StopNotify")});
+    }
+    auto results = awaitReplies(calls, options);
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      recordCall(subscription->devicePath, results[i]);
+      if (!results[i])
+        report("Error stopping " + subscription->uuids[i], results[i].error());
+    }
+    router->retireBatches(std::move(subscription));
+    std::cout << "Batch subscription " << id << " removed." << std::endl;
+  }
+
+  Result<void> writeCharacteristic(const std::string&       characteristicUUID,
+                                   std::span<const uint8_t> data,
+                                   const CallOptions&       options = {})
+  {
+    return writeCharacteristic("", characteristicUUID, data, options);
+  }
+
+  // Writes to a characteristic of `device` (the current device if empty),
+  // connecting it through the connection cache if needed. Takes any
+  // contiguous bytes (a vector, a Payload, a buffer of the caller's) and
+  // sends them without copying.
+  Result<void> writeCharacteristic(const std::string&       device,
+                                   const std::string&       characteristicUUID,
+                                   std::span<const uint8_t> data,
+                                   const CallOptions&       options = {})
+  {
+    AllocationScope allocations(writeAllocations);
+    std::string     devicePath;
+    auto            charProxy =
+      characteristicProxy(device, characteristicUUID, devicePath, options);
+    if (!charProxy)
+      return report("Error writing characteristic", charProxy.error());
+
+    auto written = writeValue(*charProxy.value(), data, options);
+    recordCall(devicePath, written);
+    if (!written)
+      return report("Error writing characteristic", written.error());
+    rememberValue(devicePath, characteristicUUID, data);
+
+    std::cout << "Data written to characteristic " << characteristicUUID
+              << std::endl;
+    return {};
+  }
+
+  Result<std::vector<uint8_t>>
+  readCharacteristic(const std::string& characteristicUUID,
+                     const CallOptions& options = {})
+  {
+    return readCharacteristic("", characteristicUUID, options);
+  }
+
+  Result<std::vector<uint8_t>>
+  readCharacteristic(const std::string& device,
+                     const std::string& characteristicUUID,
+                     const CallOptions& options = {})
+  {
+    Payload value;
+    auto    read = readCharacteristic(device, characteristicUUID, value,
+                                      options);
+    if (!read)
+      return read.error();
+    return value.toVector();
+  }
+
+  // Reads a characteristic of `device` (the current device if empty) into
+  // `value`, connecting it through the connection cache if needed. The
+  // reply is copied straight into the payload's own storage.
+  Result<void> readCharacteristic(const std::string& device,
+                                  const std::string& characteristicUUID,
+                                  Payload&           value,
+                                  const CallOptions& options = {})
+  {
+    AllocationScope allocations(readAllocations);
+    std::string     devicePath;
+    auto            charProxy =
+      characteristicProxy(device, characteristicUUID, devicePath, options);
+    if (!charProxy)
+      return report("Error reading characteristic", charProxy.error());
+
+    auto read = readValue(*charProxy.value(), value, options);
+    recordCall(devicePath, read);
+    if (!read)
+      return report("Error reading characteristic", read.error());
+
+    rememberValue(devicePath, characteristicUUID, value);
+
+    std::cout << "Read from " << characteristicUUID << ": ";
+    printHexData(value);
+    std::cout << std::endl;
+    return {};
+  }
+
+  // Reads every readable characteristic and descriptor of `device` (the
+  // current device if empty) and saves them as JSON. The attribute tree
+  // comes from one GetManagedObjects call, and all reads are then in flight
+  // together instead of costing a round trip each.
+  Result<void> snapshotDevice(const std::string& device,
+                              const std::string& outputPath,
+                              const CallOptions& options = {})
+  {
+    using Clock = std::chrono::steady_clock;
+
+    auto         started = Clock::now();
+    std::string  devicePath;
+    GattSnapshot snapshot;
+    snapshot.taken = GattSnapshot::Clock::now();
+
+    auto connected = ensureConnected(device, devicePath, options);
+    if (!connected)
+      return report("Error taking snapshot", connected.error());
+
+    auto objectManager = sdbus::createProxy(
+      *connection, sdbus::ServiceName(BLUEZ_SERVICE), sdbus::ObjectPath{"/"});
+    auto reply = invoke(*objectManager, OBJECT_MANAGER_INTERFACE,
+                        "GetManagedObjects", options);
+    recordCall(devicePath, reply);
+    if (!reply)
+      return report("Error taking snapshot", reply.error());
+
+    std::map<sdbus::ObjectPath,
+             std::map<std::string, std::map<std::string, sdbus::Variant>>>
+      objects;
+    reply.value() >> objects;
+
+    auto text = [](const std::map<std::string, sdbus::Variant>& props,
+                   const std::string&                           key) {
+      auto it = props.find(key);
+      return it != props.end() && it->second.containsValueOfType<std::string>()
+               ? it->second.get<std::string>()
+               : std::string();
+    };
+    auto flags = [](const std::map<std::string, sdbus::Variant>& props) {
+      auto it = props.find("Flags");
+      return it != props.end() &&
+                 it->second.containsValueOfType<std::vector<std::string>>()
+               ? it->second.get<std::vector<std::string>>()
+               : std::vector<std::string>();
+    };
+    auto parent = [](const std::map<std::string, sdbus::Variant>& props,
+                     const std::string&                           key) {
+      auto it = props.find(key);
+      return it != props.end() &&
+                 it->second.containsValueOfType<sdbus::ObjectPath>()
+               ? std::string(it->second.get<sdbus::ObjectPath>())
+               : std::string();
+    };
+
+    // Object paths sort parents before children, so each attribute's owner
+    // is already in place when it is reached
+    std::map<std::string, size_t>                    serviceIndex;
+    std::map<std::string, std::pair<size_t, size_t>> charIndex;
+    std::string                                      prefix = devicePath + "/";
+    for (const auto& [path, interfaces] : objects)
+    {
+      if (path.compare(0, prefix.size(), prefix) != 0)
+        continue;
+
+      auto serviceProps    = interfaces.find(GATT_SERVICE_INTERFACE);
+      auto charProps       = interfaces.find(GATT_CHAR_INTERFACE);
+      auto descriptorProps = interfaces.find(GATT_DESCRIPTOR_INTERFACE);
+      if (serviceProps != interfaces.end())
+      {
+        serviceIndex[path] = snapshot.services.size();
+        snapshot.services.push_back(
+          {text(serviceProps->second, "UUID"), path, {}});
+      }
+      else if (charProps != interfaces.end())
+      {
+        auto service = serviceIndex.find(parent(charProps->second, "Service"));
+        if (service == serviceIndex.end())
+          continue;
+
+        SnapshotCharacteristic characteristic;
+        characteristic.uuid  = text(charProps->second, "UUID");
+        characteristic.path  = path;
+        characteristic.flags = flags(charProps->second);
+        auto& owner = snapshot.services[service->second].characteristics;
+        charIndex[path] = {service->second, owner.size()};
+        owner.push_back(std::move(characteristic));
+      }
+      else if (descriptorProps != interfaces.end())
+      {
+        auto owner =
+          charIndex.find(parent(descriptorProps->second, "Characteristic"));
+        if (owner == charIndex.end())
+          continue;
+
+        SnapshotAttribute descriptor;
+        descriptor.uuid  = text(descriptorProps->second, "UUID");
+        descriptor.path  = path;
+        descriptor.flags = flags(descriptorProps->second);
+        snapshot.services[owner->second.first]
+          .characteristics[owner->second.second]
+          .descriptors.push_back(std::move(descriptor));
+      }
+    }
+
+    // Queue a read for every readable attribute, then send them all at once
+    std::vector<SnapshotAttribute*>             targets;
+    std::vector<std::unique_ptr<sdbus::IProxy>> proxies;
+    std::vector<OutgoingCall>                   calls;
+    std::map<std::string, sdbus::Variant>       readOptions;
+    auto queue = [&](SnapshotAttribute& attribute, const std::string& iface) {
+      if (!SnapshotAttribute::readable(attribute.flags))
+        return;
+      proxies.push_back(sdbus::createProxy(*connection,
+                                           sdbus::ServiceName(BLUEZ_SERVICE),
+                                           sdbus::ObjectPath{attribute.path}));
+      calls.push_back({proxies.back().get(),
+                       makeCall(*proxies.back(), iface, "ReadValue",
+                                readOptions)});
+      targets.push_back(&attribute);
+    };
+    size_t characteristicCount = 0;
+    size_t descriptorCount     = 0;
+    for (SnapshotService& service : snapshot.services)
+    {
+      for (SnapshotCharacteristic& characteristic : service.characteristics)
+      {
+        queue(characteristic, GATT_CHAR_INTERFACE);
+        for (SnapshotAttribute& descriptor : characteristic.descriptors)
+          queue(descriptor, GATT_DESCRIPTOR_INTERFACE);
+        ++characteristicCount;
+        descriptorCount += characteristic.descriptors.size();
+      }
+    }
+
+    auto   results = awaitReplies(calls, options);
+    size_t failed  = 0;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      recordCall(devicePath, results[i]);
+      targets[i]->read = true;
+      if (results[i])
+        results[i].value() >> targets[i]->value;
+      else
+      {
+        targets[i]->error = results[i].error();
+        ++failed;
+      }
+    }
+
+    uint64_t address = 0;
+    FleetAllowlist::parseDevicePath(devicePath.c_str(), address);
+    snapshot.device  = devicePath;
+    snapshot.address = FleetAllowlist::formatAddress(address);
+    snapshot.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now() - started);
+
+    std::cout << "Snapshot of " << snapshot.services.size() << " services, "
+              << characteristicCount << " characteristics and "
+              << descriptorCount << " descriptors: " << results.size()
+              << " reads, " << failed << " failed, "
+              << snapshot.elapsed.count() << " ms." << std::endl;
+
+    std::string error;
+    if (!snapshot.writeJson(outputPath, error))
+    {
+      std::cout << "Error saving snapshot: " << error << std::endl;
+      return CallError{"org.freedesktop.DBus.Error.IOError", error};
+    }
+    std::cout << "Snapshot written to " << outputPath << std::endl;
+    return {};
+  }
+
+  // Brings `device` (the current device if empty) to `state`, writing only
+  // the values that differ from what it holds. Values already seen on this
+  // connection are taken from the cache unless `reread` is set; the rest
+  // are read concurrently. Changes are written one at a time in dependency
+  // order, stopping at the first failure. With `dryRun` nothing is written.
+  Result<void> reconcileDevice(const std::string&  device,
+                               const DesiredState& state,
+                               bool                reread,
+                               bool                dryRun,
+                               const CallOptions&  options = {})
+  {
+    using Clock = std::chrono::steady_clock;
+
+    auto                                  started = Clock::now();
+    std::string                           devicePath;
+    std::map<std::string, std::string>    paths;
+    Connection::Values                    known;
+    CurrentValues                         current;
+    std::set<std::string>                 cached;
+    std::vector<ReconcileStep>            plan;
+    std::string                           error;
+    std::map<std::string, sdbus::Variant> readOptions;
+    std::map<std::string, sdbus::Variant> writeOptions;
+    writeOptions["type"] = sdbus::Variant("request");
+
+    auto connected = ensureConnected(device, devicePath, options);
+    if (!connected)
+      return report("Error reconciling", connected.error());
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      if (const Connection* entry = connections.find(devicePath))
+      {
+        paths = entry->characteristics;
+        known = entry->values;
+      }
+    }
+
+    // Fail before writing anything if a characteristic is missing
+    for (const DesiredValue& desired : state.values)
+    {
+      if (!paths.count(desired.uuid))
+        return report("Error reconciling",
+                      CallError{ERROR_NO_CHARACTERISTIC,
+                                "Characteristic " + desired.uuid +
+                                  " not found"});
+    }
+
+    std::vector<std::string>                    reads;
+    std::vector<std::unique_ptr<sdbus::IProxy>> proxies;
+    std::vector<OutgoingCall>                   calls;
+    for (const DesiredValue& desired : state.values)
+    {
+      auto it = known.find(desired.uuid);
+      if (!reread && it != known.end())
+      {
+        current.emplace(desired.uuid, it->second);
+        cached.insert(desired.uuid);
+        continue;
+      }
+      proxies.push_back(
+        sdbus::createProxy(*connection, sdbus::ServiceName(BLUEZ_SERVICE),
+                           sdbus::ObjectPath{paths[desired.uuid]}));
+      calls.push_back({proxies.back().get(),
+                       makeCall(*proxies.back(), GATT_CHAR_INTERFACE,
+                                "ReadValue", readOptions)});
+      reads.push_back(desired.uuid);
+    }
+
+    auto results = awaitReplies(calls, options);
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      // Write-only characteristics fail here and are simply written
+      recordCall(devicePath, results[i]);
+      if (!results[i])
+      {
+        current.emplace(reads[i], results[i].error());
+        continue;
+      }
+      std::vector<uint8_t> value;
+      results[i].value() >> value;
+      rememberValue(devicePath, reads[i], value);
+      current.emplace(reads[i], std::move(value));
+    }
+
+    if (!planReconcile(state, current, cached, plan, error))
+    {
+      std::cout << "Cannot reconcile: " << error << std::endl;
+      return CallError{"org.freedesktop.DBus.Error.InvalidArgs", error};
+    }
+
+    size_t                   changed = 0;
+    std::optional<CallError> failure;
+    for (const ReconcileStep& step : plan)
+    {
+      const std::string& uuid = step.desired->uuid;
+      std::cout << "  " << uuid << ": ";
+      if (!step.needsWrite())
+      {
+        std::cout << "unchanged" << (step.cached ? " (cached)" : "")
+                  << std::endl;
+        continue;
+      }
+
+      if (step.current)
+        printHexData(*step.current);
+      else
+        std::cout << "?";
+      std::cout << " -> ";
+      printHexData(step.desired->value);
+      if (step.readError)
+        std::cout << " (unreadable: " << step.readError->name << ")";
+      if (failure)
+      {
+        std::cout << " skipped" << std::endl;
+        continue;
+      }
+      if (dryRun)
+      {
+        std::cout << std::endl;
+        ++changed;
+        continue;
+      }
+
+      auto charProxy = sdbus::createProxy(*connection,
+                                          sdbus::ServiceName(BLUEZ_SERVICE),
+                                          sdbus::ObjectPath{paths[uuid]});
+      auto written   = invoke(*charProxy, GATT_CHAR_INTERFACE, "WriteValue",
+                              options, step.desired->value, writeOptions);
+      recordCall(devicePath, written);
+      if (!written)
+      {
+        std::cout << " failed: " << written.error().name << std::endl;
+        failure = written.error();
+        continue;
+      }
+      rememberValue(devicePath, uuid, step.desired->value);
+      std::cout << std::endl;
+      ++changed;
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now() - started);
+    std::cout << changed << " of " << plan.size() << " values "
+              << (dryRun ? "would be written" : "written") << ", "
+              << calls.size() << " read, " << cached.size()
+              << " from cache, " << elapsed.count() << " ms." << std::endl;
+    if (failure)
+      return report("Error reconciling", *failure);
+    return {};
+  }
+
+  // Reads `characteristicUUID` on `device` (the current device if empty)
+  // every `interval` from the poll thread. Values go through the same path
+  // as notifications; polls are skipped while the device is disconnected.
+  void addPoll(const std::string&        device,
+               const std::string&        characteristicUUID,
+               std::chrono::milliseconds interval)
+  {
+    Uuid128     uuid;
+    std::string devicePath = resolveDevicePath(device);
+    if (!Uuid128::parse(characteristicUUID, uuid))
+    {
+      std::cout << "Invalid UUID '" << characteristicUUID << "'" << std::endl;
+      return;
+    }
+    if (devicePath.empty())
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      if (connections.mostRecent())
+        devicePath = connections.mostRecent()->path;
+    }
+    if (devicePath.empty() || devicePath.front() != '/')
+    {
+      std::cout << "Unknown device." << std::endl;
+      return;
+    }
+
+    PollScheduler::Id id;
+    {
+      std::lock_guard<std::mutex> lock(pollMutex);
+      id = polls.add(devicePath, uuid.toString(), interval,
+                     PollScheduler::Clock::now());
+      if (!polling)
+      {
+        polling    = true;
+        pollThread = std::thread([this] {
+          pthread_setname_np(pthread_self(), "poll");
+          pollLoop();
+        });
+      }
+    }
+    pollWakeup.notify_one();
+    std::cout << "Poll " << id << ": " << uuid.toString() << " on "
+              << devicePath << " every " << interval.count() << " ms"
+              << std::endl;
+  }
+
+  void removePoll(PollScheduler::Id id)
+  {
+    std::unique_ptr<sdbus::IProxy> proxy;
+    {
+      std::lock_guard<std::mutex> lock(pollMutex);
+      if (!polls.remove(id))
+      {
+        std::cout << "No poll " << id << "." << std::endl;
+        return;
+      }
+      auto it = pollProxies.find(id);
+      if (it != pollProxies.end())
+      {
+        proxy = std::move(it->second);
+        pollProxies.erase(it);
+      }
+    }
+    std::cout << "Poll " << id << " removed." << std::endl;
+  }
+
+  void listPolls()
+  {
+    std::lock_guard<std::mutex> lock(pollMutex);
+    std::cout << "\n=== Polls (" << polls.all().size() << ") ===" << std::endl;
+    for (const auto& [id, entry] : polls.all())
+    {
+      std::cout << std::setw(5) << id << "  " << entry.device << "  "
+                << entry.uuid << "  every " << entry.interval.count()
+                << " ms, " << entry.polls << " polls, " << entry.skipped
+                << " skipped, " << entry.failures << " failed"
+                << (entry.inFlight ? ", reading" : "") << std::endl;
+    }
+  }
+
+  // A non-zero `slack` lets the background threads' timers run late by up
+  // to that much and lines their deadlines up, so an idle gateway wakes
+  // only for bus traffic. Zero restores precise timing. Slack above
+  // IdleMode::MAX_SLACK is clamped.
+  bool setIdleMode(std::chrono::milliseconds slack)
+  {
+    if (slack.count() < 0)
+    {
+      std::cout << "Timer slack cannot be negative." << std::endl;
+      return false;
+    }
+    if (slack > IdleMode::MAX_SLACK)
+    {
+      std::cout << "Timer slack limited to " << IdleMode::MAX_SLACK.count()
+                << " ms." << std::endl;
+      slack = IdleMode::MAX_SLACK;
+    }
+
+    int64_t applied = idleMode.slack().count();
+    idleMode.set(slack);
+    idleMode.applyToThread(applied);
+    maintenanceWakeup.notify_all();
+    pollWakeup.notify_all();
+    if (busLoop)
+      busLoop->post([] {});
+    if (slack.count() > 0)
+      std::cout << "Idle mode on, timer slack " << slack.count() << " ms."
+                << std::endl;
+    else
+      std::cout << "Idle mode off." << std::endl;
+    return true;
+  }
+
+  // Samples every thread's wakeups over `duration`
+  void measureWakeups(std::chrono::seconds     duration,
+                      const CancellationToken& token)
+  {
+    WakeupMeter meter;
+    std::cout << "Measuring for " << duration.count() << " seconds..."
+              << std::endl;
+    meter.start();
+    sleepUnlessCancelled(token, duration);
+    auto threads = meter.stop();
+    std::sort(threads.begin(), threads.end(),
+              [](const ThreadWakeups& a, const ThreadWakeups& b) {
+                return a.wakeups > b.wakeups;
+              });
+
+    auto rate = [](double perSecond) {
+      std::ostringstream text;
+      text << std::setw(8) << std::fixed << std::setprecision(2) << perSecond;
+      return text.str();
+    };
+
+    double total = 0;
+    std::cout << "\n=== Wakeups per second ===" << std::endl;
+    for (const ThreadWakeups& thread : threads)
+    {
+      std::cout << rate(thread.perSecond) << "  " << thread.name << " ("
+                << thread.tid << ")" << std::endl;
+      total += thread.perSecond;
+    }
+    std::cout << rate(total) << "  total, idle mode "
+              << (idleMode.enabled() ? "on" : "off") << std::endl;
+  }
+
+  // Connects every listed device, subscribes to `notifyUuid`, writes
+  // `value` to `writeUuid`, reads `readUuid`, waits for a notification and
+  // disconnects. Each device is a coroutine on the event loop thread, so
+  // all of them are in progress at once without a thread apiece. Each step
+  // gets its own `timeout`.
+  void runWorkflows(const std::vector<std::string>& fleet,
+                    const std::string&              notifyUuid,
+                    const std::string&              writeUuid,
+                    const std::vector<uint8_t>&     value,
+                    const std::string&              readUuid,
+                    std::chrono::milliseconds       timeout,
+                    const CancellationToken&        token)
+  {
+    auto run        = std::make_shared<WorkflowRun>();
+    run->notifyUuid = notifyUuid;
+    run->writeUuid  = writeUuid;
+    run->readUuid   = readUuid;
+    run->value      = value;
+    run->timeout    = timeout.count() > 0 ? timeout : SERVICES_RESOLVE_TIMEOUT;
+    run->outcomes.resize(fleet.size());
+
+    std::vector<size_t> started;
+    for (size_t i = 0; i < fleet.size(); ++i)
+    {
+      WorkflowOutcome& outcome = run->outcomes[i];
+      outcome.device           = resolveDevicePath(fleet[i]);
+      if (outcome.device.empty() || outcome.device.front() != '/')
+      {
+        outcome.device = fleet[i];
+        outcome.error  = CallError{"org.bluez.Error.DoesNotExist",
+                                  "Device has not been discovered"};
+        continue;
+      }
+      started.push_back(i);
+    }
+    run->remaining = started.size();
+
+    std::cout << "Running " << started.size() << " workflows..." << std::endl;
+    auto begun = std::chrono::steady_clock::now();
+    busLoop->post([this, run, started] {
+      for (size_t i : started)
+        spawn(deviceWorkflow(run, i));
+    });
+
+    auto registration = token.subscribe([run] {
+      std::lock_guard<std::mutex> lock(run->mutex);
+      run->finished.notify_all();
+    });
+    std::unique_lock<std::mutex> lock(run->mutex);
+    run->finished.wait(
+      lock, [&] { return run->remaining == 0 || token.cancelled(); });
+    if (run->remaining > 0)
+    {
+      std::cout << "Cancelled; " << run->remaining
+                << " workflows finish in the background." << std::endl;
+      return;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - begun);
+
+    size_t succeeded = 0;
+    for (const WorkflowOutcome& outcome : run->outcomes)
+    {
+      std::cout << "[WORKFLOW] " << outcome.device << ": ";
+      if (outcome.error)
+      {
+        std::cout << "failed at " << outcome.stage << " ("
+                  << outcome.error->name << ": " << outcome.error->message
+                  << ")";
+      }
+      else
+      {
+        std::cout << "read ";
+        printHexData(outcome.read);
+        std::cout << ", notified ";
+        printHexData(outcome.notified);
+        ++succeeded;
+      }
+      std::cout << ", " << outcome.elapsed.count() << " ms" << std::endl;
+    }
+    std::cout << succeeded << " of " << fleet.size()
+              << " workflows completed in " << elapsed.count() << " ms."
+              << std::endl;
+  }
+
+  void showCallbackStats()
+  {
+    ExecutorStats stats = callbacks->stats();
+    std::cout << "\n=== Callback Executor ===" << std::endl;
+    std::cout << "Worker threads:   " << stats.threads << std::endl;
+    std::cout << "Tasks run:        " << stats.executed << std::endl;
+    std::cout << "Tasks stolen:     " << stats.stolen << std::endl;
+    std::cout << "Active strands:   " << stats.strands << std::endl;
+  }
+
+  // Heap allocations so far, in total and charged to each tag. Only what
+  // goes through operator new is seen; libsystemd's own mallocs are not.
+  void showAllocations()
+  {
+    if (!AllocationTracker::enabled)
+    {
+      std::cout << "Allocation tracking is not built in; configure with "
+                   "-DBUILD_WITH_ALLOC_TRACKING=ON."
+                << std::endl;
+      return;
+    }
+
+    AllocationCounts total = AllocationTracker::total();
+    std::cout << "\n=== Heap Allocations ===" << std::endl;
+    std::cout << std::left << std::setw(20) << "Tag" << std::right
+              << std::setw(12) << "Allocations" << std::setw(14) << "Bytes"
+              << std::endl;
+    std::cout << std::left << std::setw(20) << "(all)" << std::right
+              << std::setw(12) << total.allocations << std::setw(14)
+              << total.bytes << std::endl;
+    AllocationTag::forEach([](const AllocationTag& tag) {
+      AllocationCounts counts = tag.counts();
+      std::string      name   = tag.parent() ? "  " : "";
+      std::cout << std::left << std::setw(20) << name + tag.name()
+                << std::right << std::setw(12) << counts.allocations
+                << std::setw(14) << counts.bytes << std::endl;
+    });
+    std::cout << "Frees: " << total.frees << ", live: "
+              << total.allocations - total.frees << std::endl;
+  }
+
+  // Checks on the event loop thread that, once warmed up, the notification
+  // and batch handlers and the callbacks they hand off to allocate nothing;
+  // see NotificationRouter::checkAllocations(). The allocation test checks
+  // the same without BlueZ.
+  //
+  // If `writeUuid` is given, blocking writes to that characteristic of the
+  // current device are measured as well. They are reported, not checked:
+  // sdbus-c++ allocates its own state for each pending call, on top of the
+  // lookups writeCharacteristic() makes. writeValue() itself is checked by
+  // the allocation test, against a stub proxy.
+  bool checkAllocations(const std::string& writeUuid)
+  {
+    if (!AllocationTracker::enabled)
+    {
+      std::cout << "Allocation tracking is not built in; configure with "
+                   "-DBUILD_WITH_ALLOC_TRACKING=ON."
+                << std::endl;
+      return false;
+    }
+
+    std::cout << "\n=== Notification Path Allocations ===" << std::endl;
+    std::promise<bool> checked;
+    auto               result = checked.get_future();
+    busLoop->post([this, &checked] {
+      checked.set_value(router->checkAllocations(*connection, std::cout));
+    });
+    bool passed = result.get();
+    std::cout << (passed ? "Notification paths allocate nothing."
+                         : "Notification paths allocate.")
+              << std::endl;
+
+    if (writeUuid.empty())
+      return passed;
+
+    const size_t         WRITES = 16;
+    std::vector<uint8_t> data(20, 0x5a);
+    if (!writeCharacteristic(writeUuid, data))
+      return passed;
+    AllocationCounts before  = writeAllocations.counts();
+    size_t           written = 0;
+    for (size_t i = 0; i < WRITES; ++i)
+    {
+      if (writeCharacteristic(writeUuid, data))
+        ++written;
+    }
+    AllocationCounts after = writeAllocations.counts();
+    if (written > 0)
+    {
+      std::cout << "Blocking write: "
+                << (after.allocations - before.allocations) / written
+                << " allocations, " << (after.bytes - before.bytes) / written
+                << " bytes per call (not checked)" << std::endl;
+    }
+    return passed;
+  }
+
+  static void printHexData(std::span<const uint8_t> data,
+                           std::ostream&            out = std::cout)
+  {
+    std::string text;
+    appendHexData(text, data);
+    out << text;
+  }
+
+  // Runs the event loop on a thread of our own rather than sdbus-c++'s, so
+  // coroutines can share it
+  void processEvents()
+  {
+    busLoop   = std::make_unique<BusLoop>(*connection, idleMode);
+    router    = std::make_unique<NotificationRouter>(
+      *callbacks, *busLoop,
+      [this](const std::string&       devicePath,
+             const std::string&       uuid,
+             std::span<const uint8_t> value) {
+        rememberValue(devicePath, uuid, value);
+      });
+    asyncBle  = std::make_unique<AsyncBle>(*connection, *busLoop);
+    busThread = std::thread([this] {
+      pthread_setname_np(pthread_self(), "dbus");
+      busLoop->run();
+    });
+  }
+
+  void listChanges(uint64_t sinceGeneration)
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    DeviceDelta                 delta = devices.changesSince(sinceGeneration);
+
+    std::cout << "\n=== Device Changes (generation " << delta.fromGeneration
+              << " -> " << delta.toGeneration << ") ===" << std::endl;
+
+    if (delta.resync)
+    {
+      std::cout << "Change log no longer covers generation "
+                << delta.fromGeneration << "; listing all devices."
+                << std::endl;
+    }
+
+    auto printChange = [this](char marker, const std::string& path) {
+      std::cout << marker << " " << path;
+      if (const DeviceRecord* device = devices.find(path))
+      {
+        std::cout << " " << device->name << " [" << device->address
+                  << "] gen " << device->generation;
+      }
       std::cout << std::endl;
+    };
+
+    for (const auto& path : delta.added)
+      printChange('+', path);
+    for (const auto& path : delta.updated)
+      printChange('*', path);
+    for (const auto& path : delta.removed)
+      printChange('-', path);
+
+    if (delta.added.empty() && delta.updated.empty() && delta.removed.empty())
+    {
+      std::cout << "No changes." << std::endl;
+    }
+  }
+
+  std::string getConnectedDevice()
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    const Connection*           current = connections.mostRecent();
+    return current ? current->path : std::string();
+  }
+  // Not synchronized with continuous scanning; prefer changesSince()
+  const std::map<std::string, DeviceRecord>& getDevices() const
+  {
+    return devices.all();
+  }
+  uint64_t getGeneration()
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    return devices.generation();
+  }
+  DeviceDelta changesSince(uint64_t generation)
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    return devices.changesSince(generation);
+  }
+
+private:
+  static std::string describeLimit(size_t value, const char* unit)
+  {
+    return value == 0 ? std::string("unlimited") + unit
+                      : std::to_string(value) + unit;
+  }
+
+  static bool isPinned(const DeviceRecord& device)
+  {
+    return device.connected || device.paired;
+  }
+
+  void subscribeDeviceSignals()
+  {
+    const std::string sender = "type='signal',sender='" + BLUEZ_SERVICE + "',";
+
+    scanSlots.push_back(connection->addMatch(
+      sender + "interface='" + OBJECT_MANAGER_INTERFACE +
+        "',member='InterfacesAdded'",
+      [this](sdbus::Message msg) {
+        sdbus::ObjectPath path;
+        msg >> path;
+        if (!admitted(path.c_str()))
+          return;
+
+        std::map<std::string, std::map<std::string, sdbus::Variant>>
+          interfaces;
+        msg >> interfaces;
+
+        auto it = interfaces.find(DEVICE_INTERFACE);
+        if (it != interfaces.end())
+          onDeviceAdded(path, it->second);
+      },
+      sdbus::return_slot));
+
+    scanSlots.push_back(connection->addMatch(
+      sender + "interface='" + OBJECT_MANAGER_INTERFACE +
+        "',member='InterfacesRemoved'",
+      [this](sdbus::Message msg) {
+        sdbus::ObjectPath        path;
+        std::vector<std::string> interfaces;
+        msg >> path >> interfaces;
+
+        if (std::find(interfaces.begin(), interfaces.end(),
+                      DEVICE_INTERFACE) != interfaces.end())
+        {
+          std::lock_guard<std::mutex> lock(devicesMutex);
+          devices.erase(path);
+          advertisements.forget(path);
+        }
+      },
+      sdbus::return_slot));
+
+    scanSlots.push_back(connection->addMatch(
+      sender + "interface='" + PROPERTIES_INTERFACE +
+        "',member='PropertiesChanged',arg0='" + DEVICE_INTERFACE + "'",
+      [this](sdbus::Message msg) {
+        if (!admitted(msg.getPath()))
+          return;
+
+        std::string                           interface;
+        std::map<std::string, sdbus::Variant> changed;
+        std::vector<std::string>              invalidated;
+        msg >> interface >> changed >> invalidated;
+
+        onDeviceUpdate(msg.getPath(), changed, invalidated);
+      },
+      sdbus::return_slot));
+  }
+
+  // Resolves `device` (the current device if empty) and reconnects it if it
+  // is not in the cache. On success the caller owns a call against
+  // `devicePath` and must report its outcome with recordCall().
+  Result<void> ensureConnected(const std::string& device,
+                               std::string&       devicePath,
+                               const CallOptions& options)
+  {
+    devicePath = resolveDevicePath(device);
+    bool cached;
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      auto                        now = Connection::Clock::now();
+      if (devicePath.empty() && connections.mostRecent())
+        devicePath = connections.mostRecent()->path;
+      cached = !devicePath.empty() && connections.use(devicePath, now);
+    }
+
+    if (devicePath.empty())
+      return CallError{ERROR_NOT_CONNECTED, "No device connected"};
+
+    auto admitted = admitCall(devicePath);
+    if (!admitted)
+      return admitted.error();
+    if (!cached)
+      return openConnection(devicePath, options);
+    return {};
+  }
+
+  // Resolves a characteristic UUID on `device` (the current device if empty)
+  // to its object path, connecting as ensureConnected() does
+  Result<std::string> findCharacteristic(const std::string& device,
+                                         const std::string& characteristicUUID,
+                                         std::string&       devicePath,
+                                         const CallOptions& options)
+  {
+    auto connected = ensureConnected(device, devicePath, options);
+    if (!connected)
+      return connected.error();
+
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    const Connection*           entry = connections.find(devicePath);
+    if (entry)
+    {
+      auto it = entry->characteristics.find(characteristicUUID);
+      if (it != entry->characteristics.end())
+        return it->second;
+    }
+    health.record(devicePath, CallOutcome::Ignored, DeviceHealth::Clock::now());
+    return CallError{ERROR_NO_CHARACTERISTIC,
+                     "Characteristic " + characteristicUUID + " not found"};
+  }
+
+  // Like findCharacteristic(), but returns a proxy for the characteristic.
+  // Proxies are kept on the cached connection, so repeated reads and writes
+  // do not create one per call.
+  Result<std::shared_ptr<sdbus::IProxy>>
+  characteristicProxy(const std::string& device,
+                      const std::string& characteristicUUID,
+                      std::string&       devicePath,
+                      const CallOptions& options)
+  {
+    auto connected = ensureConnected(device, devicePath, options);
+    if (!connected)
+      return connected.error();
+
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    Connection*                 entry = connections.find(devicePath);
+    if (entry)
+    {
+      auto it = entry->characteristics.find(characteristicUUID);
+      if (it != entry->characteristics.end())
+      {
+        auto& proxy = entry->proxies[characteristicUUID];
+        if (!proxy)
+          proxy = sdbus::createProxy(*connection,
+                                     sdbus::ServiceName(BLUEZ_SERVICE),
+                                     sdbus::ObjectPath{it->second});
+        return proxy;
+      }
+    }
+    health.record(devicePath, CallOutcome::Ignored, DeviceHealth::Clock::now());
+    return CallError{ERROR_NO_CHARACTERISTIC,
+                     "Characteristic " + characteristicUUID + " not found"};
+  }
+
+  template <typename... Args>
+  static sdbus::MethodCall makeCall(sdbus::IProxy&     proxy,
+                                    const std::string& interface,
+                                    const std::string& method,
+                                    const Args&... args)
+  {
+    auto call = proxy.createMethodCall(sdbus::InterfaceName(interface),
+                                       sdbus::MethodName(method));
+    ((call << args), ...);
+    return call;
+  }
+
+  // Calls a BlueZ method through awaitReply(), so it honours the deadline
+  // and cancellation token in `options`
+  template <typename... Args>
+  Result<sdbus::MethodReply> invoke(sdbus::IProxy&     proxy,
+                                    const std::string& interface,
+                                    const std::string& method,
+                                    const CallOptions& options,
+                                    const Args&... args)
+  {
+    return awaitReply(proxy, makeCall(proxy, interface, method, args...),
+                      options);
+  }
+
+  // ATT MTU of the link a characteristic is on, or the minimum of 23 if
+  // BlueZ is too old to report it
+  size_t attMtu(sdbus::IProxy& charProxy, const CallOptions& options)
+  {
+    auto reply = invoke(charProxy, PROPERTIES_INTERFACE, "Get", options,
+                        GATT_CHAR_INTERFACE, "MTU");
+    sdbus::Variant mtu;
+    if (reply)
+      reply.value() >> mtu;
+    if (mtu.containsValueOfType<uint16_t>() && mtu.get<uint16_t>() > 23)
+      return mtu.get<uint16_t>();
+    return 23;
+  }
+
+  // Time until an open circuit breaker lets a probe call through
+  std::chrono::milliseconds breakerRetryIn(const std::string& devicePath)
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    const DeviceBreaker*        breaker = health.find(devicePath);
+    auto                        now     = DeviceHealth::Clock::now();
+    if (!breaker || breaker->state != BreakerState::Open ||
+        breaker->retryAt <= now)
+      return std::chrono::milliseconds(0);
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+      breaker->retryAt - now);
+  }
+
+  // Fails fast if the device's circuit breaker is open
+  Result<void> admitCall(const std::string& devicePath)
+  {
+    std::chrono::milliseconds retryIn(0);
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      if (health.allow(devicePath, DeviceHealth::Clock::now(), retryIn))
+        return {};
+    }
+    return CallError{ERROR_CIRCUIT_OPEN,
+                     "Device " + devicePath +
+                       " is unreachable; next probe in " +
+                       std::to_string((retryIn.count() + 999) / 1000) + " s"};
+  }
+
+  void recordCall(const std::string& devicePath,
+                  CallOutcome        outcome,
+                  const std::string& error = std::string())
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    health.record(devicePath, outcome, DeviceHealth::Clock::now(), error);
+  }
+
+  template <typename T>
+  void recordCall(const std::string& devicePath, const Result<T>& result)
+  {
+    if (result)
+      recordCall(devicePath, CallOutcome::Success);
+    else
+      recordCall(devicePath,
+                 DeviceHealth::classify(result.error().name,
+                                        result.error().message),
+                 result.error().name);
+  }
+
+  // Prints a failed operation with its D-Bus error name and passes the error
+  // on to the caller
+  static CallError report(const std::string& what, const CallError& error)
+  {
+    std::cerr << what << ": " << error.name << ": " << error.message
+              << std::endl;
+    return error;
+  }
+
+  // Progress of a connect, as reported by Device1 PropertiesChanged
+  struct LinkProgress
+  {
+    std::mutex              mutex;
+    std::condition_variable changed;
+    bool                    resolved = false;
+    bool                    lost     = false;
+  };
+
+  // Marks a cached connection down as soon as BlueZ reports it disconnected,
+  // so the next operation reconnects instead of failing, and tells a pending
+  // connect when the device's services have been resolved
+  sdbus::Slot watchConnection(const std::string&            devicePath,
+                              std::shared_ptr<LinkProgress> progress)
+  {
+    return connection->addMatch(
+      "type='signal',sender='" + BLUEZ_SERVICE + "',path='" + devicePath +
+        "',interface='" + PROPERTIES_INTERFACE +
+        "',member='PropertiesChanged',arg0='" + DEVICE_INTERFACE + "'",
+      [this, devicePath, progress](sdbus::Message msg) {
+        std::string                           interface;
+        std::map<std::string, sdbus::Variant> changed;
+        msg >> interface >> changed;
+
+        auto it = changed.find("Connected");
+        if (it != changed.end() && it->second.containsValueOfType<bool>() &&
+            !it->second.get<bool>())
+        {
+          {
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+            connections.markDown(devicePath);
+          }
+          std::lock_guard<std::mutex> lock(progress->mutex);
+          progress->lost = true;
+          progress->changed.notify_all();
+        }
+
+        it = changed.find("ServicesResolved");
+        if (it != changed.end() && it->second.containsValueOfType<bool>() &&
+            it->second.get<bool>())
+        {
+          std::lock_guard<std::mutex> lock(progress->mutex);
+          progress->resolved = true;
+          progress->changed.notify_all();
+        }
+      },
+      sdbus::return_slot);
+  }
+
+  // Delivers value notifications from a characteristic for as long as the
+  // returned slot lives
+  sdbus::Slot watchNotifications(const std::string& devicePath,
+                                 const std::string& charPath,
+                                 const std::string& uuid)
+  {
+    return connection->addMatch(
+      "type='signal',sender='" + BLUEZ_SERVICE + "',path='" + charPath +
+        "',interface='" + PROPERTIES_INTERFACE +
+        "',member='PropertiesChanged',arg0='" + GATT_CHAR_INTERFACE + "'",
+      [this, devicePath, name = router->internUuid(uuid)](sdbus::Message msg) {
+        router->onNotification(devicePath, name, msg);
+      },
+      sdbus::return_slot);
+  }
+
+  // Adds each notification to the subscription's batch
+  sdbus::Slot watchBatch(BatchSubscription* subscription,
+                         const std::string& charPath,
+                         uint32_t           handle)
+  {
+    return connection->addMatch(
+      "type='signal',sender='" + BLUEZ_SERVICE + "',path='" + charPath +
+        "',interface='" + PROPERTIES_INTERFACE +
+        "',member='PropertiesChanged',arg0='" + GATT_CHAR_INTERFACE + "'",
+      [this, subscription, handle](sdbus::Message msg) {
+        router->onBatchNotification(subscription, handle, msg);
+      },
+      sdbus::return_slot);
+  }
+
+  // Ties a notification subscription to the device's cached connection, so
+  // it lasts until the device is disconnected. A replaced subscription is
+  // released outside connectionsMutex, when `watch` goes out of scope.
+  void keepNotification(const std::string& devicePath,
+                        const std::string& uuid,
+                        sdbus::Slot        watch)
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    if (Connection* entry = connections.find(devicePath))
+      std::swap(entry->notifications[uuid], watch);
+  }
+
+  // Last known value of a characteristic, kept for as long as the device
+  // stays in the connection cache. The cached vector is reused, so once it
+  // has held a value this long, updating it allocates nothing.
+  void rememberValue(const std::string&       devicePath,
+                     const std::string&       uuid,
+                     std::span<const uint8_t> value)
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    if (Connection* entry = connections.find(devicePath))
+      entry->values[uuid].assign(value.begin(), value.end());
+  }
+
+  void dropNotification(const std::string& devicePath,
+                        const std::string& uuid)
+  {
+    sdbus::Slot released;
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      Connection* entry = connections.find(devicePath);
+      if (!entry)
+        return;
+      auto it = entry->notifications.find(uuid);
+      if (it == entry->notifications.end())
+        return;
+      released = std::move(it->second);
+      entry->notifications.erase(it);
+    }
+  }
+
+  // Disconnects a connection already removed from the cache. Its signal
+  // slots are released here, outside connectionsMutex.
+  Result<void> closeConnection(Connection&        entry,
+                               const CallOptions& options = {})
+  {
+    entry.notifications.clear();
+    entry.proxies.clear();
+    entry.watch.reset();
+    if (!entry.linkUp)
+      return {};
+
+    auto deviceProxy = sdbus::createProxy(*connection,
+                                          sdbus::ServiceName(BLUEZ_SERVICE),
+                                          sdbus::ObjectPath{entry.path});
+    auto reply = invoke(*deviceProxy, DEVICE_INTERFACE, "Disconnect", options);
+    if (!reply)
+      return reply.error();
+    return {};
+  }
+
+  // Establishes a new connection and adds it to the cache, replacing a
+  // stale entry for the device. The least recently used entry is evicted
+  // only once the new link is up, so a failed connect leaves the cached
+  // links as they were.
+  Result<void> openConnection(const std::string& devicePath,
+                              const CallOptions& options)
+  {
+    Connection stale;
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      connections.take(devicePath, stale);
+    }
+
+    auto deviceProxy = sdbus::createProxy(*connection,
+                                          sdbus::ServiceName(BLUEZ_SERVICE),
+                                          sdbus::ObjectPath{devicePath});
+
+    // Watch before connecting, so ServicesResolved cannot be missed
+    auto       started  = Connection::Clock::now();
+    auto       progress = std::make_shared<LinkProgress>();
+    Connection entry;
+    entry.path  = devicePath;
+    entry.watch = watchConnection(devicePath, progress);
+
+    std::cout << "Connecting to device..." << std::endl;
+    auto connected = callConnect(*deviceProxy, options);
+    if (!connected)
+    {
+      recordCall(devicePath, connected);
+      return connected.error();
+    }
+
+    // Services may already have been resolved from BlueZ's cache
+    auto reply = invoke(*deviceProxy, PROPERTIES_INTERFACE, "Get", options,
+                        DEVICE_INTERFACE, "ServicesResolved");
+    if (reply)
+    {
+      sdbus::Variant resolvedVar;
+      reply.value() >> resolvedVar;
+      if (resolvedVar.containsValueOfType<bool>() && resolvedVar.get<bool>())
+      {
+        std::lock_guard<std::mutex> lock(progress->mutex);
+        progress->resolved = true;
+      }
+    }
+
+    auto resolved = reply ? awaitServicesResolved(*progress, options)
+                          : Result<void>(reply.error());
+    recordCall(devicePath, resolved);
+    if (!resolved)
+    {
+      closeConnection(entry);
+      return resolved.error();
+    }
+    std::cout << "Successfully connected!" << std::endl;
+
+    // Only a fully discovered device is cached; one without its
+    // characteristics would fail every operation instead of reconnecting
+    auto discovered =
+      discoverServices(devicePath, entry.characteristics, options);
+    if (!discovered)
+    {
+      closeConnection(entry);
+      return discovered.error();
+    }
+
+    entry.connectedAt = Connection::Clock::now();
+    entry.lastUsed    = entry.connectedAt;
+    Connection victim;
+    bool       evicting = false;
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      if (connections.full())
+        evicting = connections.takeLeastRecent(victim);
+      connections.insert(std::move(entry));
+    }
+
+    if (evicting)
+    {
+      std::cout << "Connection cache full; disconnecting least recently used "
+                << victim.path << std::endl;
+      // Not bound by the caller's deadline, which the connect has used up
+      auto closed = closeConnection(victim);
+      if (!closed)
+        report("Disconnect error", closed.error());
+    }
+
+    applyProfile(devicePath, options);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Connection::Clock::now() - started);
+    std::cout << "Device ready in " << elapsed.count() << " ms." << std::endl;
+    return {};
+  }
+
+  // Waits for the watch set up by openConnection() to see ServicesResolved
+  Result<void> awaitServicesResolved(LinkProgress&      progress,
+                                     const CallOptions& options)
+  {
+    auto deadline = options.deadline.value_or(CallOptions::Clock::now() +
+                                              SERVICES_RESOLVE_TIMEOUT);
+    auto registration = options.token.subscribe([&progress] {
+      std::lock_guard<std::mutex> lock(progress.mutex);
+      progress.changed.notify_all();
+    });
+
+    std::unique_lock<std::mutex> lock(progress.mutex);
+    progress.changed.wait_until(lock, deadline, [&] {
+      return progress.resolved || progress.lost || options.token.cancelled();
+    });
+    if (progress.resolved)
+      return {};
+    if (progress.lost)
+      return CallError{ERROR_CONNECT_FAILED,
+                       "Link lost before services were resolved"};
+    if (options.token.cancelled())
+      return CallError{CALL_CANCELLED, "Call cancelled"};
+    return CallError{CALL_TIMED_OUT, "Services were not resolved in time"};
+  }
+
+  struct WorkflowOutcome
+  {
+    std::string               device;
+    const char*               stage = "connect"; // last step attempted
+    std::optional<CallError>  error;
+    Payload                   read;
+    Payload                   notified;
+    std::chrono::milliseconds elapsed{0};
+  };
+
+  // Shared by runWorkflows() and the coroutines it starts, which may
+  // outlive it if it is cancelled
+  struct WorkflowRun
+  {
+    std::string                  notifyUuid;
+    std::string                  writeUuid;
+    std::string                  readUuid;
+    std::vector<uint8_t>         value;
+    std::chrono::milliseconds    timeout{0};
+    std::mutex                   mutex;
+    std::condition_variable      finished;
+    size_t                       remaining = 0;
+    std::vector<WorkflowOutcome> outcomes;
+  };
+
+  Task<Result<void>> workflowSteps(const WorkflowRun& run,
+                                   WorkflowOutcome&   outcome)
+  {
+    const std::string& device   = outcome.device;
+    auto               deadline = [&] {
+      return AsyncBle::Clock::now() + run.timeout;
+    };
+
+    auto connected = co_await asyncBle->connect(device, deadline());
+    if (!connected)
+      co_return connected;
+
+    outcome.stage   = "subscribe";
+    auto subscribed = co_await asyncBle->startNotify(device, run.notifyUuid,
+                                                     deadline());
+    if (!subscribed)
+      co_return subscribed;
+
+    outcome.stage = "write";
+    auto written  = co_await asyncBle->write(device, run.writeUuid,
+                                            Payload(run.value), deadline());
+    if (!written)
+      co_return written;
+
+    outcome.stage = "read";
+    auto read     = co_await asyncBle->read(device, run.readUuid, deadline());
+    if (!read)
+      co_return read.error();
+    outcome.read = std::move(read.value());
+
+    outcome.stage = "notification";
+    auto notified = co_await asyncBle->nextNotification(
+      device, run.notifyUuid, deadline());
+    if (!notified)
+      co_return notified.error();
+    outcome.notified = std::move(notified.value());
+    co_return Result<void>();
+  }
+
+  // One device of runWorkflows(), on the event loop thread
+  Task<void> deviceWorkflow(std::shared_ptr<WorkflowRun> run, size_t index)
+  {
+    WorkflowOutcome outcome;
+    auto            started = AsyncBle::Clock::now();
+    {
+      std::lock_guard<std::mutex> lock(run->mutex);
+      outcome.device = run->outcomes[index].device;
+    }
+
+    auto result = co_await workflowSteps(*run, outcome);
+    if (!result)
+      outcome.error = result.error();
+    // A failed connect() has already disconnected the device
+    if (outcome.stage != std::string("connect") || result)
+    {
+      auto disconnected = co_await asyncBle->disconnect(
+        outcome.device, AsyncBle::Clock::now() + run->timeout);
+      if (!disconnected && !outcome.error)
+      {
+        outcome.stage = "disconnect";
+        outcome.error = disconnected.error();
+      }
+    }
+    outcome.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      AsyncBle::Clock::now() - started);
+
+    std::lock_guard<std::mutex> lock(run->mutex);
+    run->outcomes[index] = std::move(outcome);
+    if (--run->remaining == 0)
+      run->finished.notify_all();
+  }
+
+  // Subscribes to and reads the characteristics named in the device's
+  // connection profile. All StartNotify and ReadValue calls are in flight
+  // at once, so bringing a device up costs one round trip however many
+  // characteristics its profile lists.
+  void applyProfile(const std::string& devicePath, const CallOptions& options)
+  {
+    uint64_t address = 0;
+    FleetAllowlist::parseDevicePath(devicePath.c_str(), address);
+
+    ConnectionProfile                  profile;
+    std::map<std::string, std::string> characteristics;
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      const ConnectionProfile*    found = profiles.find(address);
+      const Connection*           entry = connections.find(devicePath);
+      if (!found || !entry || found->empty())
+        return;
+      profile         = *found;
+      characteristics = entry->characteristics;
+    }
+
+    std::vector<std::unique_ptr<sdbus::IProxy>> proxies;
+    std::vector<OutgoingCall>                   calls;
+    std::vector<std::string>                    uuids;
+    std::vector<sdbus::Slot>                    watches; // one per subscribe
+    auto addCall = [&](const std::string& uuid) -> sdbus::IProxy* {
+      auto it = characteristics.find(uuid);
+      if (it == characteristics.end())
+      {
+        std::cout << "   " << uuid << ": not found" << std::endl;
+        return nullptr;
+      }
+      proxies.push_back(sdbus::createProxy(*connection,
+                                           sdbus::ServiceName(BLUEZ_SERVICE),
+                                           sdbus::ObjectPath{it->second}));
+      uuids.push_back(uuid);
+      return proxies.back().get();
+    };
+
+    for (const std::string& uuid : profile.subscribe)
+    {
+      if (sdbus::IProxy* proxy = addCall(uuid))
+      {
+        watches.push_back(
+          watchNotifications(devicePath, proxy->getObjectPath(), uuid));
+        calls.push_back(
+          {proxy, makeCall(*proxy, GATT_CHAR_INTERFACE, "StartNotify")});
+      }
+    }
+    std::map<std::string, sdbus::Variant> readOptions;
+    for (const std::string& uuid : profile.read)
+    {
+      if (sdbus::IProxy* proxy = addCall(uuid))
+        calls.push_back({proxy, makeCall(*proxy, GATT_CHAR_INTERFACE,
+                                         "ReadValue", readOptions)});
+    }
+
+    auto results = awaitReplies(calls, options);
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      recordCall(devicePath, results[i]);
+      if (!results[i])
+      {
+        std::cerr << "   " << uuids[i] << ": " << results[i].error().name
+                  << ": " << results[i].error().message << std::endl;
+      }
+      else if (i < watches.size())
+      {
+        std::cout << "   Subscribed to " << uuids[i] << std::endl;
+        keepNotification(devicePath, uuids[i], std::move(watches[i]));
+      }
+      else
+      {
+        std::vector<uint8_t> value;
+        results[i].value() >> value;
+        std::cout << "   Read " << uuids[i] << ": ";
+        printHexData(value);
+        std::cout << std::endl;
+        rememberValue(devicePath, uuids[i], value);
+      }
+    }
+  }
+
+  // Caller must hold devicesMutex
+  const DeviceRecord* findTarget(const std::string& target) const
+  {
+    uint64_t address;
+    if (FleetAllowlist::parseAddress(target.c_str(), address))
+      return devices.findByAddress(target);
+
+    const DeviceRecord* best = nullptr;
+    for (const DeviceRecord* device : devices.findByNamePrefix(target))
+    {
+      if (device->name == target &&
+          (!best || device->lastSeen > best->lastSeen))
+        best = device;
+    }
+    return best;
+  }
+
+  // Runs discovery until `done(since, found)` reports success. The check is
+  // re-evaluated every time a signal updates the table, so the scan ends as
+  // soon as the condition holds rather than after a fixed duration.
+  template <typename Done>
+  std::vector<std::string> scanUntil(Done                      done,
+                                     std::chrono::milliseconds timeout)
+  {
+    using Clock = DeviceTable::Clock;
+
+    bool standalone;
+    {
+      std::lock_guard<std::mutex> lock(devicesMutex);
+      standalone = !continuousScan;
+    }
+
+    // Seed the table with BlueZ's cached objects so that signals for known
+    // devices merge onto complete records
+    if (standalone)
+      subscribeDeviceSignals();
+    updateDeviceList();
+
+    auto start    = Clock::now();
+    auto deadline = start + timeout;
+    startDiscovery();
+
+    std::vector<std::string> found;
+    bool                     complete;
+    {
+      std::unique_lock<std::mutex> lock(devicesMutex);
+      ++scanWaiters;
+      complete = scanProgress.wait_until(
+        lock, deadline, [&] { return done(start, found); });
+      --scanWaiters;
+    }
+
+    stopDiscovery();
+    if (standalone)
+      scanSlots.clear();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now() - start);
+    std::cout << (complete ? "Found " : "Timed out; found ") << found.size()
+              << " target(s) in " << elapsed.count() << " ms." << std::endl;
+    return found;
+  }
+
+  // Allowlist check done before a signal's payload is deserialized
+  bool admitted(const char* path)
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    if (!allowlist.active())
+      return true;
+
+    ++allowlistChecked;
+    if (allowlist.admitsDevicePath(path))
+      return true;
+
+    ++allowlistRejected;
+    return false;
+  }
+
+  void onDeviceAdded(const std::string&                           path,
+                     const std::map<std::string, sdbus::Variant>& props)
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    auto                        now = DeviceTable::Clock::now();
+
+    // InterfacesAdded carries the full property set, so it may admit a
+    // device a filter rejected earlier
+    if (!devices.upsert(path, props, now))
+      devices.touch(path, now);
+    advertisements.prime(path, props);
+    if (continuousScan)
+      enforceEvictionPolicy(now);
+    if (scanWaiters > 0)
+      scanProgress.notify_all();
+  }
+
+  // Every advertisement refreshes last-seen, but property content only
+  // reaches the table through the coalescer.
+  void onDeviceUpdate(const std::string&                           path,
+                      const std::map<std::string, sdbus::Variant>& changed,
+                      const std::vector<std::string>&              invalidated)
+  {
+    bool windowOpened;
+    {
+      std::lock_guard<std::mutex> lock(devicesMutex);
+      auto                        now = DeviceTable::Clock::now();
+
+      devices.touch(path, now);
+      windowOpened = advertisements.submit(path, changed, invalidated, now);
+      flushAdvertisements(now);
+
+      if (scanWaiters > 0)
+        scanProgress.notify_all();
     }
-    catch (const sdbus::Error& e)
+
+    if (windowOpened && advertisements.getWindow().count() > 0)
+      maintenanceWakeup.notify_one();
+  }
+
+  // Caller must hold devicesMutex
+  void flushAdvertisements(DeviceTable::Clock::time_point now)
+  {
+    if (advertisements.drainDue(now, coalescedUpdates) == 0)
+      return;
+
+    for (const auto& update : coalescedUpdates)
     {
-      std::cerr << "Error reading characteristic: " << e.what() << std::endl;
+      devices.merge(update.path, update.changed, update.invalidated, now);
     }
+    coalescedUpdates.clear();
+
+    if (continuousScan)
+      enforceEvictionPolicy(now);
   }
 
-  static void printHexData(const std::vector<uint8_t>& data)
+  // Caller must hold devicesMutex
+  void enforceEvictionPolicy(DeviceTable::Clock::time_point now)
   {
-    std::cout << "0x";
-    for (uint8_t byte : data)
+    auto evicted = devices.evict(evictionPolicy, now, isPinned);
+
+    // Drop evicted devices from BlueZ as well so its object tree stays
+    // bounded; a device that advertises again is re-added by BlueZ.
+    for (const auto& path : evicted)
     {
-      std::cout << std::hex << std::setw(2) << std::setfill('0')
-                << static_cast<uint16_t>(byte) << " ";
+      advertisements.forget(path);
+      adapterProxy->callMethodAsync("RemoveDevice")
+        .onInterface(ADAPTER_INTERFACE)
+        .withArguments(sdbus::ObjectPath(path))
+        .uponReplyInvoke([](std::optional<sdbus::Error>) {});
     }
-    std::cout << std::dec << " (";
-    for (uint8_t byte : data)
+  }
+
+  // Sleeps until the next coalescing window closes, the oldest device would
+  // exceed the age limit or the duty cycle switches phase, so an idle table
+  // causes no periodic wakeups.
+  void maintenanceLoop()
+  {
+    using Clock = DeviceTable::Clock;
+
+    int64_t                      slack = 0;
+    std::unique_lock<std::mutex> lock(devicesMutex);
+    while (continuousScan)
     {
-      if (byte >= 32 && byte < 127)
+      auto now = Clock::now();
+      flushAdvertisements(now);
+      enforceEvictionPolicy(now);
+      updateRadio(now);
+
+      Clock::time_point deadline = Clock::time_point::max();
+      // Pinned devices are never evicted, however stale, so only the
+      // oldest unpinned one sets the age deadline. It is never in the past
+      // either, so a record evict() skips cannot make this loop spin.
+      if (evictionPolicy.maxAge.count() > 0)
       {
-        std::cout << (char)byte;
+        Clock::time_point oldest = now;
+        devices.oldestSeen(oldest, isPinned);
+        deadline = std::max(oldest + evictionPolicy.maxAge, now) +
+                   std::chrono::milliseconds(1);
       }
+
+      Clock::time_point flushAt;
+      if (advertisements.nextDeadline(flushAt))
+        deadline = std::min(deadline, flushAt);
+
+      Clock::time_point transitionAt;
+      if (radio.nextTransition(now, transitionAt))
+        deadline = std::min(deadline, transitionAt);
+
+      Clock::time_point retryAt;
+      if (radio.nextRetry(now, retryAt))
+        deadline = std::min(deadline, retryAt);
+
+      idleMode.applyToThread(slack);
+      if (deadline == Clock::time_point::max())
+        maintenanceWakeup.wait(lock);
+      else
+        maintenanceWakeup.wait_until(lock, idleMode.coalesce(deadline));
+    }
+  }
+
+  // Brings the adapter's discovery state in line with the radio scheduler.
+  // Caller must hold devicesMutex; the call is asynchronous so the lock is
+  // never held across a round trip.
+  void updateRadio(DeviceTable::Clock::time_point now)
+  {
+    if (!radio.needsRequest(now))
+      return;
+
+    bool wanted = radio.wantsDiscovery(now);
+    radio.beginRequest();
+    const char* method = wanted ? "StartDiscovery" : "StopDiscovery";
+    adapterProxy->callMethodAsync(method)
+      .onInterface(ADAPTER_INTERFACE)
+      .uponReplyInvoke([this, method, wanted](
+                         std::optional<sdbus::Error> error) {
+        if (error)
+          std::cerr << method << " failed: " << error->what() << std::endl;
+
+        // The state is only recorded once the adapter has confirmed it.
+        // What is wanted may have changed while the call was in flight; a
+        // failure is retried by the next updateRadio() after RETRY_DELAY,
+        // which the maintenance loop wakes up for.
+        std::lock_guard<std::mutex> lock(devicesMutex);
+        auto                        replied = DeviceTable::Clock::now();
+        radio.finishRequest(wanted, !error, replied);
+        updateRadio(replied);
+        if (error)
+          maintenanceWakeup.notify_all();
+      });
+  }
+
+  // Issues Device1.Connect with discovery paused for its duration (if the
+  // radio policy says so) and records how long it took
+  Result<void> callConnect(sdbus::IProxy&     deviceProxy,
+                           const CallOptions& options)
+  {
+    using Clock = DeviceTable::Clock;
+
+    ConnectMode mode;
+    {
+      std::lock_guard<std::mutex> lock(devicesMutex);
+      mode = radio.beginConnect();
+      updateRadio(Clock::now());
+    }
+
+    auto started = Clock::now();
+    auto reply   = invoke(deviceProxy, DEVICE_INTERFACE, "Connect", options);
+    {
+      std::lock_guard<std::mutex> lock(devicesMutex);
+      auto                        now = Clock::now();
+      radio.endConnect(mode, now - started, reply.ok());
+      updateRadio(now);
+    }
+    if (!reply)
+      return reply.error();
+    return {};
+  }
+
+  void pollLoop()
+  {
+    std::vector<PollScheduler::Id> due;
+    int64_t                        slack = 0;
+    std::unique_lock<std::mutex>   lock(pollMutex);
+    while (polling)
+    {
+      due.clear();
+      polls.due(PollScheduler::Clock::now(), due);
+      for (PollScheduler::Id id : due)
+        startPoll(id);
+
+      PollScheduler::Clock::time_point next;
+      idleMode.applyToThread(slack);
+      if (polls.nextDue(next))
+        pollWakeup.wait_until(lock, idleMode.coalesce(next));
       else
+        pollWakeup.wait(lock);
+    }
+  }
+
+  // Sends one poll's ReadValue without waiting for the reply. Caller must
+  // hold pollMutex.
+  void startPoll(PollScheduler::Id id)
+  {
+    PollEntry* entry = polls.find(id);
+    if (!entry)
+      return;
+
+    std::string charPath;
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      const Connection*           link = connections.find(entry->device);
+      if (link && link->linkUp)
       {
-        std::cout << ".";
+        auto it = link->characteristics.find(entry->uuid);
+        if (it != link->characteristics.end())
+          charPath = it->second;
       }
     }
-    std::cout << ")";
+    if (charPath.empty() || entry->inFlight)
+    {
+      ++entry->skipped;
+      return;
+    }
+
+    // Object paths can change across reconnects
+    auto& proxy = pollProxies[id];
+    if (!proxy || proxy->getObjectPath() != charPath)
+      proxy = sdbus::createProxy(*connection, sdbus::ServiceName(BLUEZ_SERVICE),
+                                 sdbus::ObjectPath{charPath});
+
+    auto timeout = std::max<std::chrono::microseconds>(
+      entry->interval, std::chrono::seconds(1));
+    entry->inFlight = true;
+    ++entry->polls;
+    proxy->callMethodAsync(
+      makeCall(*proxy, GATT_CHAR_INTERFACE, "ReadValue", defaultReadOptions()),
+      [this, id, devicePath = entry->device,
+       uuid = router->internUuid(entry->uuid)](
+        sdbus::MethodReply reply, std::optional<sdbus::Error> error) {
+        AllocationScope allocations(replyAllocations);
+        {
+          std::lock_guard<std::mutex> lock(pollMutex);
+          if (PollEntry* polled = polls.find(id))
+          {
+            polled->inFlight = false;
+            if (error)
+              ++polled->failures;
+          }
+        }
+        if (error)
+        {
+          recordCall(devicePath,
+                     DeviceHealth::classify(error->getName(),
+                                            error->getMessage()),
+                     error->getName());
+          return;
+        }
+        recordCall(devicePath, CallOutcome::Success);
+
+        router->deliverValue(devicePath, uuid, readBytes(reply), "POLL");
+      },
+      timeout);
   }
 
-  void processEvents() { connection->enterEventLoopAsync(); }
+  void stopPolling()
+  {
+    {
+      std::lock_guard<std::mutex> lock(pollMutex);
+      polling = false;
+    }
+    pollWakeup.notify_all();
+    if (pollThread.joinable())
+      pollThread.join();
+    pollProxies.clear();
+  }
 
-  std::string getConnectedDevice() const { return connectedDevice; }
-  const std::map<std::string, std::map<std::string, sdbus::Variant>>&
-  getDevices() const
+  void stopMaintenance()
   {
-    return devices;
+    {
+      std::lock_guard<std::mutex> lock(devicesMutex);
+      continuousScan = false;
+    }
+    maintenanceWakeup.notify_all();
+    if (maintenanceThread.joinable())
+      maintenanceThread.join();
   }
 };
 
@@ -574,24 +3278,116 @@ void printMenu()
   std::cout << "9.  Disable notifications" << std::endl;
   std::cout << "10. Write to characteristic" << std::endl;
   std::cout << "11. Read from characteristic" << std::endl;
+  std::cout << "12. Show device changes since generation" << std::endl;
+  std::cout << "13. Find device by address" << std::endl;
+  std::cout << "14. List strongest devices" << std::endl;
+  std::cout << "15. List recently seen devices" << std::endl;
+  std::cout << "16. List devices by name prefix" << std::endl;
+  std::cout << "17. Start continuous scan" << std::endl;
+  std::cout << "18. Stop continuous scan" << std::endl;
+  std::cout << "19. Show device table statistics" << std::endl;
+  std::cout << "20. List devices matching filter" << std::endl;
+  std::cout << "21. Set scan filter" << std::endl;
+  std::cout << "22. Load fleet allowlist" << std::endl;
+  std::cout << "23. Save allowlist in binary format" << std::endl;
+  std::cout << "24. Scan until targets found" << std::endl;
+  std::cout << "25. Scan until filter matches" << std::endl;
+  std::cout << "26. Set radio policy" << std::endl;
+  std::cout << "27. Radio statistics" << std::endl;
+  std::cout << "28. Connect to best filter match" << std::endl;
+  std::cout << "29. List connections" << std::endl;
+  std::cout << "30. Set connection limit" << std::endl;
+  std::cout << "31. Show device health" << std::endl;
+  std::cout << "32. Set operation timeout" << std::endl;
+  std::cout << "33. Set connection profile" << std::endl;
+  std::cout << "34. List connection profiles" << std::endl;
+  std::cout << "35. Provision fleet" << std::endl;
+  std::cout << "36. Firmware transfer" << std::endl;
+  std::cout << "37. Snapshot device GATT database" << std::endl;
+  std::cout << "38. Reconcile device configuration" << std::endl;
+  std::cout << "39. Poll characteristic" << std::endl;
+  std::cout << "40. Stop polling" << std::endl;
+  std::cout << "41. List polls" << std::endl;
+  std::cout << "42. Set idle mode" << std::endl;
+  std::cout << "43. Measure wakeups" << std::endl;
+  std::cout << "44. Run device workflows" << std::endl;
+  std::cout << "45. Callback executor statistics" << std::endl;
+  std::cout << "46. Subscribe to notification batches" << std::endl;
+  std::cout << "47. Stop notification batches" << std::endl;
+  std::cout << "48. Heap allocation report" << std::endl;
+  std::cout << "49. Check notification path allocations" << std::endl;
   std::cout << "0.  Exit" << std::endl;
   std::cout << "\nChoice: ";
 }
 
+// Ctrl-C cancels the BlueZ operation in progress; at the menu it exits.
+// SIGINT is blocked in every thread and taken by a sigwait() thread, since
+// cancelling from a signal handler would not be async-signal-safe.
+class InterruptCanceller
+{
+private:
+  sigset_t          signals;
+  std::mutex        mutex;
+  CancellationToken current;
+  bool              busy = false;
+
+public:
+  InterruptCanceller()
+  {
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    std::thread([this] {
+      int signal;
+      while (sigwait(&signals, &signal) == 0)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!busy)
+          std::_Exit(130);
+        std::cout << "\nCancelling..." << std::endl;
+        current.cancel();
+      }
+    }).detach();
+  }
+
+  // Options for the next menu operation, cancellable with Ctrl-C
+  CallOptions begin(std::chrono::milliseconds timeout)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    current = CancellationToken::create();
+    busy    = true;
+    return CallOptions::within(timeout, current);
+  }
+
+  void end()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    busy = false;
+  }
+};
+
 int main()
 {
   try
   {
+    // Before any other thread exists, so they all inherit the signal mask
+    InterruptCanceller interrupts;
+
     BluetoothManager btManager;
     btManager.processEvents();
 
-    int choice;
+    std::chrono::milliseconds operationTimeout(0);
+    int                       choice;
     while (true)
     {
       printMenu();
       std::cin >> choice;
       std::cin.ignore();
 
+      // Each operation reads its input first and only then starts its
+      // deadline, so typing does not use it up and Ctrl-C at a prompt still
+      // exits.
       switch (choice)
       {
         case 1:
@@ -600,7 +3396,8 @@ int main()
           std::cout << "Scan duration (seconds): ";
           std::cin >> duration;
           std::cin.ignore();
-          btManager.scanDevices(duration);
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.scanDevices(duration, options.token);
           break;
         }
         case 2:
@@ -610,7 +3407,7 @@ int main()
         case 3:
         {
           std::string serviceUUID;
-          std::cout << "Enter service UUID (partial match): ";
+          std::cout << "Enter service UUID (short form, full or prefix): ";
           std::getline(std::cin, serviceUUID);
           btManager.listDevices(serviceUUID);
           break;
@@ -618,33 +3415,45 @@ int main()
         case 4:
         {
           std::string devicePath;
-          std::cout << "Enter device path: ";
+          std::cout << "Enter device path or address: ";
           std::getline(std::cin, devicePath);
-          btManager.connectToDevice(devicePath);
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.connectToDevice(devicePath, options);
           break;
         }
         case 5:
-          btManager.disconnectFromDevice();
+        {
+          std::string devicePath;
+          std::cout << "Enter device path or address (empty for current): ";
+          std::getline(std::cin, devicePath);
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.disconnectFromDevice(devicePath, options);
           break;
+        }
 
         case 6:
         {
           std::string devicePath;
-          std::cout << "Enter device path: ";
+          std::cout << "Enter device path or address: ";
           std::getline(std::cin, devicePath);
-          btManager.forgetDevice(devicePath);
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.forgetDevice(devicePath, options);
           break;
         }
         case 7:
-          btManager.listCharacteristics();
+        {
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.listCharacteristics(options);
           break;
+        }
 
         case 8:
         {
           std::string uuid;
           std::cout << "Enter characteristic UUID: ";
           std::getline(std::cin, uuid);
-          btManager.enableNotify(uuid);
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.enableNotify(uuid, options);
           break;
         }
         case 9:
@@ -652,12 +3461,15 @@ int main()
           std::string uuid;
           std::cout << "Enter characteristic UUID: ";
           std::getline(std::cin, uuid);
-          btManager.disableNotify(uuid);
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.disableNotify(uuid, options);
           break;
         }
         case 10:
         {
-          std::string uuid, hexData;
+          std::string device, uuid, hexData;
+          std::cout << "Enter device path or address (empty for current): ";
+          std::getline(std::cin, device);
           std::cout << "Enter characteristic UUID: ";
           std::getline(std::cin, uuid);
           std::cout << "Enter hex data (e.g., 01 02 03): ";
@@ -671,17 +3483,504 @@ int main()
             data.push_back(std::stoi(byteStr, nullptr, 16));
           }
 
-          btManager.writeCharacteristic(uuid, data);
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.writeCharacteristic(device, uuid, data, options);
           break;
         }
         case 11:
         {
-          std::string uuid;
+          std::string device, uuid;
+          std::cout << "Enter device path or address (empty for current): ";
+          std::getline(std::cin, device);
           std::cout << "Enter characteristic UUID: ";
           std::getline(std::cin, uuid);
-          btManager.readCharacteristic(uuid);
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.readCharacteristic(device, uuid, options);
+          break;
+        }
+        case 12:
+        {
+          uint64_t generation;
+          std::cout << "Current generation: " << btManager.getGeneration()
+                    << std::endl;
+          std::cout << "Changes since generation: ";
+          std::cin >> generation;
+          std::cin.ignore();
+          btManager.listChanges(generation);
+          break;
+        }
+        case 13:
+        {
+          std::string address;
+          std::cout << "Enter device address: ";
+          std::getline(std::cin, address);
+          btManager.findDeviceByAddress(address);
+          break;
+        }
+        case 14:
+        case 15:
+        {
+          size_t count;
+          std::cout << "Number of devices: ";
+          std::cin >> count;
+          std::cin.ignore();
+          if (choice == 14)
+            btManager.listStrongestDevices(count);
+          else
+            btManager.listRecentDevices(count);
+          break;
+        }
+        case 16:
+        {
+          std::string prefix;
+          std::cout << "Enter name prefix: ";
+          std::getline(std::cin, prefix);
+          btManager.listDevicesByName(prefix);
+          break;
+        }
+        case 17:
+        {
+          EvictionPolicy policy;
+          size_t         maxKiB;
+          long           maxAge;
+          long           windowMs;
+          std::cout << "Maximum devices (0 = unlimited): ";
+          std::cin >> policy.maxEntries;
+          std::cout << "Maximum table size in KiB (0 = unlimited): ";
+          std::cin >> maxKiB;
+          std::cout << "Evict devices unseen for seconds (0 = never): ";
+          std::cin >> maxAge;
+          std::cout << "Coalescing window in ms (0 = off): ";
+          std::cin >> windowMs;
+          std::cin.ignore();
+          policy.maxBytes = maxKiB * 1024;
+          policy.maxAge   = std::chrono::seconds(maxAge);
+          btManager.startContinuousScan(policy,
+                                        std::chrono::milliseconds(windowMs));
+          break;
+        }
+        case 18:
+          btManager.stopContinuousScan();
+          break;
+
+        case 19:
+          btManager.showTableStats();
+          break;
+
+        case 20:
+        case 21:
+        {
+          std::string expression;
+          std::cout << "Filter (e.g. rssi > -70 && name ~ \"^SENS-\"): ";
+          std::getline(std::cin, expression);
+          if (choice == 20)
+            btManager.listDevicesMatching(expression);
+          else
+            btManager.setScanFilter(expression);
+          break;
+        }
+        case 22:
+        {
+          std::string path;
+          std::cout << "Allowlist file (empty to disable): ";
+          std::getline(std::cin, path);
+          btManager.loadAllowlist(path);
+          break;
+        }
+        case 23:
+        {
+          std::string path;
+          std::cout << "Output file: ";
+          std::getline(std::cin, path);
+          btManager.saveAllowlist(path);
+          break;
+        }
+        case 24:
+        case 25:
+        {
+          std::string input;
+          long        timeout;
+          if (choice == 24)
+            std::cout << "Targets (addresses or names, comma-separated): ";
+          else
+            std::cout << "Filter: ";
+          std::getline(std::cin, input);
+          std::cout << "Timeout (seconds): ";
+          std::cin >> timeout;
+          std::cin.ignore();
+
+          std::vector<std::string> found;
+          if (choice == 24)
+          {
+            std::vector<std::string> targets;
+            std::istringstream       iss(input);
+            std::string              target;
+            while (std::getline(iss, target, ','))
+            {
+              target.erase(0, target.find_first_not_of(' '));
+              target.erase(target.find_last_not_of(' ') + 1);
+              if (!target.empty())
+                targets.push_back(target);
+            }
+            found = btManager.scanForTargets(targets,
+                                             std::chrono::seconds(timeout));
+          }
+          else
+          {
+            DeviceFilter filter;
+            std::string  error;
+            if (!DeviceFilter::compile(input, filter, error))
+            {
+              std::cout << "Invalid filter: " << error << std::endl;
+              break;
+            }
+            found =
+              btManager.scanForMatch(filter, std::chrono::seconds(timeout));
+          }
+
+          for (const auto& path : found)
+          {
+            std::cout << "  " << path << std::endl;
+          }
+          break;
+        }
+        case 26:
+        {
+          char answer;
+          long scanMs;
+          long idleMs;
+          std::cout << "Pause discovery while connecting (y/n): ";
+          std::cin >> answer;
+          std::cout << "Scan window (ms, 0 for continuous): ";
+          std::cin >> scanMs;
+          std::cout << "Idle window (ms, 0 for continuous): ";
+          std::cin >> idleMs;
+          std::cin.ignore();
+
+          DutyCycle cycle;
+          cycle.scanWindow = std::chrono::milliseconds(scanMs);
+          cycle.idleWindow = std::chrono::milliseconds(idleMs);
+          btManager.setRadioPolicy(answer == 'y' || answer == 'Y', cycle);
+          break;
+        }
+        case 27:
+          btManager.showRadioStats();
+          break;
+
+        case 28:
+        {
+          std::string expression;
+          std::cout << "Filter: ";
+          std::getline(std::cin, expression);
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.connectToBestMatch(expression, options);
+          break;
+        }
+        case 29:
+          btManager.listConnections();
+          break;
+
+        case 30:
+        {
+          size_t limit;
+          std::cout << "Maximum simultaneous connections: ";
+          std::cin >> limit;
+          std::cin.ignore();
+          btManager.setConnectionLimit(limit);
+          break;
+        }
+        case 31:
+          btManager.showDeviceHealth();
+          break;
+
+        case 32:
+        {
+          long timeout;
+          std::cout << "Operation timeout (ms, 0 for the D-Bus default): ";
+          std::cin >> timeout;
+          std::cin.ignore();
+          operationTimeout = std::chrono::milliseconds(timeout);
+          break;
+        }
+        case 33:
+        {
+          std::string       device;
+          std::string       subscribe;
+          std::string       read;
+          std::string       error;
+          ConnectionProfile profile;
+          std::cout << "Device address (* for all devices): ";
+          std::getline(std::cin, device);
+          std::cout << "Characteristics to subscribe to (UUIDs): ";
+          std::getline(std::cin, subscribe);
+          std::cout << "Characteristics to read on connect (UUIDs): ";
+          std::getline(std::cin, read);
+          if (!ConnectionProfile::parseUuids(subscribe, profile.subscribe,
+                                             error) ||
+              !ConnectionProfile::parseUuids(read, profile.read, error))
+          {
+            std::cout << "Invalid profile: " << error << std::endl;
+            break;
+          }
+          btManager.setConnectionProfile(device, std::move(profile));
+          break;
+        }
+        case 34:
+          btManager.listConnectionProfiles();
+          break;
+
+        case 35:
+        {
+          std::string              devicesPath;
+          std::string              jobPath;
+          std::string              reportPath;
+          std::string              error;
+          size_t                   concurrency;
+          std::vector<std::string> devices;
+          ProvisionJob             job;
+          std::cout << "Device list file: ";
+          std::getline(std::cin, devicesPath);
+          std::cout << "Job file: ";
+          std::getline(std::cin, jobPath);
+          std::cout << "Devices in flight at once: ";
+          std::cin >> concurrency;
+          std::cin.ignore();
+          std::cout << "Report file: ";
+          std::getline(std::cin, reportPath);
+          if (!ProvisionJob::loadDevices(devicesPath, devices, error) ||
+              !ProvisionJob::load(jobPath, job, error))
+          {
+            std::cout << "Cannot provision: " << error << std::endl;
+            break;
+          }
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.provisionFleet(devices, job, concurrency, reportPath,
+                                   operationTimeout, options.token);
+          break;
+        }
+        case 36:
+        {
+          std::string device;
+          std::string imagePath;
+          std::string dataUuid;
+          std::string controlUuid;
+          size_t      window;
+          std::cout << "Enter device path or address: ";
+          std::getline(std::cin, device);
+          std::cout << "Image file: ";
+          std::getline(std::cin, imagePath);
+          std::cout << "Data characteristic UUID: ";
+          std::getline(std::cin, dataUuid);
+          std::cout << "Control characteristic UUID (empty for none): ";
+          std::getline(std::cin, controlUuid);
+          std::cout << "Writes in flight: ";
+          std::cin >> window;
+          std::cin.ignore();
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.transferFirmware(device, imagePath, dataUuid, controlUuid,
+                                     window, operationTimeout, options.token);
+          break;
+        }
+        case 37:
+        {
+          std::string device;
+          std::string outputPath;
+          std::cout << "Enter device path or address (empty for current): ";
+          std::getline(std::cin, device);
+          std::cout << "Output file: ";
+          std::getline(std::cin, outputPath);
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.snapshotDevice(device, outputPath, options);
+          break;
+        }
+        case 38:
+        {
+          std::string  device;
+          std::string  statePath;
+          std::string  error;
+          char         reread;
+          char         dryRun;
+          DesiredState state;
+          std::cout << "Enter device path or address (empty for current): ";
+          std::getline(std::cin, device);
+          std::cout << "Desired state file: ";
+          std::getline(std::cin, statePath);
+          std::cout << "Re-read values already seen (y/n): ";
+          std::cin >> reread;
+          std::cout << "Dry run (y/n): ";
+          std::cin >> dryRun;
+          std::cin.ignore();
+          if (!DesiredState::load(statePath, state, error))
+          {
+            std::cout << "Cannot reconcile: " << error << std::endl;
+            break;
+          }
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.reconcileDevice(device, state,
+                                    reread == 'y' || reread == 'Y',
+                                    dryRun == 'y' || dryRun == 'Y', options);
+          break;
+        }
+        case 39:
+        {
+          std::string device;
+          std::string uuid;
+          long        intervalMs;
+          std::cout << "Enter device path or address (empty for current): ";
+          std::getline(std::cin, device);
+          std::cout << "Characteristic UUID: ";
+          std::getline(std::cin, uuid);
+          std::cout << "Interval (ms): ";
+          std::cin >> intervalMs;
+          std::cin.ignore();
+          btManager.addPoll(device, uuid,
+                            std::chrono::milliseconds(intervalMs));
+          break;
+        }
+        case 40:
+        {
+          PollScheduler::Id id;
+          std::cout << "Poll id: ";
+          std::cin >> id;
+          std::cin.ignore();
+          btManager.removePoll(id);
+          break;
+        }
+        case 41:
+          btManager.listPolls();
+          break;
+
+        case 42:
+        {
+          long slackMs;
+          std::cout << "Timer slack (ms, 0 for off): ";
+          std::cin >> slackMs;
+          std::cin.ignore();
+          btManager.setIdleMode(std::chrono::milliseconds(slackMs));
+          break;
+        }
+        case 43:
+        {
+          long seconds;
+          std::cout << "Measurement period (seconds): ";
+          std::cin >> seconds;
+          std::cin.ignore();
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.measureWakeups(std::chrono::seconds(seconds),
+                                   options.token);
+          break;
+        }
+        case 44:
+        {
+          std::string              devicesPath;
+          std::string              notifyUuid;
+          std::string              writeUuid;
+          std::string              valueHex;
+          std::string              readUuid;
+          std::string              error;
+          std::vector<std::string> devices;
+          std::vector<uint8_t>     value;
+          std::cout << "Device list file: ";
+          std::getline(std::cin, devicesPath);
+          std::cout << "Characteristic to subscribe to (UUID): ";
+          std::getline(std::cin, notifyUuid);
+          std::cout << "Characteristic to write (UUID): ";
+          std::getline(std::cin, writeUuid);
+          std::cout << "Value to write (hex): ";
+          std::getline(std::cin, valueHex);
+          std::cout << "Characteristic to read (UUID): ";
+          std::getline(std::cin, readUuid);
+          if (!ProvisionJob::loadDevices(devicesPath, devices, error))
+          {
+            std::cout << "Cannot run workflows: " << error << std::endl;
+            break;
+          }
+          if (!ProvisionJob::parseHex(valueHex, value))
+          {
+            std::cout << "Invalid value." << std::endl;
+            break;
+          }
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.runWorkflows(devices, notifyUuid, writeUuid, value,
+                                 readUuid, operationTimeout, options.token);
+          break;
+        }
+        case 45:
+          btManager.showCallbackStats();
+          break;
+        case 46:
+        {
+          std::string              device;
+          std::string              uuidList;
+          std::string              error;
+          std::vector<std::string> uuids;
+          size_t                   maxBatch;
+          long                     latencyMs;
+          std::cout << "Enter device path or address (empty for current): ";
+          std::getline(std::cin, device);
+          std::cout << "Characteristics (UUIDs): ";
+          std::getline(std::cin, uuidList);
+          std::cout << "Maximum notifications per batch: ";
+          std::cin >> maxBatch;
+          std::cout << "Maximum latency (ms): ";
+          std::cin >> latencyMs;
+          std::cin.ignore();
+          if (!ConnectionProfile::parseUuids(uuidList, uuids, error) ||
+              uuids.empty())
+          {
+            std::cout << "Invalid characteristics: "
+                      << (error.empty() ? "none given" : error) << std::endl;
+            break;
+          }
+
+          auto printBatch =
+            [uuids](std::span<const NotificationRecord> records) {
+              std::vector<size_t> counts(uuids.size(), 0);
+              size_t              bytes = 0;
+              for (const NotificationRecord& record : records)
+              {
+                ++counts[record.handle];
+                bytes += record.payload.size();
+              }
+              auto span =
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                  records.back().timestamp - records.front().timestamp);
+
+              std::ostringstream line;
+              line << "\n[BATCH] " << records.size() << " notifications, "
+                   << bytes << " bytes over " << span.count() << " ms:";
+              for (size_t i = 0; i < uuids.size(); ++i)
+                line << " " << uuids[i] << " x" << counts[i];
+              std::cout << line.str() << std::endl;
+            };
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.subscribeBatches(device, uuids, maxBatch,
+                                     std::chrono::milliseconds(latencyMs),
+                                     printBatch, options);
+          break;
+        }
+        case 47:
+        {
+          uint64_t id;
+          std::cout << "Batch subscription id: ";
+          std::cin >> id;
+          std::cin.ignore();
+          CallOptions options = interrupts.begin(operationTimeout);
+          btManager.unsubscribeBatches(id, options);
+          break;
+        }
+        case 48:
+          btManager.showAllocations();
+          break;
+        case 49:
+        {
+          std::string uuid;
+          std::cout << "Characteristic to measure writes on (empty to skip): ";
+          std::getline(std::cin, uuid);
+          btManager.checkAllocations(uuid);
           break;
         }
+
         case 0:
           std::cout << "Exiting..." << std::endl;
           return 0;
@@ -689,8 +3988,7 @@ int main()
         default:
           std::cout << "Invalid choice." << std::endl;
       }
-
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      interrupts.end();
     }
   }
   catch (const std::exception& e)
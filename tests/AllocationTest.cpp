@@ -0,0 +1,174 @@
+// Checks that the value paths stop allocating once warmed up: the
+// notification and batch handlers with the callbacks they hand off to, and
+// single characteristic writes. Needs no bus or BlueZ: the signal is built
+// on a peer-to-peer connection over a socketpair, and writes go to a stub
+// proxy that answers from a thread of its own, as sdbus-c++ does from its
+// event loop. Built with the allocation hooks, whatever the main build
+// uses; fails on any allocation after warm-up.
+
+#include <sys/socket.h>
+
+#include <sdbus-c++/sdbus-c++.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AllocationTracker.h"
+#include "BusLoop.h"
+#include "CallControl.h"
+#include "CallbackExecutor.h"
+#include "GattValue.h"
+#include "IdleMode.h"
+#include "NotificationRouter.h"
+
+namespace
+{
+const size_t ROUNDS = 1024;
+
+// Builds calls with a real proxy and answers each with an empty reply
+class StubProxy
+{
+public:
+  using Handler = sdbus::IProxy::async_reply_handler;
+
+private:
+  std::unique_ptr<sdbus::IProxy> proxy;
+  std::mutex                     mutex;
+  std::condition_variable        wakeup;
+  std::optional<Handler>         pending;
+  bool                           stopping = false;
+  std::thread                    replier;
+
+  void reply()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      wakeup.wait(lock, [this] { return stopping || pending; });
+      if (stopping)
+        return;
+      Handler handler = std::move(*pending);
+      pending.reset();
+      lock.unlock();
+      handler(sdbus::MethodReply{}, std::nullopt);
+      lock.lock();
+    }
+  }
+
+public:
+  StubProxy(sdbus::IConnection& connection, const std::string& path)
+    : proxy(sdbus::createProxy(connection, sdbus::ServiceName("org.bluez"),
+                               sdbus::ObjectPath{path})),
+      replier([this] { reply(); })
+  {
+  }
+
+  ~StubProxy()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeup.notify_all();
+    replier.join();
+  }
+
+  StubProxy(const StubProxy&)            = delete;
+  StubProxy& operator=(const StubProxy&) = delete;
+
+  sdbus::MethodCall
+  createMethodCall(const sdbus::InterfaceName& interfaceName,
+                   const sdbus::MethodName&    method) const
+  {
+    return proxy->createMethodCall(interfaceName, method);
+  }
+
+  sdbus::PendingAsyncCall callMethodAsync(const sdbus::MethodCall&,
+                                          Handler handler,
+                                          std::chrono::microseconds)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending = std::move(handler);
+    }
+    wakeup.notify_all();
+    return {};
+  }
+};
+
+// Writes through writeValue() as writeCharacteristic() does, counting what
+// the whole process allocates, the stub's reply thread included
+bool checkWrites(sdbus::IConnection& connection)
+{
+  StubProxy proxy(connection, "/org/bluez/selfcheck/service0001/char0002");
+  std::vector<uint8_t> data(20, 0x5a);
+
+  auto write = [&] {
+    return bool(writeValue(proxy, data,
+                           CallOptions::within(std::chrono::seconds(5))));
+  };
+  for (size_t i = 0; i < 16; ++i)
+  {
+    if (!write())
+    {
+      std::cout << "Warm-up write failed" << std::endl;
+      return false;
+    }
+  }
+
+  AllocationCounts before  = AllocationTracker::total();
+  size_t           written = 0;
+  for (size_t i = 0; i < ROUNDS; ++i)
+  {
+    if (write())
+      ++written;
+  }
+  AllocationCounts after     = AllocationTracker::total();
+  uint64_t         allocated = after.allocations - before.allocations;
+  bool             clean     = written == ROUNDS && allocated == 0;
+  std::cout << "Write: " << written << " of " << ROUNDS << " written, "
+            << allocated << " allocations  " << (clean ? "PASS" : "FAIL")
+            << std::endl;
+  return clean;
+}
+} // namespace
+
+int main()
+{
+  if (!AllocationTracker::enabled)
+  {
+    std::cout << "Built without the allocation hooks" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0)
+  {
+    std::cout << "socketpair failed" << std::endl;
+    return EXIT_FAILURE;
+  }
+  auto server     = sdbus::createServerBus(sockets[0]);
+  auto connection = sdbus::createDirectBusConnection(sockets[1]);
+
+  IdleMode           idle;
+  BusLoop            loop(*connection, idle);
+  CallbackExecutor   callbacks;
+  NotificationRouter router(
+    callbacks, loop,
+    [](const std::string&, const std::string&, std::span<const uint8_t>) {});
+
+  // The loop is never run, so this thread stands in for its thread, where
+  // the handlers are called
+  bool passed = router.checkAllocations(*connection, std::cout, ROUNDS);
+  passed      = checkWrites(*connection) && passed;
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}